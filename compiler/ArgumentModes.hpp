@@ -0,0 +1,181 @@
+#ifndef ARGUMENT_MODES_HPP
+#define ARGUMENT_MODES_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "Node.hpp"
+
+/*
+    Chooses how scalar arguments are passed. A procedure normally receives the address of every
+    argument and reaches it through LOADI/STOREI. A mod/ref pass over the procedures, which only call
+    the ones declared before them, finds the arguments a procedure writes, directly or by passing them
+    on to an argument the called procedure writes. The others can be copied in by the caller (V_ARG),
+    the written ones copied in and back out after the call (VR_ARG), either way the procedure accesses
+    its own cell directly. A mode is changed only if no call site may pass the same variable to another
+    argument the procedure writes (to any other argument for VR_ARG) and the copies are estimated to be
+    cheaper than the indirection, weighting accesses and call sites by their loop nesting. At -Os
+    cheaper means fewer instructions, counted once per access and call site, and cycles only decide
+    ties; copying in costs no more instructions than passing the address, so unwritten arguments are
+    always copied in where that is safe, which lets sccp fold the constants they receive.
+*/
+class ArgumentModes {
+public:
+    void run(const std::vector<ProcedureNode*>& procedures, Node* main) {
+        for (auto procedure : procedures) {
+            Token* name = procedure->children[0]->token;
+            Usage& usage = usages[name];
+            usage.formals = name->getArgs();
+            usage.written.assign(usage.formals.size(), false);
+            usage.savings.assign(usage.formals.size(), 0);
+            usage.shrinks.assign(usage.formals.size(), 0);
+            visit(procedure->children[1], usage, 1);
+        }
+        Usage body;
+        visit(main, body, 1);
+
+        // Callers are decided first, whether their arguments are still references matters for aliasing
+        for (auto it = procedures.rbegin(); it != procedures.rend(); ++it) {
+            decide((*it)->children[0]->token);
+        }
+    }
+
+private:
+    static constexpr long long LOOP_WEIGHT = 10;    // Assumed iterations of a loop
+    static constexpr long long MAX_WEIGHT = 1000000;
+
+    // Differences in cost against passing by reference, see ProcCallNode and AssignmentCommandNode
+    static constexpr long long READ_SAVING = 10;        // LOAD instead of LOADI
+    static constexpr long long WRITE_SAVING = 40;       // STORE instead of the address juggling for STOREI
+    static constexpr long long PASS_SAVING = -40;       // The callee passes its own cell on with SET instead of LOAD
+    static constexpr long long INPUT_SAVING = 20;       // GET into the cell instead of GET and STOREI, see ReadCommandNode
+
+    // The same in instructions, for -Os; LOAD and LOADI, SET and LOAD are one instruction each
+    static constexpr long long WRITE_SHRINK = 2;        // LOAD 4 and STORE instead of LOAD, STORE 3, LOAD 4 and STOREI
+    static constexpr long long INPUT_SHRINK = 1;
+    static constexpr long long COPY_OUT_SIZE = 2;       // LOAD and STORE or STOREI after every call for VR_ARG
+
+    struct Call {
+        std::vector<Token*> actuals;
+        long long weight;
+    };
+
+    struct Usage {
+        std::vector<Token*> formals;
+        std::vector<bool> written;
+        std::vector<long long> savings;     // Cost saved per run of the procedure if accessed directly
+        std::vector<long long> shrinks;     // Instructions saved if accessed directly
+    };
+
+    std::unordered_map<const Token*, Usage> usages;             // By procedure
+    std::unordered_map<const Token*, std::vector<Call>> calls;  // By called procedure
+
+    static long long deeper(long long weight) {
+        return std::min(weight * LOOP_WEIGHT, MAX_WEIGHT);
+    }
+
+    static long long position(const Usage& usage, const Token* token) {
+        auto found = std::find(usage.formals.begin(), usage.formals.end(), token);
+        return found == usage.formals.end() ? -1 : found - usage.formals.begin();
+    }
+
+    // Collects writes, weighted accesses and calls of the arguments of one procedure or main
+    void visit(Node* node, Usage& usage, long long weight) {
+        NodeKind type = node->kind;
+        if (node->isLoop()) {
+            weight = deeper(weight);
+        }
+
+        if ((type == NodeKind::ASSIGNMENT_COMMAND || type == NodeKind::READ_COMMAND) && node->children[0]->kind == NodeKind::IDENTIFIER) {
+            long long i = position(usage, node->children[0]->token);
+            if (i >= 0) {
+                usage.written[i] = true;
+                bool assigned = type == NodeKind::ASSIGNMENT_COMMAND;
+                usage.savings[i] += weight * (assigned ? WRITE_SAVING : INPUT_SAVING);
+                usage.shrinks[i] += assigned ? WRITE_SHRINK : INPUT_SHRINK;
+            }
+            for (size_t j = 1; j < node->children.size(); j++) {
+                visit(node->children[j], usage, weight);
+            }
+            return;
+        }
+
+        if (type == NodeKind::IDENTIFIER) {
+            long long i = position(usage, node->token);
+            if (i >= 0) {
+                usage.savings[i] += weight * READ_SAVING;
+            }
+        }
+
+        if (type == NodeKind::PROC_CALL) {
+            Call call{{}, weight};
+            node->children[0]->build(&call.actuals);        // Only gathers the tokens of ARGS
+            const Usage& callee = usages[node->token];
+            for (size_t j = 0; j < call.actuals.size() && j < callee.written.size(); j++) {
+                long long i = position(usage, call.actuals[j]);
+                if (i >= 0) {
+                    usage.written[i] = usage.written[i] || callee.written[j];
+                    usage.savings[i] += weight * PASS_SAVING;
+                }
+            }
+            calls[node->token].push_back(call);
+            return;
+        }
+
+        for (auto child : node->children) {
+            visit(child, usage, weight);
+        }
+    }
+
+    // Variables of the caller that may be the same memory, references passed to the caller may alias
+    static bool alias(const Token* a, const Token* b) {
+        return a == b || (a->getFunction() == TokenFunction::ARG && b->getFunction() == TokenFunction::ARG);
+    }
+
+    void decide(Token* procedure) {
+        Usage& usage = usages[procedure];
+        const std::vector<Call>& sites = calls[procedure];
+        if (sites.empty()) {
+            return;     // Never called, nothing to gain
+        }
+
+        for (size_t i = 0; i < usage.formals.size(); i++) {
+            if (usage.formals[i]->getFunction() != TokenFunction::ARG) {
+                continue;
+            }
+            bool written = usage.written[i];
+            bool safe = true;
+            long long gain = 0;
+            long long shrink = usage.shrinks[i];
+
+            for (const auto& site : sites) {
+                if (site.actuals.size() != usage.formals.size()) {
+                    safe = false;       // Reported as an error when the call is built
+                    break;
+                }
+                const Token* actual = site.actuals[i];
+                for (size_t j = 0; j < site.actuals.size(); j++) {
+                    if (j != i && usage.formals[j]->getFunction() != TokenFunction::T_ARG
+                        && (written || usage.written[j]) && alias(actual, site.actuals[j])) {
+                        safe = false;
+                    }
+                }
+
+                // Copying a reference argument of the caller costs LOADI/STOREI, a variable of its own LOAD/STORE,
+                // passing by reference SET for a variable and LOAD for a reference
+                bool own = actual->getFunction() != TokenFunction::ARG;
+                long long copies = written ? (own ? 40 : 60) : (own ? 20 : 30);
+                long long reference = own ? 60 : 20;
+                gain += site.weight * (usage.savings[i] + reference - copies);
+                shrink -= written ? COPY_OUT_SIZE : 0;
+            }
+
+            if (safe && (OPTIONS.small ? shrink > 0 || (shrink == 0 && gain > 0) : gain > 0)) {
+                usage.formals[i]->setFunction(written ? TokenFunction::VR_ARG : TokenFunction::V_ARG);
+            }
+        }
+    }
+};
+
+#endif // ARGUMENT_MODES_HPP
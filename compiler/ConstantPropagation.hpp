@@ -0,0 +1,981 @@
+#ifndef CONSTANT_PROPAGATION_HPP
+#define CONSTANT_PROPAGATION_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include "Node.hpp"
+#include "ErrorHandler.hpp"
+
+/*
+    Sparse conditional constant propagation and copy propagation on SSA form. The commands of every
+    procedure and main are turned into a control flow graph of basic blocks, the definitions of scalar
+    variables are renamed into SSA values with phis at the dominance frontiers, and SCCP finds the values
+    that are constant on every path that can run together with the edges that can run at all. Tables
+    and arguments passed by reference, which may alias, are never tracked; a call ends the values of
+    every variable it may write.
+
+    Uses of constant values become numbers, so the constant index, FOR bound and expression templates
+    of code generation apply to them, and expressions of constants are folded. Uses of a copy x := y
+    read y instead while y still holds the same value. Conditionals keep only the arms that can run,
+    loops whose body never runs are dropped, REPEAT loops that never repeat become their body and
+    commands after a loop that never ends are deleted. Deleted commands are still built once so that
+    their errors are reported.
+
+    Procedures only call the ones declared before them, so main and the procedures are processed from
+    the last one: by the time a procedure is analysed every call to it has been seen, and an argument
+    copied in (V_ARG, VR_ARG) that every call that can run passes the same constant starts out as it.
+*/
+class ConstantPropagation {
+public:
+    void run(const std::vector<ProcedureNode*>& procedures, Node* main) {
+        std::vector<Diagnostic> diagnostics;
+        ErrorHandler::getInstance().capture(&diagnostics);
+
+        unit(main, nullptr);
+        for (auto it = procedures.rbegin(); it != procedures.rend(); ++it) {
+            unit((*it)->children[1], (*it)->children[0]->token);
+        }
+
+        ErrorHandler::getInstance().capture(nullptr);
+        ErrorHandler::getInstance().merge(diagnostics);
+    }
+
+private:
+    enum class Level { UNKNOWN, CONSTANT, VARYING };    // Not seen yet, one value, more than one
+
+    struct Lattice {
+        Level level = Level::UNKNOWN;
+        long long value = 0;
+
+        bool operator==(const Lattice& other) const {
+            return level == other.level && (level != Level::CONSTANT || value == other.value);
+        }
+    };
+
+    enum class Source { ENTRY, ASSIGN, UNKNOWN, FIRST, STEP, PHI };
+
+    // One SSA value of a scalar
+    struct Definition {
+        Token* variable;
+        Source source;
+        const Node* node = nullptr;     // Expression of ASSIGN, first bound of FIRST
+        long long step = 0;             // Of STEP
+        int block = -1;
+        std::vector<int> operands;      // PHI: one per incoming edge, STEP: the stepped value
+        int copied = -1;                // Use an ASSIGN copies, then the value it copies
+        Lattice value;
+    };
+
+    // Read of a scalar by an identifier node, parent->children[child]
+    struct Use {
+        Node* parent;
+        size_t child;
+        int block;
+        int value = -1;
+        int copy = -1;      // Equal value of another variable still current at the use
+    };
+
+    // What a block does in order: define a value, read an identifier, or read a variable into a slot
+    struct Event {
+        int definition = -1;
+        int use = -1;
+        Token* variable = nullptr;
+        int slot = -1;
+    };
+
+    struct Block {
+        std::vector<int> phis;
+        std::vector<Event> events;
+        std::vector<int> in;                // Edges, in the order of phi operands
+        std::vector<int> out;               // A branch goes to out[0] if its condition holds, out[1] if not
+        const Node* condition = nullptr;    // Branch on a condition
+        const Node* loop = nullptr;         // Branch on whether a FOR loop runs another trip
+        int iterator = -1;                  // Slot of its iterator
+        bool executable = false;
+    };
+
+    struct Edge {
+        int from;
+        int to;
+        bool executable = false;
+    };
+
+    // Blocks and edges a command was built into, to restructure it
+    struct Shape {
+        int entry;
+        int whenTrue = -1;      // Edge taken when the condition holds, into the loop body for FOR
+        int whenFalse = -1;
+    };
+
+    struct Call {
+        const Node* node;
+        int block;
+        std::vector<int> slots;     // Value of every passed variable, -1 if not tracked
+    };
+
+    std::unordered_map<const Token*, Lattice> formals;     // Entry values of copied in arguments, from all calls
+
+    std::vector<Block> blocks;
+    std::vector<Edge> edges;
+    std::vector<Definition> definitions;
+    std::vector<Use> uses;
+    std::vector<int> slots;
+    std::vector<Call> calls;
+    std::vector<Token*> variables;              // Tracked scalars of the unit, in order of appearance
+    std::unordered_set<const Token*> noted;
+    std::unordered_map<const Node*, int> useOf;
+    std::unordered_map<Node*, Shape> shapes;
+    std::vector<std::vector<int>> dependents;   // Definitions evaluated from every definition
+    std::vector<std::vector<int>> deciders;     // Blocks whose branch reads every definition
+    int current = 0;
+
+    static bool tracked(const Token* token) {
+        return token->getType() == TokenType::IDENTIFIER
+            && (token->getFunction() == TokenFunction::DEFAULT
+                || token->getFunction() == TokenFunction::ITERATOR
+                || token->getFunction() == TokenFunction::V_ARG
+                || token->getFunction() == TokenFunction::VR_ARG);
+    }
+
+    static Lattice constant(long long value) {
+        return Lattice{Level::CONSTANT, value};
+    }
+
+    static Lattice varying() {
+        return Lattice{Level::VARYING, 0};
+    }
+
+    static Lattice meet(const Lattice& a, const Lattice& b) {
+        if (a.level == Level::UNKNOWN) return b;
+        if (b.level == Level::UNKNOWN) return a;
+        if (a.level == Level::CONSTANT && b.level == Level::CONSTANT && a.value == b.value) return a;
+        return varying();
+    }
+
+    // Result of the language's arithmetic, false if it overflows; division and modulo round towards
+    // minus infinity, the remainder takes the sign of the divisor and both give 0 for a divisor of 0
+    static bool arithmetic(Operator operation, long long a, long long b, long long& result) {
+        switch (operation) {
+            case Operator::PLUS:    return !__builtin_add_overflow(a, b, &result);
+            case Operator::MINUS:   return !__builtin_sub_overflow(a, b, &result);
+            case Operator::TIMES:   return !__builtin_mul_overflow(a, b, &result);
+            case Operator::DIVIDE:
+                if (b == 0) {
+                    result = 0;
+                    return true;
+                }
+                if (a == LLONG_MIN && b == -1) {
+                    return false;
+                }
+                result = a / b - (a % b != 0 && (a < 0) != (b < 0));
+                return true;
+            case Operator::MODULO:
+                if (b == 0 || b == -1) {
+                    result = 0;
+                    return true;
+                }
+                result = a % b;
+                if (result != 0 && (result < 0) != (b < 0)) {
+                    result += b;
+                }
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    static bool holds(Operator operation, long long a, long long b) {
+        switch (operation) {
+            case Operator::EQ:  return a == b;
+            case Operator::NEQ: return a != b;
+            case Operator::GT:  return a > b;
+            case Operator::LT:  return a < b;
+            case Operator::GTE: return a >= b;
+            default:            return a <= b;
+        }
+    }
+
+    // Builds the graph, SSA form and constants of one unit and rewrites its commands
+    void unit(Node* root, const Token* procedure) {
+        blocks.clear();
+        edges.clear();
+        definitions.clear();
+        uses.clear();
+        slots.clear();
+        calls.clear();
+        variables.clear();
+        noted.clear();
+        useOf.clear();
+        shapes.clear();
+
+        current = block();
+        std::vector<Node*> lists;
+        if (procedure) {
+            lists.push_back(root);
+        } else {
+            for (auto child : root->children) {
+                if (child->kind == NodeKind::COMMANDS) {
+                    lists.push_back(child);
+                }
+            }
+        }
+        for (auto list : lists) {
+            commands(list);
+        }
+
+        // Every variable starts at the entry, unknown unless it is an argument all calls agree on
+        current = 0;
+        std::vector<Event> entry;
+        for (auto variable : variables) {
+            auto known = formals.find(variable);
+            Lattice start = known != formals.end() && known->second.level == Level::CONSTANT ? known->second : varying();
+            int id = definition(variable, Source::ENTRY);
+            definitions[id].value = start;
+            entry.push_back(Event{id});
+        }
+        blocks[0].events.insert(blocks[0].events.begin(), entry.begin(), entry.end());
+
+        insertPhis();
+        rename();
+        link();
+        propagate();
+
+        // Calls that can run pass their constants on
+        for (const auto& call : calls) {
+            if (!blocks[call.block].executable) {
+                continue;
+            }
+            std::vector<Token*> parameters = call.node->token->getArgs();
+            for (size_t i = 0; i < parameters.size() && i < call.slots.size(); i++) {
+                TokenFunction function = parameters[i]->getFunction();
+                if (function == TokenFunction::V_ARG || function == TokenFunction::VR_ARG) {
+                    Lattice passed = call.slots[i] >= 0 ? definitions[slots[call.slots[i]]].value : varying();
+                    formals[parameters[i]] = meet(formals[parameters[i]], passed);
+                }
+            }
+        }
+
+        substitute();
+        for (auto list : lists) {
+            restructure(list);
+        }
+    }
+
+    void note(Token* variable) {
+        if (noted.insert(variable).second) {
+            variables.push_back(variable);
+        }
+    }
+
+    int block() {
+        blocks.emplace_back();
+        return blocks.size() - 1;
+    }
+
+    int edge(int from, int to) {
+        edges.push_back(Edge{from, to});
+        blocks[from].out.push_back(edges.size() - 1);
+        blocks[to].in.push_back(edges.size() - 1);
+        return edges.size() - 1;
+    }
+
+    int definition(Token* variable, Source source, const Node* node = nullptr) {
+        note(variable);
+        Definition defined{variable, source, node};
+        defined.block = current;
+        definitions.push_back(defined);
+        return definitions.size() - 1;
+    }
+
+    void define(Token* variable, Source source, const Node* node = nullptr) {
+        blocks[current].events.push_back(Event{definition(variable, source, node)});
+    }
+
+    // Reads variable into a new slot at this point
+    int read(Token* variable) {
+        note(variable);
+        slots.push_back(-1);
+        blocks[current].events.push_back(Event{-1, -1, variable, static_cast<int>(slots.size() - 1)});
+        return slots.size() - 1;
+    }
+
+    // Records the identifiers the subtree reads
+    void reads(Node* node) {
+        for (size_t i = 0; i < node->children.size(); i++) {
+            Node* child = node->children[i];
+            if (child->kind == NodeKind::IDENTIFIER && tracked(child->token)) {
+                note(child->token);
+                uses.push_back(Use{node, i, current});
+                useOf[child] = uses.size() - 1;
+                blocks[current].events.push_back(Event{-1, static_cast<int>(uses.size() - 1)});
+            } else {
+                reads(child);
+            }
+        }
+    }
+
+    void commands(Node* list) {
+        for (auto node : list->children) {
+            command(node);
+        }
+    }
+
+    void command(Node* node) {
+        Shape& shape = shapes[node];
+        shape.entry = current;
+
+        switch (node->kind) {
+            case NodeKind::ASSIGNMENT_COMMAND:
+            case NodeKind::READ_COMMAND: {
+                Node* target = node->children[0];
+                if (node->kind == NodeKind::ASSIGNMENT_COMMAND) {
+                    reads(node->children[1]);
+                }
+                if (target->kind == NodeKind::TABEL) {
+                    reads(target);
+                } else if (tracked(target->token)) {
+                    bool assigned = node->kind == NodeKind::ASSIGNMENT_COMMAND;
+                    define(target->token, assigned ? Source::ASSIGN : Source::UNKNOWN, assigned ? node->children[1] : nullptr);
+                    const Node* expression = node->children[1];
+                    if (assigned && expression->token == nullptr) {
+                        auto copied = useOf.find(expression->children[0]->children[0]);
+                        definitions.back().copied = copied == useOf.end() ? -1 : copied->second;
+                    }
+                }
+                break;
+            }
+            case NodeKind::WRITE_COMMAND:
+                reads(node);
+                break;
+            case NodeKind::PROC_CALL_COMMAND: {
+                const Node* call = node->children[0];
+                const std::vector<Token*>& passed = call->children[0]->tokens;
+                std::vector<Token*> parameters = call->token->getArgs();
+                Call site{call, current};
+                for (auto variable : passed) {
+                    site.slots.push_back(tracked(variable) ? read(variable) : -1);
+                }
+                for (size_t i = 0; i < passed.size(); i++) {
+                    bool copiedIn = parameters.size() == passed.size() && parameters[i]->getFunction() == TokenFunction::V_ARG;
+                    if (tracked(passed[i]) && !copiedIn) {
+                        define(passed[i], Source::UNKNOWN);     // The procedure may write it
+                    }
+                }
+                calls.push_back(site);
+                break;
+            }
+            case NodeKind::IF_COMMAND:
+            case NodeKind::IF_ELSE_COMMAND: {
+                int head = current;
+                reads(node->children[0]);
+                blocks[head].condition = node->children[0];
+
+                int then = block();
+                shape.whenTrue = edge(head, then);
+                current = then;
+                commands(node->children[1]);
+                int thenEnd = current;
+
+                int join;
+                if (node->kind == NodeKind::IF_ELSE_COMMAND) {
+                    int otherwise = block();
+                    shape.whenFalse = edge(head, otherwise);
+                    current = otherwise;
+                    commands(node->children[2]);
+                    join = block();
+                    edge(thenEnd, join);
+                    edge(current, join);
+                } else {
+                    join = block();
+                    shape.whenFalse = edge(head, join);
+                    edge(thenEnd, join);
+                }
+                current = join;
+                break;
+            }
+            case NodeKind::WHILE_COMMAND: {
+                int head = block();
+                edge(current, head);
+                current = head;
+                reads(node->children[0]);
+                blocks[head].condition = node->children[0];
+
+                int body = block();
+                shape.whenTrue = edge(head, body);
+                current = body;
+                commands(node->children[1]);
+                edge(current, head);
+
+                int exit = block();
+                shape.whenFalse = edge(head, exit);
+                current = exit;
+                break;
+            }
+            case NodeKind::REPEAT_COMMAND: {
+                int body = block();
+                edge(current, body);
+                current = body;
+                commands(node->children[0]);
+                int tail = current;
+                reads(node->children[1]);
+                blocks[tail].condition = node->children[1];
+
+                int exit = block();
+                shape.whenTrue = edge(tail, exit);
+                shape.whenFalse = edge(tail, body);
+                current = exit;
+                break;
+            }
+            case NodeKind::FORTO_COMMAND:
+            case NodeKind::FORDOWNTO_COMMAND: {
+                reads(node->children[0]);
+                define(node->token, Source::FIRST, node->children[0]);
+
+                int head = block();
+                edge(current, head);
+                current = head;
+                reads(node->children[1]);
+                blocks[head].loop = node;
+                blocks[head].iterator = read(node->token);
+
+                int body = block();
+                shape.whenTrue = edge(head, body);
+                current = body;
+                commands(node->children[2]);
+                int stepped = read(node->token);
+                define(node->token, Source::STEP);
+                definitions.back().operands.push_back(stepped);
+                definitions.back().step = node->kind == NodeKind::FORTO_COMMAND ? 1 : -1;
+                edge(current, head);
+
+                int exit = block();
+                shape.whenFalse = edge(head, exit);
+                current = exit;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    // Cooper, Harvey and Kennedy's iterative dominators over the reverse postorder
+    std::vector<int> dominators() {
+        std::vector<int> order;
+        std::vector<int> position(blocks.size(), -1);
+        std::vector<std::pair<int, size_t>> pending{{0, 0}};
+        std::vector<bool> seen(blocks.size(), false);
+        seen[0] = true;
+        while (!pending.empty()) {
+            auto& [b, next] = pending.back();
+            if (next < blocks[b].out.size()) {
+                int successor = edges[blocks[b].out[next++]].to;
+                if (!seen[successor]) {
+                    seen[successor] = true;
+                    pending.emplace_back(successor, 0);
+                }
+                continue;
+            }
+            order.push_back(b);
+            pending.pop_back();
+        }
+        std::reverse(order.begin(), order.end());
+        for (size_t i = 0; i < order.size(); i++) {
+            position[order[i]] = i;
+        }
+
+        std::vector<int> idom(blocks.size(), -1);
+        idom[0] = 0;
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (size_t i = 1; i < order.size(); i++) {
+                int b = order[i];
+                int chosen = -1;
+                for (int e : blocks[b].in) {
+                    int p = edges[e].from;
+                    if (idom[p] < 0) {
+                        continue;
+                    }
+                    if (chosen < 0) {
+                        chosen = p;
+                        continue;
+                    }
+                    int x = p, y = chosen;
+                    while (x != y) {
+                        while (position[x] > position[y]) x = idom[x];
+                        while (position[y] > position[x]) y = idom[y];
+                    }
+                    chosen = x;
+                }
+                if (chosen >= 0 && idom[b] != chosen) {
+                    idom[b] = chosen;
+                    changed = true;
+                }
+            }
+        }
+        return idom;
+    }
+
+    std::vector<int> idom;
+
+    // Minimal SSA: a phi wherever the iterated dominance frontier of a variable's definitions reaches
+    void insertPhis() {
+        idom = dominators();
+        std::vector<std::vector<int>> frontier(blocks.size());
+        for (size_t b = 0; b < blocks.size(); b++) {
+            if (blocks[b].in.size() < 2 || idom[b] < 0) {
+                continue;
+            }
+            for (int e : blocks[b].in) {
+                int runner = edges[e].from;
+                while (runner >= 0 && runner != idom[b] && idom[runner] >= 0) {
+                    if (std::find(frontier[runner].begin(), frontier[runner].end(), (int)b) == frontier[runner].end()) {
+                        frontier[runner].push_back(b);
+                    }
+                    if (runner == 0) {
+                        break;
+                    }
+                    runner = idom[runner];
+                }
+            }
+        }
+
+        std::unordered_map<const Token*, std::vector<int>> sites;
+        for (size_t i = 0; i < definitions.size(); i++) {
+            sites[definitions[i].variable].push_back(definitions[i].block);
+        }
+        for (auto variable : variables) {
+            std::vector<int> pending = sites[variable];
+            std::vector<bool> placed(blocks.size(), false);
+            std::vector<bool> queued(blocks.size(), false);
+            for (int b : pending) {
+                queued[b] = true;
+            }
+            while (!pending.empty()) {
+                int b = pending.back();
+                pending.pop_back();
+                for (int f : frontier[b]) {
+                    if (placed[f]) {
+                        continue;
+                    }
+                    placed[f] = true;
+                    int saved = current;
+                    current = f;
+                    int phi = definition(variable, Source::PHI);
+                    current = saved;
+                    definitions[phi].operands.assign(blocks[f].in.size(), -1);
+                    blocks[f].phis.push_back(phi);
+                    if (!queued[f]) {
+                        queued[f] = true;
+                        pending.push_back(f);
+                    }
+                }
+            }
+        }
+    }
+
+    // Walks the dominator tree giving every read the value that reaches it
+    void rename() {
+        std::vector<std::vector<int>> children(blocks.size());
+        for (size_t b = 1; b < blocks.size(); b++) {
+            if (idom[b] >= 0) {
+                children[idom[b]].push_back(b);
+            }
+        }
+
+        std::unordered_map<const Token*, std::vector<int>> stacks;
+        auto top = [&](const Token* variable) {
+            const std::vector<int>& stack = stacks[variable];
+            return stack.empty() ? -1 : stack.back();
+        };
+
+        std::vector<std::vector<const Token*>> pushed(blocks.size());
+        std::vector<std::pair<int, bool>> pending{{0, false}};
+        while (!pending.empty()) {
+            auto [b, done] = pending.back();
+            pending.pop_back();
+            if (done) {
+                for (auto variable : pushed[b]) {
+                    stacks[variable].pop_back();
+                }
+                continue;
+            }
+
+            for (int phi : blocks[b].phis) {
+                stacks[definitions[phi].variable].push_back(phi);
+                pushed[b].push_back(definitions[phi].variable);
+            }
+            for (const auto& event : blocks[b].events) {
+                if (event.definition >= 0) {
+                    Definition& defined = definitions[event.definition];
+                    if (defined.copied >= 0) {
+                        defined.copied = uses[defined.copied].value;
+                    }
+                    stacks[defined.variable].push_back(event.definition);
+                    pushed[b].push_back(defined.variable);
+                } else if (event.use >= 0) {
+                    Use& use = uses[event.use];
+                    use.value = top(use.parent->children[use.child]->token);
+                    // The farthest copy whose variable still holds the same value
+                    for (int c = use.value >= 0 ? definitions[use.value].copied : -1; c >= 0; c = definitions[c].copied) {
+                        if (top(definitions[c].variable) == c) {
+                            use.copy = c;
+                        }
+                    }
+                } else {
+                    slots[event.slot] = top(event.variable);
+                }
+            }
+            for (int e : blocks[b].out) {
+                const Block& successor = blocks[edges[e].to];
+                size_t k = std::find(successor.in.begin(), successor.in.end(), e) - successor.in.begin();
+                for (int phi : successor.phis) {
+                    definitions[phi].operands[k] = top(definitions[phi].variable);
+                }
+            }
+
+            pending.emplace_back(b, true);
+            for (int child : children[b]) {
+                pending.emplace_back(child, false);
+            }
+        }
+    }
+
+    // SSA value a value, number or identifier node reads, -1 for numbers and what is not tracked
+    int operand(const Node* node) const {
+        if (node->kind == NodeKind::VALUE) {
+            node = node->children[0];
+        }
+        auto found = useOf.find(node);
+        return found == useOf.end() ? -1 : uses[found->second].value;
+    }
+
+    // Use lists of the definitions: what evaluate() and branch() read, so a change revisits only those
+    void link() {
+        dependents.assign(definitions.size(), {});
+        deciders.assign(definitions.size(), {});
+        auto depend = [&](std::vector<std::vector<int>>& lists, int value, int reader) {
+            if (value >= 0 && (lists[value].empty() || lists[value].back() != reader)) {
+                lists[value].push_back(reader);
+            }
+        };
+
+        for (size_t id = 0; id < definitions.size(); id++) {
+            const Definition& defined = definitions[id];
+            switch (defined.source) {
+                case Source::ASSIGN:
+                    depend(dependents, operand(defined.node->children[0]), id);
+                    if (defined.node->token != nullptr) {
+                        depend(dependents, operand(defined.node->children[1]), id);
+                    }
+                    break;
+                case Source::FIRST:
+                    depend(dependents, operand(defined.node), id);
+                    break;
+                case Source::STEP:
+                    depend(dependents, slots[defined.operands[0]], id);
+                    break;
+                case Source::PHI:
+                    for (int value : defined.operands) {
+                        depend(dependents, value, id);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        for (size_t b = 0; b < blocks.size(); b++) {
+            if (blocks[b].condition) {
+                depend(deciders, operand(blocks[b].condition->children[0]), b);
+                depend(deciders, operand(blocks[b].condition->children[1]), b);
+            } else if (blocks[b].loop) {
+                depend(deciders, slots[blocks[b].iterator], b);
+                depend(deciders, operand(blocks[b].loop->children[1]), b);
+            }
+        }
+    }
+
+    // Value of a value, number or identifier node
+    Lattice value(const Node* node) const {
+        if (node->kind == NodeKind::VALUE) {
+            node = node->children[0];
+        }
+        long long number;
+        if (node->kind == NodeKind::NUMBER && node->getConstant(number)) {
+            return constant(number);
+        }
+        int read = operand(node);
+        return read >= 0 ? definitions[read].value : varying();
+    }
+
+    Lattice expression(const Node* node) const {
+        if (node->token == nullptr) {
+            return value(node->children[0]);
+        }
+        Lattice a = value(node->children[0]);
+        Lattice b = value(node->children[1]);
+        if (a.level == Level::UNKNOWN || b.level == Level::UNKNOWN) {
+            return Lattice();
+        }
+        long long result;
+        if (a.level == Level::CONSTANT && b.level == Level::CONSTANT && arithmetic(node->op, a.value, b.value, result)) {
+            return constant(result);
+        }
+        return varying();
+    }
+
+    Lattice evaluate(const Definition& defined) const {
+        switch (defined.source) {
+            case Source::ENTRY:
+                return defined.value;
+            case Source::ASSIGN:
+                return expression(defined.node);
+            case Source::FIRST:
+                return value(defined.node);
+            case Source::STEP: {
+                int stepped = slots[defined.operands[0]];
+                Lattice before = stepped >= 0 ? definitions[stepped].value : varying();
+                long long result;
+                if (before.level == Level::CONSTANT) {
+                    return arithmetic(Operator::PLUS, before.value, defined.step, result) ? constant(result) : varying();
+                }
+                return before;
+            }
+            case Source::PHI: {
+                Lattice merged;
+                const Block& owner = blocks[defined.block];
+                for (size_t k = 0; k < owner.in.size(); k++) {
+                    if (edges[owner.in[k]].executable) {
+                        merged = meet(merged, defined.operands[k] >= 0 ? definitions[defined.operands[k]].value : varying());
+                    }
+                }
+                return merged;
+            }
+            default:
+                return varying();
+        }
+    }
+
+    // Which way the branch of a block can go: {condition may hold, may fail}
+    std::pair<bool, bool> branch(const Block& b) const {
+        Lattice x, y;
+        Operator operation;
+        if (b.condition) {
+            x = value(b.condition->children[0]);
+            y = value(b.condition->children[1]);
+            operation = b.condition->op;
+        } else {
+            x = slots[b.iterator] >= 0 ? definitions[slots[b.iterator]].value : varying();
+            y = value(b.loop->children[1]);
+            operation = b.loop->kind == NodeKind::FORTO_COMMAND ? Operator::LTE : Operator::GTE;
+        }
+        if (x.level == Level::UNKNOWN || y.level == Level::UNKNOWN) {
+            return {false, false};
+        }
+        if (x.level == Level::CONSTANT && y.level == Level::CONSTANT) {
+            bool result = holds(operation, x.value, y.value);
+            return {result, !result};
+        }
+        return {true, true};
+    }
+
+    // Wegman and Zadeck's SCCP, values only ever move from UNKNOWN towards VARYING. A block is evaluated
+    // whole when it first becomes executable, later only its phis when another edge into it does; a
+    // changed value reevaluates the definitions and branches on its use lists.
+    void propagate() {
+        std::vector<int> flow;
+        std::vector<int> changed;
+
+        auto update = [&](int id) {
+            Definition& defined = definitions[id];
+            Lattice next = meet(defined.value, evaluate(defined));
+            if (defined.source == Source::ENTRY || next == defined.value) {
+                return;
+            }
+            defined.value = next;
+            changed.push_back(id);
+        };
+        auto decide = [&](int b) {
+            const Block& decided = blocks[b];
+            if (decided.condition || decided.loop) {
+                auto [whenTrue, whenFalse] = branch(decided);
+                if (whenTrue) flow.push_back(decided.out[0]);
+                if (whenFalse) flow.push_back(decided.out[1]);
+            } else {
+                flow.insert(flow.end(), decided.out.begin(), decided.out.end());
+            }
+        };
+        auto visit = [&](int b) {
+            Block& visited = blocks[b];
+            for (int phi : visited.phis) {
+                update(phi);
+            }
+            for (const auto& event : visited.events) {
+                if (event.definition >= 0) {
+                    update(event.definition);
+                }
+            }
+            decide(b);
+        };
+
+        blocks[0].executable = true;
+        visit(0);
+        while (!flow.empty() || !changed.empty()) {
+            if (!flow.empty()) {
+                int e = flow.back();
+                flow.pop_back();
+                if (edges[e].executable) {
+                    continue;
+                }
+                edges[e].executable = true;
+                Block& reached = blocks[edges[e].to];
+                if (!reached.executable) {
+                    reached.executable = true;
+                    visit(edges[e].to);
+                } else {
+                    for (int phi : reached.phis) {
+                        update(phi);        // Only the phis merge the new edge
+                    }
+                }
+                continue;
+            }
+            int id = changed.back();
+            changed.pop_back();
+            for (int reader : dependents[id]) {
+                if (blocks[definitions[reader].block].executable) {
+                    update(reader);
+                }
+            }
+            for (int b : deciders[id]) {
+                if (blocks[b].executable) {
+                    decide(b);
+                }
+            }
+        }
+    }
+
+    static Node* number(long long value, unsigned long long line) {
+        Node* node = new NumberNode(constant_token(value));
+        node->setLine(line);
+        return node;
+    }
+
+    // Constant uses become numbers, copies read the original and expressions of constants are folded
+    void substitute() {
+        for (const auto& use : uses) {
+            if (!blocks[use.block].executable || use.value < 0) {
+                continue;
+            }
+            Node*& child = use.parent->children[use.child];
+            const Lattice& known = definitions[use.value].value;
+            if (known.level == Level::CONSTANT) {
+                Node* replaced = child;
+                child = number(known.value, replaced->line);
+                delete replaced;
+            } else if (use.copy >= 0) {
+                child->token = definitions[use.copy].variable;
+            }
+        }
+
+        for (const auto& [node, shape] : shapes) {
+            if (node->kind != NodeKind::ASSIGNMENT_COMMAND || !blocks[shape.entry].executable) {
+                continue;
+            }
+            Node*& expression = node->children[1];
+            long long a, b, result;
+            if (expression->token != nullptr && expression->children[0]->getConstant(a) && expression->children[1]->getConstant(b)
+                && arithmetic(expression->op, a, b, result)) {
+                Node* folded = new ExpressionNode();
+                folded->setLine(expression->line);
+                folded->addChild(new ValueNode());
+                folded->children[0]->addChild(number(result, expression->line));
+                delete expression;
+                expression = folded;
+            }
+        }
+    }
+
+    bool executable(int edge) const {
+        return edge >= 0 && edges[edge].executable;
+    }
+
+    // Drops the commands that cannot run and the arms and loops of the ones that can that cannot
+    void restructure(Node* list) {
+        std::vector<Node*> kept;
+        for (auto node : list->children) {
+            const Shape& shape = shapes[node];
+            if (!blocks[shape.entry].executable) {
+                drop(node);
+                continue;
+            }
+
+            switch (node->kind) {
+                case NodeKind::IF_COMMAND:
+                case NodeKind::IF_ELSE_COMMAND: {
+                    bool then = executable(shape.whenTrue);
+                    bool otherwise = executable(shape.whenFalse);
+                    if (!then && !otherwise) {
+                        kept.push_back(node);   // Undecided, left alone
+                        break;
+                    }
+                    if (then) {
+                        restructure(node->children[1]);
+                    }
+                    if (otherwise && node->kind == NodeKind::IF_ELSE_COMMAND) {
+                        restructure(node->children[2]);
+                    }
+                    if (then && otherwise) {
+                        kept.push_back(node);
+                    } else if (then) {
+                        splice(node, 1, kept);
+                    } else if (node->kind == NodeKind::IF_ELSE_COMMAND) {
+                        splice(node, 2, kept);
+                    } else {
+                        drop(node);
+                    }
+                    break;
+                }
+                case NodeKind::WHILE_COMMAND:
+                case NodeKind::FORTO_COMMAND:
+                case NodeKind::FORDOWNTO_COMMAND:
+                    if (!executable(shape.whenTrue) && executable(shape.whenFalse)) {
+                        drop(node);     // The body never runs
+                        break;
+                    }
+                    restructure(node->children.back());
+                    kept.push_back(node);
+                    break;
+                case NodeKind::REPEAT_COMMAND:
+                    restructure(node->children[0]);
+                    if (!executable(shape.whenFalse) && blocks[shape.entry].executable) {
+                        splice(node, 0, kept);  // The body runs once
+                    } else {
+                        kept.push_back(node);
+                    }
+                    break;
+                default:
+                    kept.push_back(node);
+                    break;
+            }
+        }
+        list->children = kept;
+    }
+
+    // Replaces node with the commands of one of its children
+    static void splice(Node* node, size_t arm, std::vector<Node*>& kept) {
+        Node* commands = node->children[arm];
+        kept.insert(kept.end(), commands->children.begin(), commands->children.end());
+        commands->children.clear();
+        delete node;
+    }
+
+    // Deletes a command that cannot run after building it once for its diagnostics
+    static void drop(Node* node) {
+        node->build();
+        delete node;
+    }
+};
+
+#endif // CONSTANT_PROPAGATION_HPP
@@ -0,0 +1,436 @@
+#ifndef COST_ESTIMATOR_HPP
+#define COST_ESTIMATOR_HPP
+
+#include <algorithm>
+#include <climits>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Node.hpp"
+#include "ErrorHandler.hpp"
+#include "postprocessing.hpp"
+
+// Polynomial in the trip counts n1, n2, ... of loops whose bounds are not constant
+class CostFormula {
+public:
+    CostFormula() = default;
+    explicit CostFormula(long long constant) {
+        if (constant != 0) {
+            terms[{}] = constant;
+        }
+    }
+
+    CostFormula& operator+=(const CostFormula& other) {
+        for (const auto& [monomial, coefficient] : other.terms) {
+            if ((terms[monomial] += coefficient) == 0) {
+                terms.erase(monomial);
+            }
+        }
+        return *this;
+    }
+
+    CostFormula operator+(const CostFormula& other) const {
+        CostFormula sum = *this;
+        sum += other;
+        return sum;
+    }
+
+    CostFormula times(long long factor) const {
+        CostFormula product;
+        for (const auto& [monomial, coefficient] : terms) {
+            if (coefficient * factor != 0) {
+                product.terms[monomial] = coefficient * factor;
+            }
+        }
+        return product;
+    }
+
+    // Multiplies by the trip counts of the loops symbols
+    CostFormula times(const std::vector<long long>& symbols) const {
+        CostFormula product;
+        for (const auto& [monomial, coefficient] : terms) {
+            std::vector<long long> merged = monomial;
+            merged.insert(merged.end(), symbols.begin(), symbols.end());
+            std::sort(merged.begin(), merged.end());
+            product.terms[merged] += coefficient;
+        }
+        return product;
+    }
+
+    // Value with every unknown trip count replaced by trips
+    long long estimate(long long trips) const {
+        long long total = 0;
+        for (const auto& [monomial, coefficient] : terms) {
+            long long value = coefficient;
+            for (size_t i = 0; i < monomial.size(); i++) {
+                value = value > LLONG_MAX / trips ? LLONG_MAX : value * trips;
+            }
+            total = total > LLONG_MAX - value ? LLONG_MAX : total + value;
+        }
+        return total;
+    }
+
+    std::string str() const {
+        if (terms.empty()) {
+            return "0";
+        }
+        std::string text;
+        for (const auto& [monomial, coefficient] : terms) {
+            text += text.empty() ? "" : " + ";
+            std::string product = coefficient == 1 && !monomial.empty() ? "" : std::to_string(coefficient);
+            for (long long symbol : monomial) {
+                product += (product.empty() ? "n" : "*n") + std::to_string(symbol);
+            }
+            text += product;
+        }
+        return text;
+    }
+
+private:
+    std::map<std::vector<long long>, long long> terms;     // Coefficients by the sorted symbols they multiply
+};
+
+/*
+    Static estimate of the cycles a program takes on the VM, reported per procedure, loop, call and
+    arithmetic routine by --cost-report. Straight-line code is costed from the instructions its nodes
+    generate, with the optimizations of the pipeline applied. FOR loops with constant bounds run their
+    exact number of trips, other loops a trip count of their own, n<k>, so that every cost is a formula
+    over those. A conditional is charged with its more expensive branch. A call costs the copies of its
+    arguments, the jump there and back and the formula of the procedure. The loops inside *, / and %
+    run once per bit of the operand that bounds them, nested ones once per bit again, which takes the
+    range RangeAnalysis found or ASSUMED_BITS. Estimates replace unknown trip counts by ASSUMED_TRIPS.
+*/
+class CostEstimator {
+public:
+    static constexpr long long ASSUMED_TRIPS = 10;     // Same weight as estimate_cycles
+    static constexpr long long ASSUMED_BITS = 32;
+
+    // Estimates one procedure or main, procedures have to come before their callers
+    void unit(const Node* unit, const std::string& label) {
+        bool muted = ErrorHandler::getInstance().mute(true);
+        current = label;
+        CostFormula runs(1);
+        CostFormula cost;
+        if (unit->kind == NodeKind::PROCEDURE) {
+            cost = visit(unit->children[1], runs);
+            procedures[unit->children[0]->token] = cost;
+        } else {
+            for (auto child : unit->children) {
+                cost += visit(child, runs);
+            }
+        }
+        units.push_back({label, count_instructions(unit->build()), cost});
+        ErrorHandler::getInstance().mute(muted);
+    }
+
+    void report(std::ostream& output, bool json) const {
+        if (json) {
+            output << "{\"assumed_trips\": " << ASSUMED_TRIPS << ", \"assumed_bits\": " << ASSUMED_BITS << ", \"units\": [";
+            const char* separator = "";
+            for (const auto& unit : units) {
+                output << separator << "{\"unit\": \"" << unit.label << "\", \"instructions\": " << unit.instructions
+                       << ", \"formula\": \"" << unit.cost.str() << "\", \"estimate\": " << unit.cost.estimate(ASSUMED_TRIPS) << "}";
+                separator = ", ";
+            }
+            output << "], \"loops\": [";
+            separator = "";
+            for (const auto& loop : loops) {
+                output << separator << "{\"unit\": \"" << loop.unit << "\", \"kind\": \"" << loop.kind << "\", \"line\": " << loop.line
+                       << ", \"trips\": \"" << loop.trips << "\", \"iteration\": \"" << loop.iteration.str()
+                       << "\", \"formula\": \"" << loop.total.str() << "\", \"estimate\": " << loop.total.estimate(ASSUMED_TRIPS) << "}";
+                separator = ", ";
+            }
+            output << "], \"calls\": [";
+            separator = "";
+            for (const auto& call : calls) {
+                output << separator << "{\"unit\": \"" << call.unit << "\", \"procedure\": \"" << call.procedure << "\", \"line\": " << call.line
+                       << ", \"runs\": \"" << call.runs.str() << "\", \"overhead\": " << call.overhead
+                       << ", \"formula\": \"" << call.cost.str() << "\", \"estimate\": " << call.cost.estimate(ASSUMED_TRIPS) << "}";
+                separator = ", ";
+            }
+            output << "], \"arithmetic\": [";
+            separator = "";
+            for (const auto& site : sites) {
+                output << separator << "{\"unit\": \"" << site.unit << "\", \"operator\": \"" << site.name << "\", \"line\": " << site.line
+                       << ", \"bits\": " << site.bits << ", \"cycles\": " << site.cost << ", \"runs\": \"" << site.runs.str()
+                       << "\", \"estimate\": " << site.runs.times(site.cost).estimate(ASSUMED_TRIPS) << "}";
+                separator = ", ";
+            }
+            output << "]}" << std::endl;
+            return;
+        }
+
+        output << "cost estimate (cycles; n<k> is the trip count of loop k, estimates assume " << ASSUMED_TRIPS
+               << " trips and " << ASSUMED_BITS << "-bit operands where unknown)" << std::endl;
+        output << std::left << std::setw(24) << "unit" << std::right << std::setw(14) << "instructions"
+               << std::setw(16) << "estimate" << "  formula" << std::endl;
+        for (const auto& unit : units) {
+            output << std::left << std::setw(24) << unit.label << std::right << std::setw(14) << unit.instructions
+                   << std::setw(16) << unit.cost.estimate(ASSUMED_TRIPS) << "  " << unit.cost.str() << std::endl;
+        }
+        if (!loops.empty()) {
+            output << std::left << std::setw(24) << "loop" << std::setw(22) << "unit" << std::right << std::setw(8) << "trips"
+                   << std::setw(16) << "estimate" << "  per iteration" << std::endl;
+            for (const auto& loop : loops) {
+                output << "  " << std::left << std::setw(22) << loop.kind + "@" + std::to_string(loop.line) << std::setw(22) << loop.unit
+                       << std::right << std::setw(8) << loop.trips << std::setw(16) << loop.total.estimate(ASSUMED_TRIPS)
+                       << "  " << loop.iteration.str() << std::endl;
+            }
+        }
+        if (!calls.empty()) {
+            output << std::left << std::setw(24) << "call" << std::setw(22) << "unit" << std::right << std::setw(10) << "overhead"
+                   << std::setw(16) << "estimate" << "  runs" << std::endl;
+            for (const auto& call : calls) {
+                output << "  " << std::left << std::setw(22) << call.procedure + "@" + std::to_string(call.line) << std::setw(22) << call.unit
+                       << std::right << std::setw(10) << call.overhead << std::setw(16) << call.cost.estimate(ASSUMED_TRIPS)
+                       << "  " << call.runs.str() << std::endl;
+            }
+        }
+        if (!sites.empty()) {
+            output << std::left << std::setw(24) << "arithmetic" << std::setw(22) << "unit" << std::right << std::setw(6) << "bits"
+                   << std::setw(10) << "per use" << std::setw(16) << "estimate" << "  runs" << std::endl;
+            for (const auto& site : sites) {
+                output << "  " << std::left << std::setw(22) << site.name + "@" + std::to_string(site.line) << std::setw(22) << site.unit
+                       << std::right << std::setw(6) << site.bits << std::setw(10) << site.cost
+                       << std::setw(16) << site.runs.times(site.cost).estimate(ASSUMED_TRIPS) << "  " << site.runs.str() << std::endl;
+            }
+        }
+    }
+
+private:
+    static constexpr long long RETURN_COST = 10;    // RTRN
+
+    struct UnitCost {
+        std::string label;
+        long long instructions;
+        CostFormula cost;
+    };
+
+    struct LoopCost {
+        std::string unit;
+        std::string kind;
+        unsigned long long line;
+        std::string trips;          // Exact count or the symbol standing for it
+        CostFormula iteration;
+        CostFormula total;
+    };
+
+    struct CallCost {
+        std::string unit;
+        std::string procedure;
+        unsigned long long line;
+        CostFormula runs;
+        long long overhead;         // Argument copies, jump there and back
+        CostFormula cost;           // Of one call
+    };
+
+    struct SiteCost {
+        std::string unit;
+        std::string name;
+        unsigned long long line;
+        long long bits;
+        long long cost;             // Of one use
+        CostFormula runs;
+    };
+
+    std::string current;
+    long long symbols = 0;
+    std::vector<UnitCost> units;
+    std::vector<LoopCost> loops;
+    std::vector<CallCost> calls;
+    std::vector<SiteCost> sites;
+    std::unordered_map<const Token*, CostFormula> procedures;   // Cost of one call by procedure
+
+    // Cycles of code with every instruction run once
+    static long long straight(const std::string& code) {
+        return estimate_cycles(code, 1, 1);
+    }
+
+    // Cycles of the code of an arithmetic routine, instructions inside its backward jumps run iterations times per loop
+    static long long looped(const std::string& code, long long iterations) {
+        std::vector<std::string> instructions;
+        std::unordered_map<std::string, long long> labels;
+        std::istringstream input(code);
+        std::string line;
+        while (std::getline(input, line)) {
+            std::vector<std::string> defined;
+            std::string instruction = strip_labels(line, &defined);
+            for (const auto& label : defined) {
+                labels[label] = instructions.size();
+            }
+            if (instruction.find_first_not_of(" \t") != std::string::npos && instruction[0] != '#') {
+                instructions.push_back(instruction);
+            }
+        }
+
+        std::vector<long long> depth(instructions.size(), 0);
+        for (size_t i = 0; i < instructions.size(); i++) {
+            size_t space = instructions[i].find(' ');
+            if (instructions[i][0] != 'J' || space == std::string::npos) {
+                continue;
+            }
+            std::string operand = instructions[i].substr(space + 1);
+            long long target = (long long)i + 1;
+            if (operand[0] == '*') {
+                auto found = labels.find(operand.substr(1));
+                target = found == labels.end() ? target : found->second;
+            } else if (operand[0] == '-') {
+                target = (long long)i + std::stoll(operand);
+            }
+            for (long long j = std::max(target, 0LL); j <= (long long)i && target <= (long long)i; j++) {
+                depth[j]++;
+            }
+        }
+
+        long long cycles = 0;
+        for (size_t i = 0; i < instructions.size(); i++) {
+            long long weight = 1;
+            for (long long d = 0; d < depth[i]; d++) {
+                weight = std::min(weight * iterations, 1LL << 40);
+            }
+            cycles += instruction_cost(instructions[i]) * weight;
+        }
+        return cycles;
+    }
+
+    static long long bitLength(long long value) {
+        long long bits = 1;
+        while (bits < 63 && (value >> bits) != 0) {
+            bits++;
+        }
+        return bits;
+    }
+
+    // Bits the loops of the routine of a *, / or % run for: the smaller factor or the dividend
+    static long long bits(const ExpressionNode* expression) {
+        Interval a = expression->ranges[0].magnitude();
+        Interval b = expression->ranges[1].magnitude();
+        long long bound = expression->op == Operator::TIMES ? std::min(a.hi, b.hi) : a.hi;
+        return bound == LLONG_MAX ? ASSUMED_BITS : bitLength(bound);
+    }
+
+    static bool routine(const Node* node) {
+        if (node->kind != NodeKind::EXPRESSION || node->token == nullptr) {
+            return false;
+        }
+        auto expression = static_cast<const ExpressionNode*>(node);
+        return (node->op == Operator::TIMES || node->op == Operator::DIVIDE || node->op == Operator::MODULO)
+            && expression->hoisted < 0 && !expression->computed;
+    }
+
+    // Cost of one use of an arithmetic routine, the difference to its straight cost is returned in extra
+    long long site(const ExpressionNode* expression, const CostFormula& runs, long long& extra) {
+        std::string code = expression->compute();
+        long long width = bits(expression);
+        long long cost = looped(code, width);
+        extra += cost - straight(code);
+        const char* name = expression->op == Operator::TIMES ? "*" : expression->op == Operator::DIVIDE ? "/" : "%";
+        sites.push_back({current, name, expression->line, width, cost, runs});
+        return cost;
+    }
+
+    // Cost of a command without loops, its arithmetic routines looped
+    CostFormula leaf(const Node* node, const CostFormula& runs) {
+        long long cost = straight(node->build());
+        std::vector<const Node*> pending{node};
+        while (!pending.empty()) {
+            const Node* next = pending.back();
+            pending.pop_back();
+            if (routine(next)) {
+                site(static_cast<const ExpressionNode*>(next), runs, cost);
+            }
+            pending.insert(pending.end(), next->children.begin(), next->children.end());
+        }
+        return CostFormula(cost);
+    }
+
+    // Cost of one run of the loop body and its overhead per iteration, the preheader apart
+    CostFormula loop(const Node* node, const Node* body, long long trips, bool unrolled, const CostFormula& runs,
+                     const std::vector<Node*>* invariants) {
+        std::vector<long long> symbol;
+        std::string count = std::to_string(trips);
+        if (trips < 0) {
+            symbol.push_back(++symbols);
+            count = "n" + std::to_string(symbols);
+        }
+        CostFormula each = symbol.empty() ? runs.times(trips) : runs.times(symbol);
+
+        std::string code = node->build();
+        long long overhead = straight(code) - straight(body->build());
+        CostFormula preheader;
+        for (size_t i = 0; invariants && i < invariants->size(); i++) {
+            auto expression = static_cast<const ExpressionNode*>((*invariants)[i]);
+            overhead -= straight(expression->hoist());
+            long long extra = 0;
+            preheader += CostFormula(site(expression, runs, extra) + 20);  // LOAD and STORE of the cell
+        }
+
+        size_t index = loops.size();
+        loops.push_back({current, node->getNodeType(), node->line, count});
+        CostFormula iteration = visit(body, each) + CostFormula(unrolled ? 0 : std::max(overhead, 0LL));
+        CostFormula total = (symbol.empty() ? iteration.times(trips) : iteration.times(symbol)) + preheader;
+        loops[index].iteration = iteration;
+        loops[index].total = total;
+        return total;
+    }
+
+    CostFormula visit(const Node* node, const CostFormula& runs) {
+        switch (node->kind) {
+            case NodeKind::COMMANDS: {
+                CostFormula cost;
+                for (auto child : node->children) {
+                    cost += visit(child, runs);
+                }
+                return cost;
+            }
+            case NodeKind::IF_COMMAND: {
+                long long own = straight(node->build()) - straight(node->children[1]->build());
+                return CostFormula(own) + visit(node->children[1], runs);
+            }
+            case NodeKind::IF_ELSE_COMMAND: {
+                long long own = straight(node->build()) - straight(node->children[1]->build()) - straight(node->children[2]->build());
+                CostFormula then = visit(node->children[1], runs);
+                CostFormula otherwise = visit(node->children[2], runs);
+                return CostFormula(own) + (then.estimate(ASSUMED_TRIPS) >= otherwise.estimate(ASSUMED_TRIPS) ? then : otherwise);
+            }
+            case NodeKind::WHILE_COMMAND:
+                return loop(node, node->children[1], -1, false, runs, &static_cast<const WhileCommandNode*>(node)->invariants);
+            case NodeKind::REPEAT_COMMAND:
+                return loop(node, node->children[0], -1, false, runs, &static_cast<const RepeatCommandNode*>(node)->invariants);
+            case NodeKind::FORTO_COMMAND:
+            case NodeKind::FORDOWNTO_COMMAND: {
+                long long first, last, trips = -1;
+                if (node->children[0]->getConstant(first) && node->children[1]->getConstant(last)) {
+                    trips = std::max(node->kind == NodeKind::FORTO_COMMAND ? last - first + 1 : first - last + 1, 0LL);
+                }
+                // Unrolled copies need no counting, partially unrolled ones little
+                std::string back = "JUMP *FOR_BODY_" + std::to_string(node->id) + "\n";
+                bool unrolled = trips >= 0 && node->build().find(back) == std::string::npos;
+                return loop(node, node->children[2], trips, unrolled, runs, nullptr);
+            }
+            case NodeKind::PROC_CALL_COMMAND:
+                return visit(node->children[0], runs);
+            case NodeKind::PROC_CALL: {
+                auto call = static_cast<const ProcCallNode*>(node);
+                auto found = procedures.find(node->token);
+                CostFormula callee = found == procedures.end() ? CostFormula() : found->second;
+                long long overhead = straight(node->build());
+                if (call->inlined) {
+                    overhead -= straight(call->inlined->build());
+                } else {
+                    overhead += RETURN_COST;
+                }
+                calls.push_back({current, node->token->getValue(), node->line, runs, overhead, callee + CostFormula(overhead)});
+                return calls.back().cost;
+            }
+            default:
+                return leaf(node, runs);
+        }
+    }
+};
+
+#endif // COST_ESTIMATOR_HPP
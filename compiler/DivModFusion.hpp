@@ -0,0 +1,121 @@
+#ifndef DIVMOD_FUSION_HPP
+#define DIVMOD_FUSION_HPP
+
+#include <string>
+#include <vector>
+#include "Node.hpp"
+
+/*
+    Pairs divisions and modulos of the same operands within one command list, e.g.
+        r := a % b;
+        q := a / b;
+    The first one computes both the quotient and the remainder in one pass and stores the ones needed
+    later in dedicated cells, the following ones only load them. Later expressions always run when the
+    first one does, so the extra work is never wasted. Operands must be scalars or constants that no
+    command in between can change.
+*/
+class DivModFusion {
+public:
+    // Fuses within one procedure or main
+    void run(Node* unit) {
+        owner = unit;
+        cells = 0;
+        visit(unit->kind == NodeKind::PROCEDURE ? unit->children[1] : unit);
+    }
+
+private:
+    const Node* owner = nullptr;    // Unit whose frame holds the cells
+    long long cells = 0;
+
+    void visit(Node* node) {
+        if (node->kind == NodeKind::COMMANDS) {
+            commands(node);
+            return;
+        }
+        for (auto child : node->children) {
+            visit(child);
+        }
+    }
+
+    // Token of a value usable as a division operand, nullptr for table elements
+    static const Token* operand(const Node* value) {
+        const Node* node = value->children[0];
+        if (node->kind == NodeKind::NUMBER) {
+            return node->token;
+        }
+        if (node->kind == NodeKind::IDENTIFIER && node->token->getFunction() != TokenFunction::T_ARG
+                                                && node->token->getFunction() != TokenFunction::TABLE) {
+            return node->token;
+        }
+        return nullptr;
+    }
+
+    // Division or modulo assigned by command, nullptr if it cannot be fused
+    static ExpressionNode* site(Node* command) {
+        if (command->kind != NodeKind::ASSIGNMENT_COMMAND) {
+            return nullptr;
+        }
+        auto expression = static_cast<ExpressionNode*>(command->children[1]);
+        if (expression->token == nullptr || expression->hoisted >= 0
+            || (expression->op != Operator::DIVIDE && expression->op != Operator::MODULO)
+            || !operand(expression->children[0]) || !operand(expression->children[1])) {
+            return nullptr;
+        }
+        return expression;
+    }
+
+    static bool sameOperands(const ExpressionNode* a, const ExpressionNode* b) {
+        return operand(a->children[0]) == operand(b->children[0]) && operand(a->children[1]) == operand(b->children[1]);
+    }
+
+    static bool clobbersOperands(const Node* node, const ExpressionNode* expression) {
+        return node->clobbers(operand(expression->children[0])) || node->clobbers(operand(expression->children[1]));
+    }
+
+    void commands(Node* node) {
+        const std::vector<Node*>& list = node->children;
+
+        for (size_t i = 0; i < list.size(); i++) {
+            for (auto child : list[i]->children) {
+                visit(child);
+            }
+
+            ExpressionNode* first = site(list[i]);
+            if (!first || first->computed || clobbersOperands(list[i], first)) {
+                continue;
+            }
+
+            std::vector<ExpressionNode*> reused;
+            for (size_t j = i + 1; j < list.size(); j++) {
+                ExpressionNode* next = site(list[j]);
+                if (next && sameOperands(first, next)) {
+                    reused.push_back(next);
+                }
+                if (clobbersOperands(list[j], first)) {
+                    break;
+                }
+            }
+
+            if (reused.empty()) {
+                continue;
+            }
+
+            if (first->op == Operator::MODULO) {
+                first->remainder = unit_cell(owner, "~", cells++);
+            }
+            for (auto next : reused) {
+                long long& result = next->op == Operator::DIVIDE ? first->quotient : first->remainder;
+                if (result < 0) {
+                    result = unit_cell(owner, "~", cells++);
+                }
+            }
+            for (auto next : reused) {
+                next->computed = true;
+                next->quotient = first->quotient;
+                next->remainder = first->remainder;
+            }
+        }
+    }
+};
+
+#endif // DIVMOD_FUSION_HPP
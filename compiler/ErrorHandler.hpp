@@ -4,11 +4,86 @@
 #include <string>
 #include <vector>
 #include <mutex>
-#include <sstream>
+#include <atomic>
+#include <exception>
 #include <iostream>
 #include "Token.hpp"
+#include "Options.hpp"
 
 
+enum class ErrorCode {
+    SYNTAX,                 // Message given by the parser
+    UNRECOGNIZED_TOKEN,
+    DUPLICATE_VARIABLE,
+    DUPLICATE_PROCEDURE,
+    UNDECLARED_VARIABLE,
+    INVALID_BOUNDS,
+    UNINITIALIZED_VARIABLE,
+    RECURSIVE_CALL,
+    IMPROPER_TABLE_USE,
+    NOT_ENOUGH_ARGUMENTS,
+    TOO_MANY_ARGUMENTS,
+    MISMATCHED_ARGUMENTS,
+    UNASSIGNABLE
+};
+
+enum class Severity { ERROR, WARNING };
+
+// One diagnostic, the message is only put together when it is printed
+struct Diagnostic {
+    ErrorCode code;
+    Severity severity = Severity::ERROR;
+    std::string argument;               // Offending token or text, empty if none
+    unsigned long long line = 0;        // Span of the offending token, line 0 if unknown
+    unsigned long long column = 0;
+    unsigned long long length = 0;
+    bool located = false;               // Reported at a token
+
+    std::string format() const {
+        std::string text = severity == Severity::ERROR ? "ERROR: " : "WARNING: ";
+
+        switch (code) {
+            case ErrorCode::SYNTAX: return text + argument;
+            case ErrorCode::UNRECOGNIZED_TOKEN: return text + "Unrecognized token: '" + argument + "' on line " + std::to_string(line);
+            default: break;
+        }
+
+        text += message(code);
+        if (located) {
+            text += " - '" + argument + "' on line: " + std::to_string(line);
+        }
+        return text;
+    }
+
+    static const char* message(ErrorCode code) {
+        switch (code) {
+            case ErrorCode::DUPLICATE_VARIABLE: return "Cannot create multiple variables with the same name in the same scope.";
+            case ErrorCode::DUPLICATE_PROCEDURE: return "Cannot create multiple procedures with the same name.";
+            case ErrorCode::UNDECLARED_VARIABLE: return "Undeclared variable.";
+            case ErrorCode::INVALID_BOUNDS: return "Lower bound is greater than upper bound";
+            case ErrorCode::UNINITIALIZED_VARIABLE: return "Uninitialized variable.";
+            case ErrorCode::RECURSIVE_CALL: return "Cannot call procedure inside itself.";
+            case ErrorCode::IMPROPER_TABLE_USE: return "Improper use of table.";
+            case ErrorCode::NOT_ENOUGH_ARGUMENTS: return "Not enough arguments passed.";
+            case ErrorCode::TOO_MANY_ARGUMENTS: return "Too many arguments passed.";
+            case ErrorCode::MISMATCHED_ARGUMENTS: return "Missmatched argument types.";
+            case ErrorCode::UNASSIGNABLE: return "Cannot assign token.";
+            default: return "Syntax error.";
+        }
+    }
+};
+
+// Thrown when compilation cannot go on, the logged diagnostics say why
+struct CompilationAborted : std::exception {
+    const char* what() const noexcept override { return "Compilation aborted"; }
+};
+
+/*
+    Diagnostics are appended to a buffer of the logging thread or, while a task captures them, to the
+    task's buffer, so logging never waits for a lock. The thread driving the compilation merges them into
+    the program's list on demand. Once --max-errors errors were logged compilation stops: the driving
+    thread throws CompilationAborted right away, concurrent tasks see aborted() and skip the work that is left.
+*/
 class ErrorHandler {
 public:
     static ErrorHandler& getInstance() {
@@ -16,37 +91,85 @@ public:
         return instance;
     }
 
-    void logError(const std::string& message, Token* token = nullptr) {
-        std::lock_guard<std::mutex> lock(mtx);
-        std::ostringstream error;
-
+    void log(ErrorCode code, Token* token = nullptr, Severity severity = Severity::ERROR) {
+        Diagnostic diagnostic{code, severity};
         if (token) {
-            error << "ERROR: " << message << " - \'" << token->getValue() << "\' on line: " << token->getLine();
-        } else {
-            error << "ERROR: " << message;
+            diagnostic.argument = token->getValue();
+            diagnostic.line = token->getLine();
+            diagnostic.column = token->getColumn();
+            diagnostic.length = diagnostic.argument.size();
+            diagnostic.located = true;
         }
+        record(std::move(diagnostic));
+    }
+
+    // Diagnostic about text that is not a token, e.g. the parser's messages
+    void log(ErrorCode code, const std::string& argument, unsigned long long line = 0, Severity severity = Severity::ERROR) {
+        Diagnostic diagnostic{code, severity, argument, line};
+        record(std::move(diagnostic));
+    }
 
-        errors.push_back(error.str());
+    // Collects the diagnostics of the calling thread in buffer until capture(nullptr), so that the
+    // diagnostics of concurrent tasks can be merged in a fixed order
+    void capture(std::vector<Diagnostic>* buffer) {
+        captured = buffer;
     }
 
-    void printErrors() const {
+    // Drops the diagnostics of the calling thread while on, for code built only to be measured or
+    // built a second time, returns the previous setting so that nested uses can restore it
+    bool mute(bool on) {
+        bool was = muted;
+        muted = on;
+        return was;
+    }
+
+    void merge(std::vector<Diagnostic>& buffered) {
+        std::lock_guard<std::mutex> lock(mtx);
+        flush();
+        diagnostics.insert(diagnostics.end(), buffered.begin(), buffered.end());
+        buffered.clear();
+    }
+
+    size_t errorCount() const { return errors; }
+
+    bool aborted() const { return OPTIONS.maxErrors > 0 && errors >= static_cast<size_t>(OPTIONS.maxErrors); }
+
+    void printErrors() {
+        std::string report = formatErrors();
+        std::cout << (report.empty() ? "No errors logged.\n" : report) << std::flush;
+    }
+
+    // One line per diagnostic, at most --max-errors errors
+    std::string formatErrors() {
         std::lock_guard<std::mutex> lock(mtx);
-        if (errors.empty()) {
-            std::cout << "No errors logged.\n";
-        } else {
-            for (const auto& err : errors) {
-                std::cout << err << std::endl;
+        flush();
+
+        std::string report;
+        size_t printed = 0;
+        for (const auto& diagnostic : diagnostics) {
+            if (diagnostic.severity == Severity::ERROR && OPTIONS.maxErrors > 0 && printed++ >= static_cast<size_t>(OPTIONS.maxErrors)) {
+                continue;
             }
+            report += diagnostic.format() + "\n";
         }
+        if (aborted()) {
+            report += "Too many errors, compilation stopped.\n";
+        }
+        return report;
     }
 
     void clearErrors() {
         std::lock_guard<std::mutex> lock(mtx);
-        errors.clear();
+        flush();
+        diagnostics.clear();
+        errors = 0;
     }
 
-    const std::vector<std::string>& getErrors() const {
-        return errors;
+    // All diagnostics logged so far, in order
+    std::vector<Diagnostic> getDiagnostics() {
+        std::lock_guard<std::mutex> lock(mtx);
+        flush();
+        return diagnostics;
     }
 
 private:
@@ -56,10 +179,33 @@ private:
     ErrorHandler(const ErrorHandler&) = delete;
     ErrorHandler& operator=(const ErrorHandler&) = delete;
 
-    std::vector<std::string> errors;
+    void record(Diagnostic diagnostic) {
+        if (muted) {
+            return;
+        }
+        bool error = diagnostic.severity == Severity::ERROR;
+        (captured ? *captured : local).push_back(std::move(diagnostic));
+
+        if (error && ++errors && !captured && aborted()) {
+            throw CompilationAborted();
+        }
+    }
+
+    // Moves what the calling thread logged outside of tasks into the program's list
+    void flush() {
+        diagnostics.insert(diagnostics.end(), local.begin(), local.end());
+        local.clear();
+    }
+
+    std::vector<Diagnostic> diagnostics;
+    std::atomic<size_t> errors{0};
     mutable std::mutex mtx;
+
+    static inline thread_local std::vector<Diagnostic>* captured = nullptr;
+    static inline thread_local std::vector<Diagnostic> local;
+    static inline thread_local bool muted = false;
 };
 
-#define LOG_ERROR(msg, tok) ErrorHandler::getInstance().logError(msg, tok)
+#define LOG_ERROR(code, tok) ErrorHandler::getInstance().log(code, tok)
 
 #endif // ERRORHANDLER_HPP
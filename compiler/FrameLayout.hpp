@@ -0,0 +1,146 @@
+#ifndef FRAME_LAYOUT_HPP
+#define FRAME_LAYOUT_HPP
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "Node.hpp"
+#include "Linker.hpp"
+
+/*
+    Decides how the linker overlays the static frames of the procedures. There is no recursion and a
+    procedure only calls the ones declared before it, so the call depth of a procedure, one more than
+    the deepest of its callers and 1 for the ones main calls, is found walking the procedures from the
+    last one. Procedures of the same depth are never active at the same time and share their memory.
+    Arguments, return addresses and generated cells are written before every use, but a local scalar
+    the procedure may read before writing it keeps its value from the previous call, as do the elements
+    of local tables. Those are pinned to cells of their own.
+*/
+class FrameLayout {
+public:
+    void run(const std::vector<ProcedureNode*>& procedures) {
+        std::vector<Token*> heads(procedures.size(), nullptr);
+        std::vector<long long> depths(procedures.size(), 1);
+        for (auto procedure : procedures) {
+            if (procedure->id >= 0 && procedure->id < static_cast<long long>(procedures.size())) {
+                heads[procedure->id] = procedure->children[0]->token;
+                numbers[procedure->children[0]->token] = procedure->id;
+            }
+        }
+
+        for (auto it = procedures.rbegin(); it != procedures.rend(); ++it) {
+            calls((*it)->children[1], depths[(*it)->id], depths);
+            std::unordered_set<const Token*> assigned;
+            commands((*it)->children[1], assigned);
+        }
+
+        LINKER.frames(heads, depths, pinned);
+    }
+
+private:
+    std::unordered_map<const Token*, long long> numbers;    // By procedure
+    std::unordered_set<const Token*> pinned;
+
+    // Makes the procedures the subtree calls deeper than depth
+    void calls(const Node* node, long long depth, std::vector<long long>& depths) {
+        if (node->kind == NodeKind::PROC_CALL) {
+            auto callee = numbers.find(node->token);
+            if (callee != numbers.end()) {
+                depths[callee->second] = std::max(depths[callee->second], depth + 1);
+            }
+            return;
+        }
+        for (auto child : node->children) {
+            calls(child, depth, depths);
+        }
+    }
+
+    void read(const Token* token, const std::unordered_set<const Token*>& assigned) {
+        if ((token->getFunction() == TokenFunction::DEFAULT && !assigned.count(token))
+            || token->getFunction() == TokenFunction::TABLE) {
+            pinned.insert(token);
+        }
+    }
+
+    // Reads every identifier and table in the subtree
+    void reads(const Node* node, const std::unordered_set<const Token*>& assigned) {
+        if ((node->kind == NodeKind::IDENTIFIER || node->kind == NodeKind::TABEL) && node->token) {
+            read(node->token, assigned);
+        }
+        for (auto child : node->children) {
+            reads(child, assigned);
+        }
+    }
+
+    void commands(const Node* list, std::unordered_set<const Token*>& assigned) {
+        for (auto node : list->children) {
+            command(node, assigned);
+        }
+    }
+
+    // Follows the commands, assigned holds the scalars written on every way to the current one
+    void command(const Node* node, std::unordered_set<const Token*>& assigned) {
+        switch (node->kind) {
+            case NodeKind::ASSIGNMENT_COMMAND:
+            case NodeKind::READ_COMMAND: {
+                const Node* target = node->children[0];
+                if (node->kind == NodeKind::ASSIGNMENT_COMMAND) {
+                    reads(node->children[1], assigned);
+                }
+                if (target->kind == NodeKind::TABEL) {
+                    reads(target, assigned);
+                } else {
+                    assigned.insert(target->token);
+                }
+                break;
+            }
+            case NodeKind::WRITE_COMMAND:
+                reads(node, assigned);
+                break;
+            case NodeKind::PROC_CALL_COMMAND:
+                for (auto token : node->children[0]->children[0]->tokens) {
+                    read(token, assigned);      // The procedure may read it before writing it
+                }
+                break;
+            case NodeKind::IF_COMMAND:
+            case NodeKind::IF_ELSE_COMMAND: {
+                reads(node->children[0], assigned);
+                std::unordered_set<const Token*> then = assigned;
+                commands(node->children[1], then);
+                if (node->kind == NodeKind::IF_ELSE_COMMAND) {
+                    std::unordered_set<const Token*> otherwise = assigned;
+                    commands(node->children[2], otherwise);
+                    for (auto token : then) {
+                        if (otherwise.count(token)) {
+                            assigned.insert(token);
+                        }
+                    }
+                }
+                break;
+            }
+            case NodeKind::WHILE_COMMAND: {
+                reads(node->children[0], assigned);
+                std::unordered_set<const Token*> body = assigned;
+                commands(node->children[1], body);
+                break;
+            }
+            case NodeKind::REPEAT_COMMAND:
+                commands(node->children[0], assigned);
+                reads(node->children[1], assigned);
+                break;
+            case NodeKind::FORTO_COMMAND:
+            case NodeKind::FORDOWNTO_COMMAND: {
+                reads(node->children[0], assigned);
+                reads(node->children[1], assigned);
+                std::unordered_set<const Token*> body = assigned;
+                commands(node->children[2], body);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+};
+
+#endif // FRAME_LAYOUT_HPP
@@ -0,0 +1,73 @@
+#ifndef INLINING_HPP
+#define INLINING_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "Node.hpp"
+#include "Profile.hpp"
+#include "ErrorHandler.hpp"
+#include "postprocessing.hpp"
+
+/*
+    Builds the commands of a procedure in place of the calls the profile finds hot. A call costs the
+    SET, STORE and JUMP to the procedure and the RTRN back besides the copies of the arguments. The
+    inlined commands still get the arguments the same way and run on the static frame of the
+    procedure, so they behave exactly like the call. A call site is inlined when the cycles it saved in
+    the profiled run are at least the instructions the copy adds, up to MAX_SIZE instructions.
+    Procedures only call the ones declared before them, those are decided first, so the size of a
+    procedure includes the calls inlined into it.
+*/
+class Inlining {
+public:
+    // Returns true if any call was inlined
+    bool run(const std::vector<ProcedureNode*>& procedures, Node* main) {
+        if (PROFILE.empty()) {
+            return false;
+        }
+        for (auto procedure : procedures) {
+            const Node* body = procedure->children[1];
+            visit(procedure->children[1]);
+            bodies[procedure->children[0]->token] = {body, size(body)};
+        }
+        visit(main);
+        return inlined;
+    }
+
+private:
+    static constexpr long long CALL_COST = 71;      // SET, STORE, JUMP and RTRN
+    static constexpr long long MAX_SIZE = 512;
+
+    struct Body {
+        const Node* commands;
+        long long size;     // Instructions
+    };
+
+    std::unordered_map<const Token*, Body> bodies;  // By procedure
+    bool inlined = false;
+
+    void visit(Node* node) {
+        if (node->kind == NodeKind::PROC_CALL) {
+            auto body = bodies.find(node->token);
+            const BlockCounts* counts = PROFILE.find(node);
+            if (body != bodies.end() && counts && counts->count > 0 && body->second.size <= MAX_SIZE
+                && counts->count * CALL_COST >= (unsigned long long)body->second.size) {
+                static_cast<ProcCallNode*>(node)->inlined = body->second.commands;
+                inlined = true;
+            }
+            return;
+        }
+        for (auto child : node->children) {
+            visit(child);
+        }
+    }
+
+    static long long size(const Node* commands) {
+        bool muted = ErrorHandler::getInstance().mute(true);
+        long long instructions = count_instructions(commands->build());
+        ErrorHandler::getInstance().mute(muted);
+        return instructions;
+    }
+};
+
+#endif // INLINING_HPP
@@ -0,0 +1,106 @@
+#ifndef INTERVAL_HPP
+#define INTERVAL_HPP
+
+#include <climits>
+#include <algorithm>
+
+// Closed range of values, LLONG_MIN and LLONG_MAX stand for minus and plus infinity.
+struct Interval {
+    long long lo = LLONG_MIN;
+    long long hi = LLONG_MAX;
+
+    static Interval constant(long long value) { return Interval{value, value}; }
+
+    bool empty() const { return lo > hi; }
+    bool top() const { return lo == LLONG_MIN && hi == LLONG_MAX; }
+    bool nonNegative() const { return lo >= 0; }
+    bool contains(long long value) const { return lo <= value && value <= hi; }
+    bool operator==(const Interval& other) const { return lo == other.lo && hi == other.hi; }
+
+    Interval join(const Interval& other) const {
+        return Interval{std::min(lo, other.lo), std::max(hi, other.hi)};
+    }
+
+    Interval meet(const Interval& other) const {
+        return Interval{std::max(lo, other.lo), std::min(hi, other.hi)};
+    }
+
+    // Bounds that keep moving are pushed to infinity so loop analysis terminates
+    Interval widen(const Interval& next) const {
+        return Interval{next.lo < lo ? LLONG_MIN : lo, next.hi > hi ? LLONG_MAX : hi};
+    }
+
+    // Range of absolute values
+    Interval magnitude() const;
+};
+
+// Adds two bounds, infinities absorb and overflow saturates, for refining comparisons
+inline long long bound_add(long long x, long long y) {
+    if (x == LLONG_MIN || y == LLONG_MIN) return LLONG_MIN;
+    if (x == LLONG_MAX || y == LLONG_MAX) return LLONG_MAX;
+    long long sum;
+    if (__builtin_add_overflow(x, y, &sum)) return x > 0 ? LLONG_MAX : LLONG_MIN;
+    return sum;
+}
+
+inline long long bound_negate(long long x) {
+    if (x == LLONG_MIN) return LLONG_MAX;
+    if (x == LLONG_MAX) return LLONG_MIN;
+    return -x;
+}
+
+inline Interval Interval::magnitude() const {
+    if (lo >= 0) return *this;
+    if (hi <= 0) return Interval{bound_negate(hi), bound_negate(lo)};
+    return Interval{0, std::max(bound_negate(lo), hi)};
+}
+
+// Range of the exact results of +, - or *. The VM wraps around on overflow, so if any of them leaves
+// the 64-bit range the result can be anything and the range is full; infinite bounds are the extreme
+// values themselves.
+inline Interval wrapping(__int128 lo, __int128 hi) {
+    if (lo < LLONG_MIN || hi > LLONG_MAX) {
+        return Interval();
+    }
+    return Interval{static_cast<long long>(lo), static_cast<long long>(hi)};
+}
+
+inline Interval operator+(const Interval& a, const Interval& b) {
+    return wrapping(static_cast<__int128>(a.lo) + b.lo, static_cast<__int128>(a.hi) + b.hi);
+}
+
+inline Interval operator-(const Interval& a, const Interval& b) {
+    return wrapping(static_cast<__int128>(a.lo) - b.hi, static_cast<__int128>(a.hi) - b.lo);
+}
+
+inline Interval operator*(const Interval& a, const Interval& b) {
+    __int128 corners[] = {static_cast<__int128>(a.lo) * b.lo, static_cast<__int128>(a.lo) * b.hi,
+                          static_cast<__int128>(a.hi) * b.lo, static_cast<__int128>(a.hi) * b.hi};
+    return wrapping(*std::min_element(corners, corners + 4), *std::max_element(corners, corners + 4));
+}
+
+// Floor division, division by 0 gives 0
+inline Interval operator/(const Interval& a, const Interval& b) {
+    if (a.nonNegative() && b.lo >= 1) {
+        return Interval{b.hi == LLONG_MAX ? 0 : a.lo / b.hi, a.hi == LLONG_MAX ? LLONG_MAX : a.hi / b.lo};
+    }
+    long long bound = a.magnitude().hi;     // |a / b| <= |a|
+    if (a.nonNegative() && b.nonNegative()) {
+        return Interval{0, bound};
+    }
+    return Interval{bound_negate(bound), bound};
+}
+
+// Remainder takes the sign of the divisor, modulo 0 gives 0
+inline Interval operator%(const Interval& a, const Interval& b) {
+    Interval result{b.lo >= 0 ? 0 : bound_add(b.lo, 1), b.hi <= 0 ? 0 : bound_add(b.hi, -1)};
+    if (a.nonNegative() && b.nonNegative()) {
+        result.hi = std::min(result.hi, a.hi);
+    }
+    if (a.hi <= 0 && b.hi <= 0) {
+        result.lo = std::max(result.lo, a.lo);
+    }
+    return result;
+}
+
+#endif // INTERVAL_HPP
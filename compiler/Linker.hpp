@@ -0,0 +1,356 @@
+#ifndef LINKER_HPP
+#define LINKER_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <stdexcept>
+#include <mutex>
+#include "Token.hpp"
+#include "postprocessing.hpp"
+#include "Statistics.hpp"
+
+/*
+    Code generation does not see real memory addresses. Every token gets a relocatable address
+    BASE + slot * STRIDE and table cells are addressed by offsets from it. Procedures and main are
+    assembled into separate units, the linker lays them out after the prologue and resolves jumps
+    between units, return addresses and relocatable addresses. A unit does not depend on where it is
+    placed or where the variables live, which lets the compilation cache reuse it.
+    Tokens created during code generation get their real address when linking, in the order the code
+    refers to them, so the layout does not depend on which of the concurrent tasks created them first.
+    Once frames are given, the cells of main and the constant pool are packed from the first variable
+    cell on and the cells of every procedure go to the region of its call depth, which all procedures
+    of that depth share: only a chain of callers and callees is ever active and each callee is deeper.
+*/
+class Linker {
+public:
+    static constexpr long long BASE = 1LL << 62;
+    static constexpr long long STRIDE = 1LL << 40;
+    static constexpr long long FIRST_CELL = 9;      // Below are the accumulator, the registers and the constants 0 and 1
+
+    static Linker& getInstance() {
+        static Linker instance;
+        return instance;
+    }
+
+    // Gives every token its relocatable address, called once after parsing
+    // Addresses from free onwards are left for the tokens created during code generation
+    void begin(std::vector<Token*>& tokens, long long free) {
+        program = &tokens;
+        next = free;
+        slots.clear();
+        addresses.clear();
+        values.clear();
+        for (auto token : tokens) {
+            track(token);
+            values[token->getValue()] = token;
+        }
+        parsed = slots.size();
+        heads.clear();
+        depths.clear();
+        pinned.clear();
+    }
+
+    // Overlays the frames of the procedures when linking, heads and depths are indexed by procedure
+    // number, pinned cells of procedures keep their values between calls and stay out of the frames
+    void frames(const std::vector<Token*>& procedures, const std::vector<long long>& depth,
+                const std::unordered_set<const Token*>& kept) {
+        heads.clear();
+        for (size_t i = 0; i < procedures.size(); i++) {
+            heads[procedures[i]] = i;
+        }
+        depths = depth;
+        pinned = kept;
+    }
+
+    // Returns the token with the given value, creates it if the program does not have it yet
+    Token* intern(const std::string& value, TokenType type) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        STATS.add(Counter::LOOKUPS);
+        auto found = values.find(value);
+        if (found != values.end()) {
+            return found->second;
+        }
+
+        Token* token = new Token(type, value, 0, 0, -1, type != TokenType::NUMBER);
+        token->initialize();
+        program->push_back(token);
+        values[value] = token;
+        track(token);
+        return token;
+    }
+
+    bool relocatable(long long operand) const {
+        return operand >= BASE - STRIDE / 2;
+    }
+
+    // Token a relocatable address belongs to and the offset from its address
+    Token* token(long long operand, long long& offset) const {
+        size_t index = slot(operand);
+        offset = operand - BASE - static_cast<long long>(index) * STRIDE;
+        return index < slots.size() ? slots[index] : nullptr;
+    }
+
+    long long resolve(long long operand) const {
+        size_t index = slot(operand);
+        if (index >= slots.size()) {
+            throw std::runtime_error("Undefined address: " + std::to_string(operand));
+        }
+        return addresses[index] + operand - BASE - static_cast<long long>(index) * STRIDE;
+    }
+
+    // Lays out the prologue, the units and resolves everything left symbolic
+    // If map is given it receives the origin of every emitted instruction, blocks the profiled nodes
+    std::string link(const std::vector<Unit>& units, std::vector<SourceLocation>* map = nullptr,
+                     std::vector<BlockSite>* blocks = nullptr) {
+        // Allocate the tokens created during code generation and find the constants the units use
+        std::vector<bool> used(slots.size(), false);
+        std::vector<size_t> referenced;     // Used slots in the order the code refers to them
+        for (const auto& unit : units) {
+            for (const auto& instruction : unit.code) {
+                long long operand;
+                if (!address(instruction, operand) || slot(operand) >= used.size() || used[slot(operand)]) {
+                    continue;
+                }
+                used[slot(operand)] = true;
+                referenced.push_back(slot(operand));
+            }
+        }
+        allocate(referenced);
+
+        std::vector<size_t> constants;
+        for (auto index : referenced) {
+            if (slots[index]->getType() == TokenType::NUMBER && addresses[index] != 5 && addresses[index] != 6) {
+                constants.push_back(index);
+            }
+        }
+        std::sort(constants.begin(), constants.end(), [this](size_t a, size_t b) { return addresses[a] < addresses[b]; });
+
+        // INIT bools and constants
+        std::vector<std::string> prologue = {"SET 1", "STORE 6", "HALF", "STORE 5"};
+        for (auto index : constants) {
+            prologue.push_back("SET " + slots[index]->getValue());
+            prologue.push_back("STORE " + std::to_string(addresses[index]));
+        }
+
+        // Units follow the jump to main
+        std::unordered_map<std::string, long long> labels;
+        std::vector<long long> bases;
+        long long position = prologue.size() + 1;
+        for (const auto& unit : units) {
+            bases.push_back(position);
+            labels[unit.label] = position;
+            position += unit.code.size();
+        }
+
+        auto main = labels.find("MAIN");
+        if (main == labels.end()) {
+            throw std::runtime_error("Undefined label: MAIN");
+        }
+        prologue.push_back("JUMP " + std::to_string(main->second - static_cast<long long>(prologue.size())));
+
+        std::string output;
+        output.reserve(position * 12);
+        for (const auto& instruction : prologue) {
+            output += instruction;
+            output += '\n';
+        }
+        if (map) {
+            SourceLocation init;
+            init.procedure = "INIT";
+            map->assign(prologue.size(), init);
+        }
+
+        for (size_t i = 0; i < units.size(); i++) {
+            for (size_t j = 0; j < units[i].code.size(); j++) {
+                output += resolved(units[i].code[j], bases[i] + j, labels);
+                output += '\n';
+                if (map) {
+                    map->push_back(units[i].locations[units[i].origins[j]]);
+                }
+            }
+            for (size_t j = 0; blocks && j < units[i].blocks.size(); j++) {
+                BlockSite block = units[i].blocks[j];
+                block.entry += bases[i];
+                block.branch += block.branch < 0 ? 0 : bases[i];
+                blocks->push_back(block);
+            }
+        }
+
+        return output;
+    }
+
+    // Returns true and sets operand if the instruction refers to a relocatable address
+    bool address(const std::string& instruction, long long& operand) const {
+        size_t space = instruction.find(' ');
+        if (space == std::string::npos || space + 1 >= instruction.size()
+            || instruction[space + 1] == '*' || instruction[space + 1] == '&') {
+            return false;
+        }
+        operand = std::stoll(instruction.substr(space + 1));
+        return relocatable(operand);
+    }
+
+private:
+    Linker() = default;
+    ~Linker() = default;
+
+    Linker(const Linker&) = delete;
+    Linker& operator=(const Linker&) = delete;
+
+    // Makes a token relocatable, its real address stays unknown until linking if it was created late
+    void track(Token* token) {
+        addresses.push_back(token->getAddress());
+        token->setAddress(BASE + static_cast<long long>(slots.size()) * STRIDE);
+        slots.push_back(token);
+    }
+
+    // Gives the tokens created during code generation their addresses, moves the cells into the frames if set
+    void allocate(const std::vector<size_t>& referenced) {
+        if (depths.empty()) {
+            for (auto index : referenced) {
+                if (index >= parsed) {
+                    addresses[index] = next++;
+                }
+            }
+            STATS.add(Counter::CELLS, next);
+            return;
+        }
+
+        // Cells of the parsed tokens in their order, the generated ones after them
+        std::vector<size_t> order;
+        for (auto index : referenced) {
+            if (index < parsed) {
+                order.push_back(index);
+            }
+        }
+        std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return first(a) < first(b); });
+        for (auto index : referenced) {
+            if (index >= parsed) {
+                order.push_back(index);
+            }
+        }
+
+        long long end = FIRST_CELL;
+        std::vector<std::vector<size_t>> frames(depths.size());
+        for (auto index : order) {
+            if (index < parsed && first(index) < FIRST_CELL) {
+                continue;   // The constants 0 and 1
+            }
+            long long procedure = owner(index);
+            if (procedure < 0) {
+                place(index, end);
+            } else {
+                frames[procedure].push_back(index);
+            }
+        }
+
+        // Every depth gets the room of its largest frame
+        std::vector<long long> regions;
+        for (size_t i = 0; i < frames.size(); i++) {
+            long long size = 0;
+            for (auto index : frames[i]) {
+                size += cells(index);
+            }
+            regions.resize(std::max<size_t>(regions.size(), depths[i] + 1), 0);
+            regions[depths[i]] = std::max(regions[depths[i]], size);
+        }
+        std::vector<long long> bases(regions.size() + 1, end);
+        for (size_t depth = 1; depth < regions.size(); depth++) {
+            bases[depth + 1] = bases[depth] + regions[depth];
+        }
+        for (size_t i = 0; i < frames.size(); i++) {
+            long long at = bases[depths[i]];
+            for (auto index : frames[i]) {
+                place(index, at);
+            }
+        }
+        next = bases.back();
+        STATS.add(Counter::CELLS, next);
+    }
+
+    // Procedure the cells of a token belong to, -1 for main, the constant pool and pinned cells
+    long long owner(size_t index) const {
+        const Token* token = slots[index];
+        if (pinned.count(token)) {
+            return -1;
+        }
+        auto head = heads.find(token);
+        if (head != heads.end()) {
+            return head->second;
+        }
+
+        // Locals and generated cells of procedures are named "<procedure>-<name>"
+        const std::string& value = token->getValue();
+        size_t dash = value.find('-');
+        if (token->getType() != TokenType::IDENTIFIER || dash == 0 || dash == std::string::npos
+            || !std::all_of(value.begin(), value.begin() + dash, [](char c) { return c >= '0' && c <= '9'; })) {
+            return -1;
+        }
+        size_t procedure = std::stoull(value.substr(0, dash));
+        return procedure < depths.size() ? static_cast<long long>(procedure) : -1;
+    }
+
+    long long first(size_t index) const {
+        return addresses[index] + slots[index]->getLower();
+    }
+
+    long long cells(size_t index) const {
+        return slots[index]->getUpper() - slots[index]->getLower() + 1;
+    }
+
+    // Moves the cells of a token to at and advances at past them
+    void place(size_t index, long long& at) {
+        addresses[index] = at - slots[index]->getLower();
+        at += cells(index);
+    }
+
+    static size_t slot(long long operand) {
+        return (operand - BASE + STRIDE / 2) / STRIDE;
+    }
+
+    std::string resolved(const std::string& instruction, long long position,
+                         const std::unordered_map<std::string, long long>& labels) const {
+        size_t space = instruction.find(' ');
+        if (space == std::string::npos) {
+            return instruction;
+        }
+
+        std::string operation = instruction.substr(0, space + 1);
+        std::string operand = instruction.substr(space + 1);
+
+        if (operand[0] == '*') {
+            auto target = labels.find(operand.substr(1));
+            if (target == labels.end()) {
+                throw std::runtime_error("Undefined label: " + operand.substr(1));
+            }
+            STATS.add(Counter::LABELS);
+            return operation + std::to_string(target->second - position);       // Jump to another unit
+        }
+        if (operand[0] == '&') {
+            STATS.add(Counter::LABELS);
+            return operation + std::to_string(position + std::stoll(operand.substr(1)));   // Return address
+        }
+
+        long long value = std::stoll(operand);
+        return relocatable(value) ? operation + std::to_string(resolve(value)) : instruction;
+    }
+
+    std::vector<Token*> slots;
+    std::vector<long long> addresses;   // Real address of every slot
+    size_t parsed = 0;                  // Slots of the tokens known after parsing
+    long long next = 0;                 // First free address
+    std::vector<Token*>* program = nullptr;
+    std::unordered_map<std::string, Token*> values;
+    std::unordered_map<const Token*, size_t> heads;     // Return cells of the procedures, by procedure
+    std::vector<long long> depths;                      // Call depth of every procedure, empty if not overlaid
+    std::unordered_set<const Token*> pinned;
+    std::mutex mutex;
+};
+
+#define LINKER Linker::getInstance()
+
+#endif // LINKER_HPP
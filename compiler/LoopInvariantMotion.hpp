@@ -0,0 +1,139 @@
+#ifndef LOOP_INVARIANT_MOTION_HPP
+#define LOOP_INVARIANT_MOTION_HPP
+
+#include <string>
+#include <vector>
+#include "Node.hpp"
+
+/*
+    Computes *, / and % whose operands a WHILE or REPEAT loop never changes once before the loop, in a
+    cell of the unit the expression then only loads. Operands are numbers, variables and table
+    elements with a constant or unchanging index. The loop must not assign, read into or pass on the
+    variable or table, and must not iterate over the variable with a FOR. Arguments passed by
+    reference may alias each other, writing or passing any of them changes them all, scalars and
+    tables separately. Loops are visited from the outermost, so an expression moves out of as many
+    loops as possible. Only expressions that run in every iteration move: those of the commands of the
+    loop body itself, of the conditions of IF and WHILE commands among them and of the bodies of nested
+    REPEAT loops, but not of IF branches or of the bodies of nested WHILE and FOR loops, which may not
+    run at all. A REPEAT body runs at least once; a WHILE loop with moved expressions tests its
+    condition before the preheader and again after the body, so they are computed only if the body
+    runs. That is why the condition of the loop itself keeps its expressions. Ranges found inside the
+    loop need not hold before it and are dropped for the moved expressions.
+*/
+class LoopInvariantMotion {
+public:
+    // Moves expressions within one procedure or main, run before DivModFusion which leaves them alone
+    void run(Node* unit) {
+        owner = unit;
+        cells = 0;
+        visit(unit->kind == NodeKind::PROCEDURE ? unit->children[1] : unit);
+    }
+
+private:
+    const Node* owner = nullptr;    // Unit whose frame holds the cells
+    long long cells = 0;
+
+    static std::vector<Node*>* invariants(Node* loop) {
+        if (loop->kind == NodeKind::WHILE_COMMAND) {
+            return &static_cast<WhileCommandNode*>(loop)->invariants;
+        }
+        return &static_cast<RepeatCommandNode*>(loop)->invariants;
+    }
+
+    void visit(Node* node) {
+        NodeKind type = node->kind;
+        if (type == NodeKind::WHILE_COMMAND) {
+            body(node, node->children[1]);
+        } else if (type == NodeKind::REPEAT_COMMAND) {
+            body(node, node->children[0]);
+            hoist(node, node->children[1]);
+        }
+        for (auto child : node->children) {
+            visit(child);
+        }
+    }
+
+    // Moves the expressions of the commands that run whenever the list does
+    void body(Node* loop, Node* list) {
+        for (auto command : list->children) {
+            switch (command->kind) {
+                case NodeKind::IF_COMMAND:
+                case NodeKind::IF_ELSE_COMMAND:
+                case NodeKind::WHILE_COMMAND:
+                    hoist(loop, command->children[0]);      // Only the condition is certain to run
+                    break;
+                case NodeKind::REPEAT_COMMAND:
+                    body(loop, command->children[0]);
+                    hoist(loop, command->children[1]);
+                    break;
+                case NodeKind::FORTO_COMMAND:
+                case NodeKind::FORDOWNTO_COMMAND:
+                    break;                                  // Bounds are values, the body may not run
+                default:
+                    hoist(loop, command);
+            }
+        }
+    }
+
+    void hoist(Node* loop, Node* node) {
+        if (node->kind == NodeKind::EXPRESSION) {
+            auto expression = static_cast<ExpressionNode*>(node);
+            if (expression->hoisted < 0 && expensive(expression)
+                && invariant(loop, expression->children[0]) && invariant(loop, expression->children[1])) {
+                expression->hoisted = unit_cell(owner, "~h", cells++);
+                expression->ranges[0] = Interval();
+                expression->ranges[1] = Interval();
+                invariants(loop)->push_back(expression);
+            }
+            return;
+        }
+        for (auto child : node->children) {
+            hoist(loop, child);
+        }
+    }
+
+    // Multiplication, division or modulo that is not folded to a constant anyway
+    static bool expensive(const ExpressionNode* expression) {
+        if (expression->token == nullptr) {
+            return false;
+        }
+        Operator operation = expression->op;
+        long long a, b;
+        return (operation == Operator::TIMES || operation == Operator::DIVIDE || operation == Operator::MODULO)
+            && !(expression->children[0]->getConstant(a) && expression->children[1]->getConstant(b));
+    }
+
+    // Whether a FOR loop within the subtree iterates over token
+    static bool iterates(const Node* node, const Token* token) {
+        NodeKind type = node->kind;
+        if ((type == NodeKind::FORTO_COMMAND || type == NodeKind::FORDOWNTO_COMMAND) && node->token == token) {
+            return true;
+        }
+        for (auto child : node->children) {
+            if (iterates(child, token)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool unchanged(const Node* loop, const Token* token) {
+        return !loop->clobbers(token) && !iterates(loop, token);
+    }
+
+    // Whether the value, a number, a variable or a table element, is the same in every iteration
+    static bool invariant(const Node* loop, const Node* value) {
+        const Node* node = value->children[0];
+        NodeKind type = node->kind;
+        if (type == NodeKind::NUMBER) {
+            return true;
+        }
+        if (type == NodeKind::IDENTIFIER) {
+            return unchanged(loop, node->token);
+        }
+        const Node* index = node->children[0];
+        return unchanged(loop, node->token) && (index->kind == NodeKind::NUMBER || unchanged(loop, index->token));
+    }
+};
+
+#endif // LOOP_INVARIANT_MOTION_HPP
@@ -2,24 +2,188 @@
 #define NODE_HPP
 
 #include <vector>
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <unordered_map>
 #include "Token.hpp"
 #include "ErrorHandler.hpp"
+#include "Options.hpp"
+#include "Interval.hpp"
+#include "postprocessing.hpp"
+#include "Linker.hpp"
+#include "Statistics.hpp"
+#include "Templates.hpp"
+
+// Returns the constant pool entry holding value, allocates a new one if the program does not use it yet
+inline Token* constant_token(long long value) {
+    return LINKER.intern(std::to_string(value), TokenType::NUMBER);
+}
+
+// Returns the compiler generated cell with the given name, e.g. "2-~0" for the first one of procedure 2
+inline Token* hidden_token(const std::string& name) {
+    return LINKER.intern(name, TokenType::IDENTIFIER);
+}
+
+// Sequence superopt chose for a template, the shortest one at -Os; parameter is the cell X stands for
+inline const InstructionTemplate& instruction_template(TemplateId id) {
+    return (OPTIONS.small ? SMALL_TEMPLATES : FAST_TEMPLATES)[static_cast<size_t>(id)];
+}
+
+inline std::string emit_template(TemplateId id, long long parameter = 0) {
+    std::ostringstream assembly;
+    const InstructionTemplate& chosen = instruction_template(id);
+
+    for (size_t i = 0; i < chosen.size; i++) {
+        const TemplateInstruction& instruction = chosen.code[i];
+        assembly << instruction.opcode;
+        switch (instruction.kind) {
+            case TemplateOperand::NONE:      break;
+            case TemplateOperand::PARAMETER: assembly << " " << parameter; break;
+            case TemplateOperand::CONSTANT:  assembly << " " << constant_token(instruction.value)->getAddress(); break;
+            default:                         assembly << " " << instruction.value; break;
+        }
+        assembly << std::endl;
+    }
+    return assembly.str();
+}
+
+// Address of table[index] kept in cell while a loop steps index by one, chosen by StrengthReduction
+struct InductionPointer {
+    Token* table;
+    Token* index;
+    long long cell;
+};
+
+// Points the cells at the elements their indices select now
+inline std::string init_pointers(const std::vector<InductionPointer>& pointers) {
+    std::ostringstream assembly;
+
+    for (const auto& pointer : pointers) {
+        if (pointer.table->getFunction() == TokenFunction::T_ARG) {
+            assembly << "LOAD " << pointer.table->getAddress() << std::endl;   // Load address of index0
+        } else {
+            assembly << "SET " << pointer.table->getAddress() << std::endl;    // Set address of index0
+        }
+        assembly << "ADD " << pointer.index->getAddress() << std::endl;        // Add the index
+        assembly << "STORE " << pointer.cell << std::endl;                     // Store the element's address
+    }
+
+    return assembly.str();
+}
+
+// Moves the cells one element forward for step 1, back for -1
+inline std::string step_pointers(const std::vector<InductionPointer>& pointers, long long step) {
+    std::ostringstream assembly;
+
+    for (const auto& pointer : pointers) {
+        assembly << "LOAD " << pointer.cell << std::endl;
+        assembly << (step > 0 ? "ADD " : "SUB ") << 6 << std::endl;
+        assembly << "STORE " << pointer.cell << std::endl;
+    }
+
+    return assembly.str();
+}
+
+// Kind of an AST node, passes dispatch on it instead of the name
+enum class NodeKind {
+    PROGRAM_ALL, PROCEDURES, PROCEDURE, PROC_HEAD, ARGS_DECL, PROC_CALL_COMMAND, PROC_CALL, ARGS, MAIN, COMMANDS,
+    ASSIGNMENT_COMMAND, IF_ELSE_COMMAND, IF_COMMAND, WHILE_COMMAND, REPEAT_COMMAND, FORTO_COMMAND, FORDOWNTO_COMMAND,
+    READ_COMMAND, WRITE_COMMAND, DECLARATIONS, EXPRESSION, CONDITION, VALUE, NUMBER, IDENTIFIER, TABEL
+};
+
+// Operator of an expression or condition, NONE for every other node and for a single value
+enum class Operator {
+    NONE, PLUS, MINUS, TIMES, DIVIDE, MODULO, EQ, NEQ, GT, LT, GTE, LTE
+};
+
+// Name of a kind as printed in the AST, the source map and the statistics
+inline const char* nodeKindName(NodeKind kind) {
+    switch (kind) {
+        case NodeKind::PROGRAM_ALL:         return "PROGRAM_ALL";
+        case NodeKind::PROCEDURES:          return "PROCEDURES";
+        case NodeKind::PROCEDURE:           return "PROCEDURE";
+        case NodeKind::PROC_HEAD:           return "PROC_HEAD";
+        case NodeKind::ARGS_DECL:           return "ARGS_DECL";
+        case NodeKind::PROC_CALL_COMMAND:   return "PROC_CALL_COMMAND";
+        case NodeKind::PROC_CALL:           return "PROC_CALL";
+        case NodeKind::ARGS:                return "ARGS";
+        case NodeKind::MAIN:                return "MAIN";
+        case NodeKind::COMMANDS:            return "COMMANDS";
+        case NodeKind::ASSIGNMENT_COMMAND:  return "ASSIGNMENT_COMMAND";
+        case NodeKind::IF_ELSE_COMMAND:     return "IF_ELSE_COMMAND";
+        case NodeKind::IF_COMMAND:          return "IF_COMMAND";
+        case NodeKind::WHILE_COMMAND:       return "WHILE_COMMAND";
+        case NodeKind::REPEAT_COMMAND:      return "REPEAT_COMMAND";
+        case NodeKind::FORTO_COMMAND:       return "FORTO_COMMAND";
+        case NodeKind::FORDOWNTO_COMMAND:   return "FORDOWNTO_COMMAND";
+        case NodeKind::READ_COMMAND:        return "READ_COMMAND";
+        case NodeKind::WRITE_COMMAND:       return "WRITE_COMMAND";
+        case NodeKind::DECLARATIONS:        return "DECLARATIONS";
+        case NodeKind::EXPRESSION:          return "EXPRESSION";
+        case NodeKind::CONDITION:           return "CONDITION";
+        case NodeKind::VALUE:               return "VALUE";
+        case NodeKind::NUMBER:              return "NUMBER";
+        case NodeKind::IDENTIFIER:          return "IDENTIFIER";
+        case NodeKind::TABEL:               return "TABEL";
+    }
+    return "UNKNOWN";
+}
+
+// Operator of the token an expression or condition is built with, by its type
+inline Operator operatorOf(const Token* token) {
+    if (!token) {
+        return Operator::NONE;
+    }
+    switch (token->getType()) {
+        case TokenType::T_PLUS:     return Operator::PLUS;
+        case TokenType::T_MINUS:    return Operator::MINUS;
+        case TokenType::T_MUL:      return Operator::TIMES;
+        case TokenType::T_DIV:      return Operator::DIVIDE;
+        case TokenType::T_MOD:      return Operator::MODULO;
+        case TokenType::T_EQ:       return Operator::EQ;
+        case TokenType::T_NEQ:      return Operator::NEQ;
+        case TokenType::T_GT:       return Operator::GT;
+        case TokenType::T_LT:       return Operator::LT;
+        case TokenType::T_GTE:      return Operator::GTE;
+        case TokenType::T_LTE:      return Operator::LTE;
+        default:                    return Operator::NONE;
+    }
+}
 
 class Node {
 public:
+    const NodeKind kind;
     std::vector<Node*> children;
     std::vector<Token*> tokens;
     Token* token;
+    Operator op;
     long long id;
+    unsigned long long line;
+    std::string block;      // Stable ID of a node the profile counts, given by Profile::number
 
-    explicit Node(Token* token = nullptr, long long id = -1) : token(token), id(id) {}
+    // Values of FOR iterators substituted as constants while building unrolled copies of loop bodies
+    static inline thread_local std::unordered_map<const Token*, long long> boundIterators;
 
+    // Cleared while the pass manager measures the code built without unrolling
+    static inline thread_local bool unrolling = true;
+
+    Node(NodeKind kind, Token* token, long long id)
+        : kind(kind), token(token), op(operatorOf(token)), id(id), line(token ? token->getLine() : 0) {
+        STATS.add(Counter::NODES);
+    }
+
+    // Deletes the subtree from a worklist, children are detached first so that no destructor recurses
     virtual ~Node() {
-        for (auto child : children) {
-            delete child;
+        std::vector<Node*> pending;
+        pending.swap(children);
+        while (!pending.empty()) {
+            Node* node = pending.back();
+            pending.pop_back();
+            pending.insert(pending.end(), node->children.begin(), node->children.end());
+            node->children.clear();
+            delete node;
         }
     }
 
@@ -31,7 +195,44 @@ public:
         tokens.push_back(token);
     }
 
-    virtual void print(int level = 0) const {
+    void setLine(unsigned long long line) {
+        this->line = line;
+    }
+
+    // Wraps generated code in source map directives, assemble_unit strips them
+    // and attributes every instruction in between to this node's line and kind.
+    std::string locate(const std::string& code) const {
+        std::ostringstream located;
+
+        located << (isLoop() ? "#LOOP " : "#LOC ") << line << " " << getNodeType() << std::endl;
+        located << code;
+        located << "#ENDLOC" << std::endl;
+
+        return located.str();
+    }
+
+    // Profiling directive of a --profile-generate build, assemble_unit records the instruction that follows
+    std::string mark(const std::string& directive, const std::string& sense = "") const {
+        if (!OPTIONS.profileGenerate || block.empty()) {
+            return "";
+        }
+        return directive + " " + block + (sense.empty() ? "" : " " + sense) + "\n";
+    }
+
+    // Prints the subtree in preorder from an explicit stack
+    void print(int level = 0) const {
+        std::vector<std::pair<const Node*, int>> pending{{this, level}};
+        while (!pending.empty()) {
+            auto [node, depth] = pending.back();
+            pending.pop_back();
+            node->printNode(depth);
+            for (auto child = node->children.rbegin(); child != node->children.rend(); ++child) {
+                pending.emplace_back(*child, depth + 1);
+            }
+        }
+    }
+
+    void printNode(int level) const {
         for (int i = 0; i < level; ++i) {
             std::cout << "  ";
         }
@@ -54,45 +255,95 @@ public:
         }
 
         std::cout << std::endl;
+    }
+
+    std::string getNodeType() const { return nodeKindName(kind); }
+
+    virtual bool isLoop() const { return false; }
+
+    // Code storing the value of a node hoisted out of a loop in its cell, run before the loop
+    virtual std::string hoist() const { return ""; }
 
-        for (const auto& child : children) {
-            child->print(level + 1);
+    // Returns true and sets value if the node always evaluates to the same number
+    virtual bool getConstant(long long& value) const { return false; }
+
+    // Returns true if target is used anywhere in the subtree
+    bool uses(const Token* target) const {
+        if (token == target || std::find(tokens.begin(), tokens.end(), target) != tokens.end()) {
+            return true;
+        }
+        for (auto child : children) {
+            if (child->uses(target)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Returns true if the subtree may change target: assigns it, reads it or passes it to a procedure
+    bool writes(const Token* target) const {
+        if ((kind == NodeKind::ASSIGNMENT_COMMAND || kind == NodeKind::READ_COMMAND) && children[0]->token == target) {
+            return true;
+        }
+        if (kind == NodeKind::ARGS && std::find(tokens.begin(), tokens.end(), target) != tokens.end()) {
+            return true;
+        }
+        for (auto child : children) {
+            if (child->writes(target)) {
+                return true;
+            }
         }
+        return false;
     }
 
-    virtual std::string getNodeType() const = 0;
+    // Like writes, but arguments passed by reference may alias each other: writing or passing on any
+    // scalar argument may change a scalar argument, the same for table arguments
+    bool clobbers(const Token* target) const {
+        if (target->getType() == TokenType::NUMBER) {
+            return false;
+        }
+        TokenFunction function = target->getFunction();
+        if (function != TokenFunction::ARG && function != TokenFunction::T_ARG) {
+            return writes(target);
+        }
+
+        if ((kind == NodeKind::ASSIGNMENT_COMMAND || kind == NodeKind::READ_COMMAND) && children[0]->token->getFunction() == function) {
+            return true;
+        }
+        if (kind == NodeKind::ARGS) {
+            for (auto passed : tokens) {
+                if (passed->getFunction() == function) {
+                    return true;
+                }
+            }
+        }
+        for (auto child : children) {
+            if (child->clobbers(target)) {
+                return true;
+            }
+        }
+        return false;
+    }
 
     virtual std::string build(std::vector<Token*> *tokens = nullptr) const = 0;
 };
 
+// Address of the index-th cell a pass keeps in the frame of unit, tagged per pass ("~" DivModFusion,
+// "~h" LoopInvariantMotion, "~i" StrengthReduction). The name only depends on the unit and the order,
+// so cached units refer to the same cells.
+inline long long unit_cell(const Node* unit, const std::string& tag, long long index) {
+    std::string owner = unit->kind == NodeKind::PROCEDURE ? std::to_string(unit->id) + "-" : "";
+    return hidden_token(owner + tag + std::to_string(index))->getAddress();
+}
+
 
 class ProgramAllNode : public Node {
 public:
-    explicit ProgramAllNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "PROGRAM_ALL"; }
+    explicit ProgramAllNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::PROGRAM_ALL, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
+        // Procedures are assembled into units of their own, the linker adds the prologue and lays them out.
 
-        // TODO : determine whether bools and constants are used to optimise 75 overhead.
-        // INIT bools.
-        assembly << "SET " << 1 << std::endl;
-        assembly << "STORE " << 6 << std::endl;
-        assembly << "HALF" << std::endl;
-        assembly << "STORE " << 5 << std::endl;
-
-        // INIT constants
-        std::vector<Token*> subvec(tokens->begin() + 2, tokens->end());
-
-        for (auto token : subvec) {
-            if (token->getType() == TokenType::NUMBER) {
-                assembly << "SET " << token->getValue() << std::endl;
-                assembly << "STORE " << token->getAddress() << std::endl;
-            }
-        }
-
-        assembly << "JUMP " << "*MAIN" << std::endl;    // Skip procedures before main.
-        assembly << children[0]->build();               // Insert procedures.
-        assembly << "*MAIN ";                           // Label Main.
         assembly << children[1]->build();               // Insert Main.
         assembly << "HALT" << std::endl;                // Finish the program.
 
@@ -100,45 +351,47 @@ public:
     }
 };
 
-class ProceduresNode : public Node {
+class ProcedureNode : public Node {
 public:
-    explicit ProceduresNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "PROCEDURES"; }
+    explicit ProcedureNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::PROCEDURE, token, id) {}
+
+    // Builds this procedure alone, the others are separate units
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
-        // 0 - procedures, 1 - proc_head, 2 - commands, 3 - declarations (optional)
+        std::ostringstream procedure;
+        // 0 - proc_head, 1 - commands, 2 - declarations (optional)
 
-        if (children.empty()) {
-            return assembly.str();
-        }
+        assembly << "#PROC " << children[0]->token->getValue() << std::endl;    // Attribute code to the procedure
+        procedure << children[1]->build();                                      // Build procedure, proc_head is built before
+        procedure << "RTRN " << children[0]->token->getAddress() << std::endl;  // Return to the caller
+        assembly << locate(procedure.str());
 
-        if (children[0]->getNodeType() == "PROCEDURES") {
-            assembly << children[0]->build();
-        }
-
-        // Ignore because sometimes children[3] somehow gets object that is not in children
-        try {
-            children.at(3)->getNodeType();
-        } catch (const std::out_of_range& e) { }
+        return assembly.str();
+    }
+};
 
-        if (children[1]->getNodeType() == "PROC_HEAD" && children[2]->getNodeType() == "COMMANDS") {
-            assembly << "*PROC_" + children[1]->token->getValue() << " ";           // Label procedure
-            children[1]->build();                                                   // Build proc_head
-            assembly << children[2]->build();                                       // Build procedure
-            for (auto arg : children[1]->token->getArgs()){
+class ProceduresNode : public Node {
+public:
+    explicit ProceduresNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::PROCEDURES, token, id) {}
 
-            }
-            assembly << "RTRN " << children[1]->token->getAddress() << std::endl;   // Return to the caller
+    // Procedures in the order of declaration
+    std::vector<ProcedureNode*> list() const {
+        std::vector<ProcedureNode*> procedures;
+        for (auto child : children) {
+            procedures.push_back(static_cast<ProcedureNode*>(child));
         }
+        return procedures;
+    }
 
-        return assembly.str();
+    // Every procedure is assembled into a unit of its own
+    std::string build(std::vector<Token*> *tokens = nullptr) const override {
+        return "";
     }
 };
 
 class ProcHeadNode : public Node {
 public:
-    explicit ProcHeadNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "PROC_HEAD"; }
+    explicit ProcHeadNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::PROC_HEAD, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - ard_declaration
@@ -158,25 +411,17 @@ public:
 
 class ArgsDeclNode : public Node {
 public:
-    explicit ArgsDeclNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "ARGS_DECL"; }
+    explicit ArgsDeclNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::ARGS_DECL, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
-        std::ostringstream assembly;
-
-        tokens->push_back(token);
-
-        for (auto node : children) {
-            assembly << node->build(tokens);
-        }
-
-        return assembly.str();
+        // tokens - declared arguments in order
+        tokens->insert(tokens->end(), this->tokens.begin(), this->tokens.end());
+        return "";
     }
 };
 
 class ProcCallCommandNode : public Node {
 public:
-    explicit ProcCallCommandNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "PROC_CALL_COMMAND"; }
+    explicit ProcCallCommandNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::PROC_CALL_COMMAND, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - proc_call
@@ -191,13 +436,16 @@ public:
 
 class ProcCallNode : public Node {
 public:
-    explicit ProcCallNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "PROC_CALL"; }
+    const Node* inlined = nullptr;  // Commands of the procedure built in place of the call, chosen by Inlining
+
+    explicit ProcCallNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::PROC_CALL, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - args
         // token - procedure_identifier
 
+        assembly << mark("#BLOCK");                                         // Counts the calls
+
         std::vector<Token*> *passed_args = new std::vector<Token*>();
         std::vector<Token*> *args = new std::vector<Token*>(token->getArgs());
 
@@ -205,10 +453,12 @@ public:
 
         if (args->size() != passed_args->size()){
             if (args->size() > passed_args->size()){
-                LOG_ERROR("Not enough arguments passed.", token);
+                LOG_ERROR(ErrorCode::NOT_ENOUGH_ARGUMENTS, token);
             } else {
-                std::cout << args->size() << " | " << passed_args->size() << std::endl;
-                LOG_ERROR("Too many arguments passed.", token);
+                if (!OPTIONS.quiet) {
+                    std::cout << args->size() << " | " << passed_args->size() << std::endl;
+                }
+                LOG_ERROR(ErrorCode::TOO_MANY_ARGUMENTS, token);
             }
             return assembly.str();
         }
@@ -216,13 +466,19 @@ public:
         for (long long i = 0; i < args->size(); i++) {
             if (!((args->at(i)->getFunction() == TokenFunction::T_ARG && passed_args->at(i)->getFunction() == TokenFunction::TABLE)
                 || (args->at(i)->getFunction() == TokenFunction::T_ARG && passed_args->at(i)->getFunction() == TokenFunction::T_ARG)
-                || (args->at(i)->getFunction() == TokenFunction::ARG && passed_args->at(i)->getFunction() == TokenFunction::DEFAULT)
-                || (args->at(i)->getFunction() == TokenFunction::ARG && passed_args->at(i)->getFunction() == TokenFunction::ITERATOR)
-                || (args->at(i)->getFunction() == TokenFunction::ARG && passed_args->at(i)->getFunction() == TokenFunction::ARG))) {
-                LOG_ERROR("Missmatched argument types.", token);
+                || (scalar(args->at(i)) && scalar(passed_args->at(i))))) {
+                LOG_ERROR(ErrorCode::MISMATCHED_ARGUMENTS, token);
             }
 
-            if (passed_args->at(i)->getFunction() == TokenFunction::ARG || passed_args->at(i)->getFunction() == TokenFunction::T_ARG) {
+            if (args->at(i)->getFunction() == TokenFunction::V_ARG || args->at(i)->getFunction() == TokenFunction::VR_ARG) {
+                if (passed_args->at(i)->getFunction() == TokenFunction::ARG) {
+                    assembly << "LOADI " << passed_args->at(i)->getAddress() << std::endl;
+                } else {
+                    assembly << "LOAD " << passed_args->at(i)->getAddress() << std::endl;
+                }
+                assembly << "STORE " << args->at(i)->getAddress() << std::endl;    // Copy the value in
+            }
+            else if (passed_args->at(i)->getFunction() == TokenFunction::ARG || passed_args->at(i)->getFunction() == TokenFunction::T_ARG) {
                 assembly << "LOAD " << passed_args->at(i)->getAddress() << std::endl;
                 assembly << "STORE " << args->at(i)->getAddress() << std::endl;
             }
@@ -232,48 +488,66 @@ public:
             }
         }
 
-        assembly << "SET " << "&3" << std::endl;                            // Set return address 3 lines forward
-        assembly << "STORE " << token->getAddress() << std::endl;           // Store return address in procedure's variable
-        assembly << "JUMP " << "*PROC_" + token->getValue() << std::endl;   // Jump to the procedure
+        if (inlined) {
+            // The body in place of the jump, its diagnostics are reported with the procedure
+            bool muted = ErrorHandler::getInstance().mute(true);
+            assembly << relabel(inlined->build(), "_I" + block.substr(block.rfind(':') + 1));
+            ErrorHandler::getInstance().mute(muted);
+        } else {
+            assembly << "SET " << "&3" << std::endl;                            // Set return address 3 lines forward
+            assembly << "STORE " << token->getAddress() << std::endl;           // Store return address in procedure's variable
+            assembly << "JUMP " << "*PROC_" + token->getValue() << std::endl;   // Jump to the procedure
+        }
+
+        for (long long i = 0; i < args->size(); i++) {
+            if (args->at(i)->getFunction() == TokenFunction::VR_ARG) {
+                assembly << "LOAD " << args->at(i)->getAddress() << std::endl;     // Copy the value back out
+                if (passed_args->at(i)->getFunction() == TokenFunction::ARG) {
+                    assembly << "STOREI " << passed_args->at(i)->getAddress() << std::endl;
+                } else {
+                    assembly << "STORE " << passed_args->at(i)->getAddress() << std::endl;
+                }
+            }
+        }
 
         delete passed_args;
         delete args;
 
         return assembly.str();
     }
+
+private:
+    // Scalar variables and arguments, however ArgumentModes passes them
+    static bool scalar(const Token* token) {
+        return token->getFunction() == TokenFunction::DEFAULT || token->getFunction() == TokenFunction::ITERATOR
+            || token->getFunction() == TokenFunction::ARG || token->getFunction() == TokenFunction::V_ARG
+            || token->getFunction() == TokenFunction::VR_ARG;
+    }
 };
 
 class ArgsNode : public Node {
 public:
-    explicit ArgsNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "ARGS"; }
+    explicit ArgsNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::ARGS, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
-        // 0 - following args
-        // token - this argument
-        std::ostringstream assembly;
-
-        tokens->push_back(token);
-
-        for (auto node : children) {
-            assembly << node->build(tokens);
-        }
-
-        return assembly.str();
+        // tokens - passed arguments in order
+        tokens->insert(tokens->end(), this->tokens.begin(), this->tokens.end());
+        return "";
     }
 };
 
 class MainNode : public Node {
 public:
-    explicit MainNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "MAIN"; }
+    explicit MainNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::MAIN, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - declarations, 1 - commands
         // 0 - commands
 
+        assembly << "#PROC " << "MAIN" << std::endl;   // Attribute code to main in the source map.
+
         // Build declarations and commands.
         for (auto node : children) {
-            assembly << node->build();
+            assembly << locate(node->build());
         }
 
         return assembly.str();
@@ -282,17 +556,14 @@ public:
 
 class CommandsNode : public Node {
 public:
-    explicit CommandsNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "COMMANDS"; }
+    explicit CommandsNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::COMMANDS, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
-        // 0 - prev commands, 1 - command
-        // 1 - command
-        // %empty%
+        // 0..n - commands in order
 
         // Build all the commands.
         for (auto node : children) {
-            assembly << node->build();
+            assembly << node->locate(node->build());
         }
 
         return assembly.str();
@@ -301,24 +572,43 @@ public:
 
 class AssignmentCommandNode : public Node {
 public:
-    explicit AssignmentCommandNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "ASSIGNMENT_COMMAND"; }
+    long long pointer = -1;                     // Cell with the address of the assigned element, filled in by StrengthReduction
+    std::vector<InductionPointer> stepped;      // Pointers following the assigned index, which is stepped by step
+    long long step = 0;
+
+    explicit AssignmentCommandNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::ASSIGNMENT_COMMAND, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - identifier, 1 - expression
+        long long index;
 
         if (children[0]->token->getAssignibility() == false && children[0]->token->getFunction() != TokenFunction::TABLE) {
-            LOG_ERROR("Cannot assign token.", children[0]->token);
+            LOG_ERROR(ErrorCode::UNASSIGNABLE, children[0]->token);
         }
 
-        if (children[0]->token->getFunction() == TokenFunction::ARG || children[0]->token->getFunction() == TokenFunction::T_ARG){
-            if (children[0]->getNodeType() == "IDENTIFIER") {
+        if (pointer >= 0 && !children[0]->children[0]->getConstant(index)) {
+            assembly << children[1]->build();                                       // Put value into R4
+            assembly << "LOAD " << 4 << std::endl;                                  // Load value from R4
+            assembly << "STOREI " << pointer << std::endl;                          // Store value in the element the pointer holds
+        }
+        else if (children[0]->token->getFunction() == TokenFunction::ARG || children[0]->token->getFunction() == TokenFunction::T_ARG){
+            if (children[0]->kind == NodeKind::IDENTIFIER) {
                 assembly << children[1]->build();                                       // Put value into R4
                 assembly << "LOAD " << children[0]->token->getAddress() << std::endl;   // Load address from arg's address
                 assembly << "STORE " << 3 << std::endl;                                 // Store address in R3
                 assembly << "LOAD " << 4 << std::endl;
                 assembly << "STOREI " << 3 << std::endl;                                // Store value into variable's addres
             }
+            else if (children[0]->children[0]->getConstant(index)) {
+                assembly << children[1]->build();                                       // Put value into R4
+                assembly << "LOAD " << 4 << std::endl;                                  // Load value from R4
+                assembly << "STORE " << 1 << std::endl;                                 // Store value in R1
+                assembly << "LOAD " << children[0]->token->getAddress() << std::endl;   // Get address of index0
+                assembly << "ADD " << constant_token(index)->getAddress() << std::endl; // Add the constant index
+                assembly << "STORE " << 3 << std::endl;                                 // Store value in R3
+                assembly << "LOAD " << 1 << std::endl;                                  // Load value from R1
+                assembly << "STOREI " << 3 << std::endl;                                // Store value in table
+            }
             else {
                 assembly << children[1]->build();                                       // Put value into R4
                 assembly << "LOAD " << 4 << std::endl;                                  // Load value from R4
@@ -332,11 +622,16 @@ public:
             }
         }
         else {
-            if (children[0]->getNodeType() == "IDENTIFIER") {
+            if (children[0]->kind == NodeKind::IDENTIFIER) {
                 assembly << children[1]->build();                                       // Put value into R4
                 assembly << "LOAD " << 4 << std::endl;
                 assembly << "STORE " << children[0]->token->getAddress() << std::endl;  // Store value into variable's addres
             }
+            else if (children[0]->children[0]->getConstant(index)) {
+                assembly << children[1]->build();                                       // Put value into R4
+                assembly << "LOAD " << 4 << std::endl;
+                assembly << "STORE " << children[0]->token->getAddress() + index << std::endl;  // Store value directly in the cell
+            }
             else {
                 assembly << children[1]->build();                                       // Put value into R4
                 assembly << "LOAD " << 4 << std::endl;                                  // Load value from R4
@@ -349,6 +644,7 @@ public:
                 assembly << "STOREI " << 3 << std::endl;                                // Store value in table
             }
         }
+        assembly << step_pointers(stepped, step);                                       // Keep pointers on the stepped index
 
         return assembly.str();
     }
@@ -356,14 +652,28 @@ public:
 
 class IfElseCommandNode : public Node {
 public:
-    explicit IfElseCommandNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "IF_ELSE_COMMAND"; }
+    bool swapped = false;   // ELSE runs more often, it is jumped to and THEN falls through, chosen by ProfileLayout
+
+    explicit IfElseCommandNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::IF_ELSE_COMMAND, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - condition, 1 - then, 2 - else
 
+        assembly << mark("#BLOCK");
         assembly << children[0]->build();                       // In R4 will be 1 if True or 0 if False
         assembly << "LOAD " << 4 << std::endl;
+        if (swapped) {
+            assembly << mark("#BRANCH", "F");
+            assembly << "JZERO " << "*ELSE_IF_" << id << std::endl; // If False jump to ELSE label
+            assembly << children[1]->build();                       // Insert THEN commands
+            assembly << "JUMP " << "*END_IF_" << id << std::endl;   // Jump to the END of the if
+            assembly << "*ELSE_IF_" << id << " ";                   // Label ELSE block
+            assembly << children[2]->build();                       // Insert ELSE block
+            assembly << "*END_IF_" << id << " ";                    // Label END of the if
+
+            return assembly.str();
+        }
+        assembly << mark("#BRANCH", "T");
         assembly << "JPOS " << "*THEN_IF_" << id << std::endl;  // If True jump to THEN label
         assembly << children[2]->build();                       // Insert ELSE commands
         assembly << "JUMP " << "*END_IF_" << id << std::endl;   // Jump to the END of the if
@@ -377,14 +687,15 @@ public:
 
 class IfCommandNode : public Node {
 public:
-    explicit IfCommandNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "IF_COMMAND"; }
+    explicit IfCommandNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::IF_COMMAND, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - condition, 1 - then
 
+        assembly << mark("#BLOCK");
         assembly << children[0]->build();                       // In R4 will be 1 if True or 0 if False
         assembly << "LOAD " << 4 << std::endl;
+        assembly << mark("#BRANCH", "F");
         assembly << "JZERO " << "*END_IF_" << id << std::endl;  // If False jump to END label
         assembly << children[1]->build();                       // Insert ELSE commands
         assembly << "*END_IF_" << id << " ";                    // Label END of the if
@@ -395,15 +706,53 @@ public:
 
 class WhileCommandNode : public Node {
 public:
-    explicit WhileCommandNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "WHILE_COMMAND"; }
+    std::vector<InductionPointer> pointers;     // Element addresses kept by StrengthReduction
+    std::vector<Node*> invariants;              // Computed once before the loop, chosen by LoopInvariantMotion
+    bool rotated = false;                       // Condition after the body, chosen by ProfileLayout for loops iterating more than once
+
+    explicit WhileCommandNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::WHILE_COMMAND, token, id) {}
+    bool isLoop() const override { return true; }
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - condition, 1 - command
 
+        assembly << mark("#BLOCK");
+        assembly << init_pointers(pointers);                        // Point at the elements the counters select
+        if (!invariants.empty()) {
+            // The preheader runs only if the body does, the condition is tested before it and after the body
+            assembly << children[0]->build();                       // In R4 will be 1 if True or 0 if False
+            assembly << "LOAD " << 4 << std::endl;
+            assembly << "JZERO " << "*END_WHILE_" << id << std::endl;   // If False skip the loop and the preheader
+            for (auto invariant : invariants) {
+                assembly << invariant->hoist();                     // Preheader
+            }
+            assembly << "*BODY_WHILE_" << id << " ";                // Label COMMAND block of the while
+            assembly << children[1]->build();                       // Insert COMMAND block
+            assembly << children[0]->build();                       // In R4 will be 1 if True or 0 if False
+            assembly << "LOAD " << 4 << std::endl;
+            assembly << mark("#BRANCH", "T");
+            assembly << "JPOS " << "*BODY_WHILE_" << id << std::endl;   // If True jump to the COMMAND block
+            assembly << "*END_WHILE_" << id << " ";                 // Label END of the while
+
+            return assembly.str();
+        }
+        if (rotated) {
+            // One jump per iteration instead of two, entering costs one more
+            assembly << "JUMP " << "*COND_WHILE_" << id << std::endl;   // Jump to the CONDITION of the while
+            assembly << "*BODY_WHILE_" << id << " ";                    // Label COMMAND block of the while
+            assembly << children[1]->build();                           // Insert COMMAND block
+            assembly << "*COND_WHILE_" << id << " ";                    // Label CONDITION of the while
+            assembly << children[0]->build();                           // In R4 will be 1 if True or 0 if False
+            assembly << "LOAD " << 4 << std::endl;
+            assembly << mark("#BRANCH", "T");
+            assembly << "JPOS " << "*BODY_WHILE_" << id << std::endl;   // If True jump to the COMMAND block
+
+            return assembly.str();
+        }
         assembly << "*COND_WHILE_" << id << " ";                    // Label CONDITION of the while
         assembly << children[0]->build();                           // In R4 will be 1 if True or 0 if False
         assembly << "LOAD " << 4 << std::endl;
+        assembly << mark("#BRANCH", "F");
         assembly << "JZERO " << "*END_WHILE_" << id << std::endl;   // If False jump to END label
         assembly << children[1]->build();                           // Insert COMMAND block
         assembly << "JUMP " << "*COND_WHILE_" << id << std::endl;   // Jump to the CONDITION of the while
@@ -415,34 +764,160 @@ public:
 
 class RepeatCommandNode : public Node {
 public:
-    explicit RepeatCommandNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "REPEAT_COMMAND"; }
+    std::vector<InductionPointer> pointers;     // Element addresses kept by StrengthReduction
+    std::vector<Node*> invariants;              // Computed once before the loop, chosen by LoopInvariantMotion
+
+    explicit RepeatCommandNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::REPEAT_COMMAND, token, id) {}
+    bool isLoop() const override { return true; }
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - command, 1 - condition
 
+        assembly << mark("#BLOCK");
+        assembly << init_pointers(pointers);                        // Point at the elements the counters select
+        for (auto invariant : invariants) {
+            assembly << invariant->hoist();                         // Preheader
+        }
         assembly << "*REPEAT_START_" << id << " ";                  // Label START of the if
         assembly << children[0]->build();                           // Insert COMMAND block
         assembly << children[1]->build();                           // Insert CONDITION of the repeat
         assembly << "LOAD " << 4 << std::endl;
+        assembly << mark("#BRANCH", "F");
         assembly << "JZERO " << "*REPEAT_START_" << id << std::endl; // If True jump to START label
 
         return assembly.str();
     }
 };
 
-class ForToCommandNode : public Node {
+// Unrolling shared by both FOR loops, step is 1 for FOR TO and -1 for FOR DOWNTO.
+class ForCommandNode : public Node {
+public:
+    std::vector<InductionPointer> pointers;     // Element addresses kept by StrengthReduction, stepped with the iterator
+    bool cold = false;                          // Never entered in the profile, not worth unrolling
+
+    ForCommandNode(NodeKind kind, Token* token, long long id) : Node(kind, token, id) {}
+    bool isLoop() const override { return true; }
+
+protected:
+    // Builds the body with the iterator fixed to value and labels made unique to the copy
+    std::string buildCopy(long long value, long long copy) const {
+        boundIterators[token] = value;
+        std::string body = children[2]->build();
+        boundIterators.erase(token);
+
+        return relabel(body, "_U" + std::to_string(id) + "_" + std::to_string(copy));
+    }
+
+    // Leaves the iterator with the value the rolled loop exits with, a variable of the same name outside the loop shares its cell
+    std::string leave(long long value) const {
+        std::ostringstream assembly;
+        assembly << "LOAD " << constant_token(value)->getAddress() << std::endl;
+        assembly << "STORE " << token->getAddress() << std::endl;
+        return assembly.str();
+    }
+
+    // Unrolls a loop with constant bounds into code, returns false if the generic loop has to be built.
+    // Short loops are unrolled fully. Longer ones run factor copies of the body per iteration,
+    // the trips left over are appended as straight copies.
+    bool unroll(long long first, long long last, long long step, std::string& code) const {
+        long long budget = unrolling ? OPTIONS.unrollBudget : 0;
+
+        if (budget <= 0 || cold || boundIterators.count(token) || children[2]->writes(token)) {
+            return false;
+        }
+
+        if ((step > 0 && first > last) || (step < 0 && first < last)) {
+            code = leave(first);    // The body never runs
+            return true;
+        }
+
+        unsigned long long distance = step > 0 ? (unsigned long long)last - (unsigned long long)first
+                                               : (unsigned long long)first - (unsigned long long)last;
+        if (distance >= (unsigned long long)budget * 64) {
+            return false;   // Far too long for any factor
+        }
+        long long trips = distance + 1;
+
+        std::ostringstream assembly;
+        std::string copy = buildCopy(first, 0);
+        long long size = std::max(count_instructions(copy), 1LL);
+
+        if (trips - 1 <= budget / size) {
+            assembly << copy;
+            for (long long i = 1; i < trips; i++) {
+                assembly << buildCopy(first + i * step, i);
+            }
+            assembly << leave(last + step);
+            code = assembly.str();
+            return true;
+        }
+
+        long long factor = std::min(OPTIONS.unrollFactor, trips);
+        while (factor > 1 && factor - 1 + trips % factor > budget / size) {
+            factor--;
+        }
+        if (factor < 2) {
+            return false;
+        }
+
+        bool counted = children[2]->uses(token);    // Copies read the iterator, keep it exact between them
+        long long limit = first + trips / factor * factor * step;
+        std::string advance = step > 0 ? "ADD " : "SUB ";
+
+        assembly << "LOAD " << constant_token(first)->getAddress() << std::endl;   // Load first value
+        assembly << "STORE " << token->getAddress() << std::endl;                  // Set iterator to first value
+        assembly << init_pointers(pointers);                                       // Point at the first elements
+        assembly << "*FOR_BODY_" << id << " ";                                     // Label BODY of for
+        for (long long i = 0; i < factor; i++) {
+            assembly << relabel(children[2]->build(), "_U" + std::to_string(id) + "_" + std::to_string(i));
+            if (counted) {
+                assembly << "LOAD " << token->getAddress() << std::endl;           // Load iterator
+                assembly << advance << 6 << std::endl;                             // Step iterator by 1
+                assembly << "STORE " << token->getAddress() << std::endl;          // Store stepped iterator
+                assembly << step_pointers(pointers, step);                         // Step the pointers along
+            }
+        }
+        if (counted && !pointers.empty()) {
+            assembly << "LOAD " << token->getAddress() << std::endl;               // Stepping the pointers left the last one loaded
+        }
+        if (!counted) {
+            assembly << "LOAD " << token->getAddress() << std::endl;               // Load iterator
+            assembly << advance << constant_token(factor)->getAddress() << std::endl;  // Step iterator by factor
+            assembly << "STORE " << token->getAddress() << std::endl;              // Store stepped iterator
+        }
+        assembly << "SUB " << constant_token(limit)->getAddress() << std::endl;    // Compare with the first leftover value
+        assembly << (step > 0 ? "JNEG " : "JPOS ") << "*FOR_BODY_" << id << std::endl;    // Repeat until it is reached
+        for (long long i = 0; i < trips % factor; i++) {
+            assembly << buildCopy(limit + i * step, factor + i);                   // Leftover trips
+        }
+        if (trips % factor) {
+            assembly << leave(last + step);                                        // The loop left the iterator at limit
+        }
+
+        code = assembly.str();
+        return true;
+    }
+};
+
+class ForToCommandNode : public ForCommandNode {
 public:
-    explicit ForToCommandNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "FORTO_COMMAND"; }
+    explicit ForToCommandNode(Token* token = nullptr, long long id = -1) : ForCommandNode(NodeKind::FORTO_COMMAND, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - lower_bound, 1 - upper_bound, 2 - commands
         // token - identifier
 
+        long long lower, upper;
+        std::string unrolled;
+        if (children[0]->getConstant(lower) && children[1]->getConstant(upper) && unroll(lower, upper, 1, unrolled)) {
+            return mark("#BLOCK") + unrolled;
+        }
+
+        assembly << mark("#BLOCK");                                             // Counts the entries
         assembly << children[0]->build();                                       // Store lower_bound in R4
         assembly << "LOAD " << 4 << std::endl;                                  // Load lower_bound
         assembly << "STORE " << token->getAddress() << std::endl;               // Set iterator to lower_bound
+        assembly << init_pointers(pointers);                                    // Point at the first elements
         assembly << "*FOR_BODY_" << id  << " ";                                 // Label BODY of for
         assembly << children[1]->build();                                       // Store upper_bound in R4
         assembly << "LOAD " << token->  getAddress() << std::endl;              // Load iterator
@@ -452,6 +927,7 @@ public:
         assembly << "LOAD " << token->getAddress() << std::endl;                // Load iterator
         assembly << "ADD " << 6 << std::endl;                                   // ADD 1 to iterator
         assembly << "STORE " << token->getAddress() << std::endl;               // Store increased iterator
+        assembly << step_pointers(pointers, 1);                                 // Step the pointers along
         assembly << "JUMP " << "*FOR_BODY_" << id << std::endl;                 // Jump to FOR_BODY block
         assembly << "*FOR_END_" << id << " ";                                   // Label END of for
 
@@ -459,18 +935,25 @@ public:
     }
 };
 
-class ForDownToCommandNode : public Node {
+class ForDownToCommandNode : public ForCommandNode {
 public:
-    explicit ForDownToCommandNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "FORDOWNTO_COMMAND"; }
+    explicit ForDownToCommandNode(Token* token = nullptr, long long id = -1) : ForCommandNode(NodeKind::FORDOWNTO_COMMAND, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - upper_bound, 1 - lower_bound, 2 - commands
         // token - identifier
 
+        long long upper, lower;
+        std::string unrolled;
+        if (children[0]->getConstant(upper) && children[1]->getConstant(lower) && unroll(upper, lower, -1, unrolled)) {
+            return mark("#BLOCK") + unrolled;
+        }
+
+        assembly << mark("#BLOCK");                                             // Counts the entries
         assembly << children[0]->build();                                       // Store upper_bound in R4
         assembly << "LOAD " << 4 << std::endl;                                  // Load upper_bound
         assembly << "STORE " << token->getAddress() << std::endl;               // Set iterator to upper_bound
+        assembly << init_pointers(pointers);                                    // Point at the first elements
         assembly << "*FOR_BODY_" << id  << " ";                                 // Label BODY of for
         assembly << children[1]->build();                                       // Store lower_bound in R4
         assembly << "LOAD " << token->  getAddress() << std::endl;              // Load iterator
@@ -480,6 +963,7 @@ public:
         assembly << "LOAD " << token->getAddress() << std::endl;                // Load iterator
         assembly << "SUB " << 6 << std::endl;                                   // SUB 1 from iterator
         assembly << "STORE " << token->getAddress() << std::endl;               // Store increased iterator
+        assembly << step_pointers(pointers, -1);                                // Step the pointers along
         assembly << "JUMP " << "*FOR_BODY_" << id << std::endl;                 // Jump to FOR_BODY block
         assembly << "*FOR_END_" << id << " ";                                   // Label END of for
 
@@ -489,13 +973,39 @@ public:
 
 class ReadCommandNode : public Node {
 public:
-    explicit ReadCommandNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "READ_COMMAND"; }
+    explicit ReadCommandNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::READ_COMMAND, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - identifier
+        long long index;
+        const Token* target = children[0]->token;
+        bool reference = target->getFunction() == TokenFunction::ARG || target->getFunction() == TokenFunction::T_ARG;
 
-        assembly << "GET " << children[0]->token->getAddress() << std::endl;
+        if (children[0]->kind == NodeKind::IDENTIFIER && !reference) {
+            assembly << "GET " << target->getAddress() << std::endl;                   // Read straight into the variable
+            return assembly.str();
+        }
+        if (children[0]->kind == NodeKind::IDENTIFIER) {
+            assembly << "GET " << 0 << std::endl;                                     // Read into the accumulator
+            assembly << "STOREI " << target->getAddress() << std::endl;                // Store it at the address the argument holds
+            return assembly.str();
+        }
+        if (!reference && children[0]->children[0]->getConstant(index)) {
+            assembly << "GET " << target->getAddress() + index << std::endl;           // Read straight into the cell
+            return assembly.str();
+        }
+
+        if (children[0]->children[0]->getConstant(index)) {
+            assembly << "LOAD " << target->getAddress() << std::endl;                 // Get address of index0
+            assembly << "ADD " << constant_token(index)->getAddress() << std::endl;   // Add the constant index
+        } else {
+            assembly << children[0]->children[0]->build();                            // Store index in R4
+            assembly << (reference ? "LOAD " : "SET ") << target->getAddress() << std::endl;  // Get address of index0
+            assembly << "ADD " << 4 << std::endl;                                     // Calculate absolute address
+        }
+        assembly << "STORE " << 3 << std::endl;                                       // Store address in R3
+        assembly << "GET " << 0 << std::endl;                                         // Read into the accumulator
+        assembly << "STOREI " << 3 << std::endl;                                      // Store it in the element
 
         return assembly.str();
     }
@@ -503,8 +1013,7 @@ public:
 
 class WriteCommandNode : public Node {
 public:
-    explicit WriteCommandNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "WRITE_COMMAND"; }
+    explicit WriteCommandNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::WRITE_COMMAND, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
         // 0 - value
@@ -518,24 +1027,47 @@ public:
 
 class DeclarationsNode : public Node {
 public:
-    explicit DeclarationsNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "DECLARATIONS"; }
+    explicit DeclarationsNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::DECLARATIONS, token, id) {}
+    std::string build(std::vector<Token*> *tokens = nullptr) const override {
+        // tokens - declared variables and tables in order, their cells are assigned while parsing
+        return "";
+    }
+};
+
+class ExpressionNode : public Node {
+public:
+    Interval ranges[2];     // Values operands a and b can take, filled in by RangeAnalysis
+    long long quotient = -1;    // Cells of the quotient and the remainder shared by fused / and %, filled in by DivModFusion
+    long long remainder = -1;
+    bool computed = false;      // An earlier / or % on the same operands already stored the result
+    long long hoisted = -1;     // Cell computed before the enclosing loop, filled in by LoopInvariantMotion
+
+    explicit ExpressionNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::EXPRESSION, token, id) {}
+    bool getConstant(long long& value) const override { return token == nullptr && children[0]->getConstant(value); }
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
 
-        for (auto node : children) {
-            assembly << node->build();
+        if (hoisted >= 0) {
+            assembly << "LOAD " << hoisted << std::endl;    // Value computed before the loop
+            assembly << "STORE " << 4 << std::endl;         // Store result in R4
+            return assembly.str();
         }
 
+        return compute();
+    }
+
+    std::string hoist() const override {
+        std::ostringstream assembly;
+
+        assembly << compute();
+        assembly << "LOAD " << 4 << std::endl;
+        assembly << "STORE " << hoisted << std::endl;       // Keep the value for the loop
+
         return assembly.str();
     }
-};
 
-class ExpressionNode : public Node {
-public:
-    explicit ExpressionNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "EXPRESSION"; }
-    std::string build(std::vector<Token*> *tokens = nullptr) const override {
+    // Code computing the expression into R4, also used for the loop preheader of a hoisted one
+    std::string compute() const {
         std::ostringstream assembly;
         // 0 - a, 1 - b
         // token - operator
@@ -545,10 +1077,11 @@ public:
             return assembly.str();                      // Return early cause there is no token.
         }
 
-        std::string operation = token->getValue();
-
         // a *operator* b
-        if (operation == "+") {
+        if (computed) {
+            assembly << "LOAD " << (op == Operator::DIVIDE ? quotient : remainder) << std::endl;  // Reuse the fused result
+            assembly << "STORE " << 4 << std::endl;     // Store result in R4
+        } else if (op == Operator::PLUS) {
             assembly << children[1]->build();           // Get b into R4
             assembly << "LOAD " << 4 << std::endl;
             assembly << "STORE " << 1 << std::endl;     // Store b in R1
@@ -556,7 +1089,7 @@ public:
             assembly << "LOAD " << 4 << std::endl;
             assembly << "ADD " << 1 << std::endl;
             assembly << "STORE " << 4 << std::endl;     // Store result in R4
-        } else if (operation == "-") {
+        } else if (op == Operator::MINUS) {
             assembly << children[1]->build();           // Get b into R4
             assembly << "LOAD " << 4 << std::endl;
             assembly << "STORE " << 1 << std::endl;     // Store b in R1
@@ -564,43 +1097,48 @@ public:
             assembly << "LOAD " << 4 << std::endl;
             assembly << "SUB " << 1 << std::endl;
             assembly << "STORE " << 4 << std::endl;     // Store result in R4
-        } else if (operation == "*") {
-            assembly << "LOAD " << 5 << std::endl;      // Load 0
-            assembly << "STORE " << 7 << std::endl;     // Set sign to positive
+        } else if (op == Operator::TIMES) {
+            bool sign = !ranges[0].nonNegative() || !ranges[1].nonNegative();     // Result sign has to be fixed
+            Interval a = ranges[0].magnitude();
+            Interval b = ranges[1].magnitude();
+            bool swap = a.hi <= b.lo;                   // |a| is never larger, let it be halved instead of b
+            bool ordered = swap || b.hi <= a.lo;        // Otherwise the smaller operand is picked at runtime
+            long long ra = swap ? 2 : 1;
+            long long rb = swap ? 1 : 2;
+
+            if (sign) {
+                assembly << "LOAD " << 5 << std::endl;  // Load 0
+                assembly << "STORE " << 7 << std::endl; // Set sign to positive
+            }
             assembly << children[1]->build();           // Get b into R4
             assembly << "LOAD " << 4 << std::endl;
-            assembly << "STORE " << 2 << std::endl;     // Store b in R2
-            assembly << "JNEG " << 2 << std::endl;      // If b < 0 jump 2 lines forward
-            assembly << "JUMP " << 6 << std::endl;      // Jump 6 lines to a check
-            assembly << "SUB " << 2 << std::endl;       //! -b
-            assembly << "SUB " << 2 << std::endl;       // Make number positive
-            assembly << "STORE " << 2 << std::endl;     // Store positive b
-            assembly << "LOAD " << 6 << std::endl;      // Load 1
-            assembly << "STORE " << 7 << std::endl;     // Set sign to negative
+            assembly << "STORE " << rb << std::endl;    // Store b in R2
+            if (!ranges[1].nonNegative()) {
+                const InstructionTemplate& negate = instruction_template(TemplateId::MUL_NEGATE_B);
+                assembly << "JNEG " << 2 << std::endl;  // If b < 0 jump 2 lines forward
+                assembly << "JUMP " << negate.size + 1 << std::endl;            // Jump over the negation
+                assembly << emit_template(TemplateId::MUL_NEGATE_B, rb);        // Make b positive, sign negative
+            }
             assembly << children[0]->build();           // Get a into R4
             assembly << "LOAD " << 4 << std::endl;
-            assembly << "STORE " << 1 << std::endl;     // Store a in R1
-            assembly << "JNEG " << 2 << std::endl;      // If a < 0 jump 2 lines forward
-            assembly << "JUMP " << 11 << std::endl;     // Jump _ lines to a check
-            assembly << "SUB " << 1 << std::endl;       //! -a
-            assembly << "SUB " << 1 << std::endl;       // Make number positive
-            assembly << "STORE " << 1 << std::endl;     // Store positive a
-            assembly << "LOAD " << 7 << std::endl;      // Load sign
-            assembly << "JPOS " << 4 << std::endl;      // If sign = 1 jump 4 lines forward
-            assembly << "ADD " << 6 << std::endl;       // Set sign to negative
-            assembly << "STORE " << 7 << std::endl;     // Store negative sign
-            assembly << "JUMP " << 3 << std::endl;      // Jump 3 lines to the end of the sign check
-            assembly << "HALF" << std::endl;            // Set sign to positive
-            assembly << "STORE " << 7 << std::endl;     // Store positive sign
-            assembly << "LOAD " << 1 << std::endl;      // Load a
-            assembly << "SUB " << 2 << std::endl;       // Subtract b from a
-            assembly << "JPOS " << 7 << std::endl;      // If a > b skip swapping a and b
-            assembly << "LOAD " << 1 << std::endl;      // Load a
-            assembly << "STORE " << 4 << std::endl;     // Store a in b
-            assembly << "LOAD " << 2 << std::endl;      // Load b
-            assembly << "STORE " << 1 << std::endl;     // Store b in a
-            assembly << "LOAD " << 4 << std::endl;      // Load a
-            assembly << "STORE " << 2 << std::endl;     // Store b in a
+            assembly << "STORE " << ra << std::endl;    // Store a in R1
+            if (!ranges[0].nonNegative()) {
+                const InstructionTemplate& negate = instruction_template(TemplateId::MUL_NEGATE_A);
+                assembly << "JNEG " << 2 << std::endl;  // If a < 0 jump 2 lines forward
+                assembly << "JUMP " << negate.size + 1 << std::endl;            // Jump over the negation
+                assembly << emit_template(TemplateId::MUL_NEGATE_A, ra);        // Make a positive, flip the sign
+            }
+            if (!ordered) {
+                assembly << "LOAD " << 1 << std::endl;  // Load a
+                assembly << "SUB " << 2 << std::endl;   // Subtract b from a
+                assembly << "JPOS " << 7 << std::endl;  // If a > b skip swapping a and b
+                assembly << "LOAD " << 1 << std::endl;  // Load a
+                assembly << "STORE " << 4 << std::endl; // Store a in b
+                assembly << "LOAD " << 2 << std::endl;  // Load b
+                assembly << "STORE " << 1 << std::endl; // Store b in a
+                assembly << "LOAD " << 4 << std::endl;  // Load a
+                assembly << "STORE " << 2 << std::endl; // Store b in a
+            }
             assembly << "LOAD " << 5 << std::endl;      // Load 0
             assembly << "STORE " << 4 << std::endl;     // Zero result
             assembly << "LOAD " << 2 << std::endl;      //! a >= b
@@ -619,15 +1157,10 @@ public:
             assembly << "ADD " << 1 << std::endl;       // Double a
             assembly << "STORE " << 1 << std::endl;     // Store doubled a
             assembly << "JUMP " << -15 << std::endl;    // Jump to the beginning
-            assembly << "LOAD " << 7 << std::endl;      // Load sign
-            assembly << "JZERO " << 5 << std::endl;     // If sign = 0 jump 4 lines to the end
-            assembly << "LOAD " << 4 << std::endl;      // Load result
-            assembly << "SUB " << 4 << std::endl;
-            assembly << "SUB " << 4 << std::endl;       // Negate result
-            assembly << "JUMP " << 2 << std::endl;      // Jump 2 lines to avoid unnecessary load
-            assembly << "LOAD " << 4 << std::endl;      // Load result
-            assembly << "STORE " << 4 << std::endl;     // Store result in R4
-        } else if (operation == "/") {
+            if (sign) {
+                assembly << emit_template(TemplateId::MUL_SIGN);                // Negate the result if the sign is 1
+            }
+        } else if (op == Operator::DIVIDE || quotient >= 0) {
             /*
             1 - a
             2 - b
@@ -636,37 +1169,53 @@ public:
             7 - sign
             8 - temp_counter
             */
-            assembly << "LOAD " << 5 << std::endl;
-            assembly << "STORE " << 7 << std::endl;     // Zero sign
+            bool signA = !ranges[0].nonNegative();
+            bool signB = !ranges[1].nonNegative();
+            bool zero = ranges[1].contains(0);          // Divisor may be 0
+            Interval a = ranges[0].magnitude();
+            Interval b = ranges[1].magnitude();
+
+            if (!signA && !signB && a.hi < b.lo && quotient < 0 && remainder < 0) {
+                assembly << "LOAD " << 5 << std::endl;  // a < b, the quotient is 0
+                assembly << "STORE " << 4 << std::endl;
+                return locate(assembly.str());
+            }
+
+            if (signA || signB) {
+                assembly << "LOAD " << 5 << std::endl;
+                assembly << "STORE " << 7 << std::endl; // Zero sign
+            }
             assembly << children[1]->build();           // Get b into R4
             assembly << "LOAD " << 4 << std::endl;
-            assembly << "JZERO " << "*DIV_BY_ZERO_" << id << std::endl;      // If b = 0 return 0
+            if (zero) {
+                assembly << "JZERO " << "*DIV_BY_ZERO_" << id << std::endl;  // If b = 0 return 0
+            }
             assembly << "STORE " << 2 << std::endl;     // Store b in R1
-            assembly << "JNEG " << 2 << std::endl;      // If b < 0 jump 2 lines forward
-            assembly << "JUMP " << 7 << std::endl;      // Jump 7 lines to a check
-            assembly << "SUB " << 2 << std::endl;       //! -b
-            assembly << "SUB " << 2 << std::endl;       // Make number positive
-            assembly << "STORE " << 2 << std::endl;     // Store positive b
-            assembly << "LOAD " << 6 << std::endl;      // Load 1
-            assembly << "ADD " << 6 << std::endl;       // Make it 2
-            assembly << "STORE " << 7 << std::endl;     // Set sign to negative (R7)
+            if (signB) {
+                const InstructionTemplate& negate = instruction_template(TemplateId::DIV_NEGATE_B);
+                assembly << "JNEG " << 2 << std::endl;  // If b < 0 jump 2 lines forward
+                assembly << "JUMP " << negate.size + 1 << std::endl;            // Jump over the negation
+                assembly << emit_template(TemplateId::DIV_NEGATE_B, 2);         // Make b positive, sign 2
+            }
             assembly << children[0]->build();           // Get a into R4
             assembly << "LOAD " << 4 << std::endl;
-            assembly << "JZERO " << "*DIV_BY_ZERO_" << id << std::endl;      // If b = 0 return 0
             assembly << "STORE " << 1 << std::endl;     // Store a in R1
-            assembly << "JNEG " << 2 << std::endl;      // If a < 0 jump 2 lines forward
-            assembly << "JUMP " << 7 << std::endl;      // Jump 7 lines to a check
-            assembly << "SUB " << 1 << std::endl;       //! -a
-            assembly << "SUB " << 1 << std::endl;       // Make number positive
-            assembly << "STORE " << 1 << std::endl;     // Store positive a
-            assembly << "LOAD " << 7 << std::endl;      // Load sign
-            assembly << "ADD " << 6 << std::endl;       // Add 1
-            assembly << "STORE " << 7 << std::endl;     // Store sign
+            if (signA) {
+                const InstructionTemplate& negate = instruction_template(TemplateId::DIV_NEGATE_A);
+                assembly << "JNEG " << 2 << std::endl;  // If a < 0 jump 2 lines forward
+                assembly << "JUMP " << negate.size + 1 << std::endl;            // Jump over the negation
+                assembly << emit_template(TemplateId::DIV_NEGATE_A, 1);         // Make a positive, add 1 to the sign
+            }
 
             assembly << "LOAD " << 6 << std::endl;      // Load 1
             assembly << "STORE " << 8 << std::endl;     // Set temp_counter to 1
             assembly << "HALF" << std::endl;            // Set 0
             assembly << "STORE " << 4 << std::endl;     // Set counter to 0
+            if (a.lo < b.hi) {
+                assembly << "LOAD " << 1 << std::endl;  // Load a
+                assembly << "SUB " << 2 << std::endl;   // Subtract b from a
+                assembly << "JNEG " << "*DIV_SIGN_" << id << std::endl;     // If a < b the quotient is 0 and a the remainder
+            }
 
             assembly << "*DIV_START_LOOP_" << id << " ";// Label START of the division
             assembly << "LOAD " << 2 << std::endl;      // Load b
@@ -700,237 +1249,204 @@ public:
             assembly << "STORE " << 8 << std::endl;     // Reset temp_counter
             assembly << "JUMP " << "*DIV_START_LOOP_" << id << std::endl;   // Jump to the start of the loop
 
-            assembly << "*DIV_SIGN_" << id << " ";      // Label END of the division
-            assembly << "LOAD " << 7 << std::endl;      // Load sign
-            assembly << "JZERO " << "*DIV_pp_" << id << std::endl; // Jump to a, b > 0
-            assembly << "SUB " << 6 << std::endl;       // Substract 1
-            assembly << "JZERO " << "*DIV_np_" << id << std::endl; // Jump to a > 0, b < 0
-            assembly << "SUB " << 6 << std::endl;       // Substract 1
-            assembly << "JZERO " << "*DIV_pn_" << id << std::endl; // Jump to a < 0, b > 0
-
-            assembly << "*DIV_pp_" << id << " ";        // Case a, b > 0 and a, b < 0
-            assembly << "LOAD " << 4 << std::endl;      // Load result
-            assembly << "JUMP " << "*DIV_RETURN_" << id << std::endl;       // Jump to the return
-            assembly << "*DIV_pn_" << id << " ";
-            assembly << "LOAD " << 4 << std::endl;      // Load result
-            assembly << "ADD " << 6 << std::endl;       // Add 1
-            assembly << "STORE " << 8 << std::endl;     // Temporarly store value
-            assembly << "SUB " << 8 << std::endl;
-            assembly << "SUB " << 8 << std::endl;       // Make it negative
-            assembly << "JUMP " << "*DIV_RETURN_" << id << std::endl;       // Jump to the return
-            assembly << "*DIV_np_" << id << " ";
-            assembly << "LOAD " << 4 << std::endl;      // Load result
-            assembly << "ADD " << 6 << std::endl;       // Add 1
-            assembly << "STORE " << 8 << std::endl;     // Temporarly store value
-            assembly << "SUB " << 8 << std::endl;
-            assembly << "SUB " << 8 << std::endl;       // Make it negative
-            assembly << "JUMP " << "*DIV_RETURN_" << id << std::endl;       // Jump to the return
-
+            assembly << "*DIV_SIGN_" << id << " ";      // Label END of the division, R1 holds the remainder
+            if (remainder >= 0 && (signA || signB)) {
+                assembly << "LOAD " << 1 << std::endl;  // Load remainder
+                assembly << "JZERO " << "*DIV_REM_pp_" << id << std::endl;  // Exact division leaves 0
+                assembly << "LOAD " << 7 << std::endl;  // Load sign
+                assembly << "JZERO " << "*DIV_REM_pp_" << id << std::endl;  // Jump to a, b > 0
+                assembly << "SUB " << 6 << std::endl;   // Substract 1
+                assembly << "JZERO " << "*DIV_REM_np_" << id << std::endl;  // Jump to a < 0, b > 0
+                assembly << "SUB " << 6 << std::endl;   // Substract 1
+                assembly << "JZERO " << "*DIV_REM_pn_" << id << std::endl;  // Jump to a > 0, b < 0
+                assembly << "LOAD " << 5 << std::endl;  // Case a, b < 0
+                assembly << "SUB " << 1 << std::endl;   // Negate remainder
+                assembly << "JUMP " << "*DIV_REM_" << id << std::endl;
+                assembly << "*DIV_REM_np_" << id << " ";
+                assembly << "LOAD " << 2 << std::endl;  // Load b
+                assembly << "SUB " << 1 << std::endl;   // Sub remainder
+                assembly << "JUMP " << "*DIV_REM_" << id << std::endl;
+                assembly << "*DIV_REM_pn_" << id << " ";
+                assembly << "LOAD " << 1 << std::endl;  // Load remainder
+                assembly << "SUB " << 2 << std::endl;   // Sub b
+                assembly << "JUMP " << "*DIV_REM_" << id << std::endl;
+                assembly << "*DIV_REM_pp_" << id << " ";
+                assembly << "LOAD " << 1 << std::endl;  // Load remainder
+                assembly << "*DIV_REM_" << id << " ";
+                assembly << "STORE " << remainder << std::endl;             // Store signed remainder
+            } else if (remainder >= 0) {
+                assembly << "LOAD " << 1 << std::endl;  // Load remainder
+                assembly << "STORE " << remainder << std::endl;             // Store remainder
+            }
+            if (signA || signB) {
+                assembly << "LOAD " << 7 << std::endl;  // Load sign
+                assembly << "SUB " << 6 << std::endl;   // Substract 1
+                assembly << "JZERO " << "*DIV_MIXED_" << id << std::endl;   // Jump to a < 0, b > 0
+                assembly << "SUB " << 6 << std::endl;   // Substract 1
+                assembly << "JZERO " << "*DIV_MIXED_" << id << std::endl;   // Jump to a > 0, b < 0
+                assembly << "JUMP " << "*DIV_RETURN_" << id << std::endl;   // Same signs, R4 holds the result
+                assembly << "*DIV_MIXED_" << id << " ";
+                assembly << emit_template(TemplateId::DIV_MIXED);               // Negative, rounded down unless exact
+            }
+            if (zero) {
+                assembly << "JUMP " << "*DIV_RETURN_" << id << std::endl;   // Jump over the division by 0
+                assembly << "*DIV_BY_ZERO_" << id << " ";                   // Label END of the division
+                assembly << "LOAD " << 5 << std::endl;  // Load 0
+                assembly << "STORE " << 4 << std::endl; // Store result in R4
+                if (remainder >= 0) {
+                    assembly << "STORE " << remainder << std::endl;         // Remainder is 0 as well
+                }
+            }
             assembly << "*DIV_RETURN_" << id << " ";
-            assembly << "JUMP " << 2 << std::endl;      // Jump over the division by 0
-            assembly << "*DIV_BY_ZERO_" << id << " ";   // Label END of the division
-            assembly << "LOAD " << 5 << std::endl;      // Load 0
-            assembly << "STORE " << 4 << std::endl;     // Store result in R4
-        } else if (operation == "%") {
+            if (quotient >= 0) {
+                assembly << "LOAD " << 4 << std::endl;  // Load quotient
+                assembly << "STORE " << quotient << std::endl;              // Keep it for the fused expressions
+            }
+            if (op == Operator::MODULO) {
+                assembly << "LOAD " << remainder << std::endl;              // Modulo returns the remainder
+                assembly << "STORE " << 4 << std::endl; // Store result in R4
+            }
+        } else if (op == Operator::MODULO) {
             /*
             1 - a
             2 - b
             3 - b_temp
-            4 - counter
             7 - sign
-            8 - temp_counter
             */
-            assembly << "LOAD " << 5 << std::endl;
-            assembly << "STORE " << 7 << std::endl;     // Zero sign
+            bool signA = !ranges[0].nonNegative();
+            bool signB = !ranges[1].nonNegative();
+            bool zero = ranges[1].contains(0);          // Divisor may be 0
+            Interval a = ranges[0].magnitude();
+            Interval b = ranges[1].magnitude();
+
+            if (!signA && !signB && a.hi < b.lo && remainder < 0) {
+                assembly << children[0]->build();       // a < b, the remainder is a
+                return locate(assembly.str());
+            }
+
+            if (signA || signB) {
+                assembly << "LOAD " << 5 << std::endl;
+                assembly << "STORE " << 7 << std::endl; // Zero sign
+            }
             assembly << children[1]->build();           // Get b into R4
             assembly << "LOAD " << 4 << std::endl;
-            assembly << "JZERO " << "*MOD_BY_ZERO_" << id << std::endl;      // If b = 0 return 0
+            if (zero) {
+                assembly << "JZERO " << "*MOD_BY_ZERO_" << id << std::endl;  // If b = 0 return 0
+            }
             assembly << "STORE " << 2 << std::endl;     // Store b in R1
-            assembly << "JNEG " << 2 << std::endl;      // If b < 0 jump 2 lines forward
-            assembly << "JUMP " << 7 << std::endl;      // Jump 7 lines to a check
-            assembly << "SUB " << 2 << std::endl;       //! -b
-            assembly << "SUB " << 2 << std::endl;       // Make number positive
-            assembly << "STORE " << 2 << std::endl;     // Store positive b
-            assembly << "LOAD " << 6 << std::endl;      // Load 1
-            assembly << "ADD " << 6 << std::endl;       // Make it 2
-            assembly << "STORE " << 7 << std::endl;     // Set sign to negative (R7)
+            if (signB) {
+                const InstructionTemplate& negate = instruction_template(TemplateId::DIV_NEGATE_B);
+                assembly << "JNEG " << 2 << std::endl;  // If b < 0 jump 2 lines forward
+                assembly << "JUMP " << negate.size + 1 << std::endl;            // Jump over the negation
+                assembly << emit_template(TemplateId::DIV_NEGATE_B, 2);         // Make b positive, sign 2
+            }
             assembly << children[0]->build();           // Get a into R4
             assembly << "LOAD " << 4 << std::endl;
-            assembly << "JZERO " << "*MOD_BY_ZERO_" << id << std::endl;      // If b = 0 return 0
             assembly << "STORE " << 1 << std::endl;     // Store a in R1
-            assembly << "JNEG " << 2 << std::endl;      // If a < 0 jump 2 lines forward
-            assembly << "JUMP " << 7 << std::endl;      // Jump 7 lines to a check
-            assembly << "SUB " << 1 << std::endl;       //! -a
-            assembly << "SUB " << 1 << std::endl;       // Make number positive
-            assembly << "STORE " << 1 << std::endl;     // Store positive a
-            assembly << "LOAD " << 7 << std::endl;      // Load sign
-            assembly << "ADD " << 6 << std::endl;       // Add 1
-            assembly << "STORE " << 7 << std::endl;     // Store sign
-
-            assembly << "LOAD " << 6 << std::endl;      // Load 1
-            assembly << "STORE " << 8 << std::endl;     // Set temp_counter to 1
-            assembly << "HALF" << std::endl;            // Set 0
-            assembly << "STORE " << 4 << std::endl;     // Set counter to 0
+            if (signA) {
+                const InstructionTemplate& negate = instruction_template(TemplateId::DIV_NEGATE_A);
+                assembly << "JNEG " << 2 << std::endl;  // If a < 0 jump 2 lines forward
+                assembly << "JUMP " << negate.size + 1 << std::endl;            // Jump over the negation
+                assembly << emit_template(TemplateId::DIV_NEGATE_A, 1);         // Make a positive, add 1 to the sign
+            }
 
+            // The quotient is not needed, only the largest doubling of b not above a is subtracted every round
             assembly << "*MOD_START_LOOP_" << id << " ";// Label START of the division
-            assembly << "LOAD " << 2 << std::endl;      // Load b
-            assembly << "STORE " << 3 << std::endl;     // Store temp_b
-            assembly << "*MOD_LOOP_" << id << " ";      // Label START of the division loop
-            assembly << "LOAD " << 1 << std::endl;      // Load a
-            assembly << "SUB " << 3 << std::endl;       // Subtract temp_b from a
-            assembly << "JNEG " << "*MOD_END_LOOP_" << id << std::endl;      // If a < temp_b jump to the end
-            assembly << "LOAD " << 8 << std::endl;      // Load temp_counter
-            assembly << "ADD " << 8 << std::endl;       // Double temp_counter
-            assembly << "STORE " << 8 << std::endl;     // Store doubled temp_counter
-            assembly << "LOAD " << 3 << std::endl;      // Load temp_b
-            assembly << "ADD " << 3 << std::endl;       // Double temp_b
-            assembly << "STORE " << 3 << std::endl;     // Store doubled temp_b
-            assembly << "JUMP " << "*MOD_LOOP_" << id << std::endl;         // Jump to the end of the loop
-            assembly << "*MOD_END_LOOP_" << id << " ";  // Label END of the division
-            assembly << "LOAD " << 8 << std::endl;      // Load temp_counter
-            assembly << "HALF" << std::endl;            // Half temp_counter
-            assembly << "STORE " << 8 << std::endl;     // Store halfed temp_counter
-            assembly << "ADD " << 4 << std::endl;       // Add counter
-            assembly << "STORE " << 4 << std::endl;     // Store counter
-            assembly << "LOAD " << 3 << std::endl;      // Load temp_b
-            assembly << "HALF" << std::endl;            // Half temp_b
-            assembly << "STORE " << 3 << std::endl;     // Store halfed temp_b
             assembly << "LOAD " << 1 << std::endl;      // Load a
             assembly << "SUB " << 2 << std::endl;       // Subtract b from a
             assembly << "JNEG " << "*MOD_SIGN_" << id << std::endl;         // If a < b jump to the end
+            assembly << "LOAD " << 2 << std::endl;      // Load b
+            assembly << "*MOD_LOOP_" << id << " ";      // Label START of the division loop
+            assembly << "STORE " << 3 << std::endl;     // Store temp_b
+            assembly << "ADD " << 0 << std::endl;       // Double temp_b
+            assembly << "SUB " << 1 << std::endl;       // Subtract a from doubled temp_b
+            assembly << "JPOS " << "*MOD_END_LOOP_" << id << std::endl;      // If a < 2 * temp_b jump to the end
+            assembly << "ADD " << 1 << std::endl;       // Restore doubled temp_b
+            assembly << "JUMP " << "*MOD_LOOP_" << id << std::endl;         // Jump to the start of the loop
+            assembly << "*MOD_END_LOOP_" << id << " ";  // Label END of the division
             assembly << "LOAD " << 1 << std::endl;      // Load a
             assembly << "SUB " << 3 << std::endl;       // Subtract temp_b from a
             assembly << "STORE " << 1 << std::endl;     // Store a
-            assembly << "LOAD " << 6 << std::endl;      // Load 1
-            assembly << "STORE " << 8 << std::endl;     // Reset temp_counter
             assembly << "JUMP " << "*MOD_START_LOOP_" << id << std::endl;   // Jump to the start of the loop
 
-            assembly << "*MOD_SIGN_" << id << " ";      // Label END of the division
-            assembly << "LOAD " << 7 << std::endl;      // Load sign
-            assembly << "JZERO " << "*MOD_pp_" << id << std::endl; // Jump to a, b > 0
-            assembly << "SUB " << 6 << std::endl;       // Substract 1
-            assembly << "JZERO " << "*MOD_np_" << id << std::endl; // Jump to a > 0, b < 0
-            assembly << "SUB " << 6 << std::endl;       // Substract 1
-            assembly << "JZERO " << "*MOD_pn_" << id << std::endl; // Jump to a < 0, b > 0
-
-            assembly << "LOAD " << 5 << std::endl;      // Case a, b < 0
-            assembly << "SUB " << 1 << std::endl;       // Negate result
-            assembly << "JUMP " << "*MOD_RETURN_" << id << std::endl;       // Jump to the return
-            assembly << "*MOD_pp_" << id << " ";
-            assembly << "LOAD " << 1 << std::endl;      // Load result
-            assembly << "JUMP " << "*MOD_RETURN_" << id << std::endl;       // Jump to the return
-            assembly << "*MOD_pn_" << id << " ";
+            assembly << "*MOD_SIGN_" << id << " ";      // Label END of the division, R1 holds the remainder
+            if (signA || signB) {
+                assembly << "LOAD " << 7 << std::endl;  // Load sign
+                assembly << "JZERO " << "*MOD_pp_" << id << std::endl; // Jump to a, b > 0
+                assembly << "SUB " << 6 << std::endl;   // Substract 1
+                assembly << "JZERO " << "*MOD_np_" << id << std::endl; // Jump to a < 0, b > 0
+                assembly << "SUB " << 6 << std::endl;   // Substract 1
+                assembly << "JZERO " << "*MOD_pn_" << id << std::endl; // Jump to a > 0, b < 0
+
+                assembly << "LOAD " << 5 << std::endl;  // Case a, b < 0
+                assembly << "SUB " << 1 << std::endl;   // Negate result
+                assembly << "JUMP " << "*MOD_RETURN_" << id << std::endl;   // Jump to the return
+                assembly << "*MOD_np_" << id << " ";
+                assembly << "LOAD " << 1 << std::endl;  // Load result
+                assembly << "JZERO " << "*MOD_RETURN_" << id << std::endl;  // Exact division leaves 0
+                assembly << "LOAD " << 2 << std::endl;  // Load b
+                assembly << "SUB " << 1 << std::endl;   // Sub result
+                assembly << "JUMP " << "*MOD_RETURN_" << id << std::endl;   // Jump to the return
+                assembly << "*MOD_pn_" << id << " ";
+                assembly << "LOAD " << 1 << std::endl;  // Load result
+                assembly << "JZERO " << "*MOD_RETURN_" << id << std::endl;  // Exact division leaves 0
+                assembly << "SUB " << 2 << std::endl;   // Sub b
+                assembly << "JUMP " << "*MOD_RETURN_" << id << std::endl;   // Jump to the return
+                assembly << "*MOD_pp_" << id << " ";
+            }
             assembly << "LOAD " << 1 << std::endl;      // Load result
-            assembly << "SUB " << 2 << std::endl;       // Sub b
-            assembly << "JUMP " << "*MOD_RETURN_" << id << std::endl;       // Jump to the return
-            assembly << "*MOD_np_" << id << " ";
-            assembly << "LOAD " << 2 << std::endl;      // Load b
-            assembly << "SUB " << 1 << std::endl;       // Sub result
-            assembly << "JUMP " << "*MOD_RETURN_" << id << std::endl;       // Jump to the return
-
+            if (zero) {
+                assembly << "JUMP " << 2 << std::endl;  // Jump over the division by 0
+                assembly << "*MOD_BY_ZERO_" << id << " ";                   // Label END of the division
+                assembly << "LOAD " << 5 << std::endl;  // Load 0
+            }
             assembly << "*MOD_RETURN_" << id << " ";
-            assembly << "JUMP " << 2 << std::endl;      // Jump over the division by 0
-            assembly << "*MOD_BY_ZERO_" << id << " ";   // Label END of the division
-            assembly << "LOAD " << 5 << std::endl;      // Load 0
             assembly << "STORE " << 4 << std::endl;     // Store result in R4
+            if (remainder >= 0) {
+                assembly << "STORE " << remainder << std::endl;             // Keep it for the fused expressions
+            }
         }
 
-        return assembly.str();
+        return locate(assembly.str());
     }
 };
 
 class ConditionNode : public Node {
 public:
-    explicit ConditionNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "CONDITION"; }
+    explicit ConditionNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::CONDITION, token, id) {}
+
+    // Template turning a - b into the outcome of the comparison
+    TemplateId comparison() const {
+        switch (op) {
+            case Operator::LT:  return TemplateId::BOOL_LT;
+            case Operator::LTE: return TemplateId::BOOL_LTE;
+            case Operator::EQ:  return TemplateId::BOOL_EQ;
+            case Operator::GTE: return TemplateId::BOOL_GTE;
+            case Operator::GT:  return TemplateId::BOOL_GT;
+            default:            return TemplateId::BOOL_NEQ;
+        }
+    }
+
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
 
-        std::string operation = token->getValue();
-
         // a *operator* b
-        if (operation == "<") {
-            assembly << children[1]->build();
-            assembly << "LOAD " << 4 << std::endl;
-            assembly << "STORE " << 1 << std::endl;
-            assembly << children[0]->build();
-            assembly << "LOAD " << 4 << std::endl;
-            assembly << "SUB " << 1 << std::endl;       // a - b
-            assembly << "JNEG " << 3 << std::endl;      // If a - b < 0 jump 3 lines forward
-            assembly << "LOAD " << 5 << std::endl;      // Load 0
-            assembly << "JUMP " << 2 << std::endl;      // Jump 2 lines to go around else
-            assembly << "LOAD " << 6 << std::endl;      // If a - b < 0 load 1
-            assembly << "STORE " << 4 << std::endl;     // Store result in R4
-        } else if (operation == "<=") {
-            assembly << children[1]->build();
-            assembly << "LOAD " << 4 << std::endl;
-            assembly << "STORE " << 1 << std::endl;
-            assembly << children[0]->build();
-            assembly << "LOAD " << 4 << std::endl;
-            assembly << "SUB " << 1 << std::endl;       // a - b
-            assembly << "JPOS " << 3 << std::endl;      // If a - b > 0 jump 3 lines forward
-            assembly << "LOAD " << 6 << std::endl;      // Load 1
-            assembly << "JUMP " << 2 << std::endl;      // Jump 2 lines to go around else
-            assembly << "LOAD " << 5 << std::endl;      // If a - b > 0 load 0
-            assembly << "STORE " << 4 << std::endl;     // Store result in R4
-        } else if (operation == "=") {
-            assembly << children[1]->build();
-            assembly << "LOAD " << 4 << std::endl;
-            assembly << "STORE " << 1 << std::endl;
-            assembly << children[0]->build();
-            assembly << "LOAD " << 4 << std::endl;
-            assembly << "SUB " << 1 << std::endl;       // a - b
-            assembly << "JZERO " << 3 << std::endl;     // If a - b = 0 jump 3 lines forward
-            assembly << "LOAD " << 5 << std::endl;      // Load 0
-            assembly << "JUMP " << 2 << std::endl;      // Jump 2 lines to go around else
-            assembly << "LOAD " << 6 << std::endl;      // If a - b = 0 load 1
-            assembly << "STORE " << 4 << std::endl;     // Store result in R4
-        } else if (operation == ">=") {
-            assembly << children[1]->build();
-            assembly << "LOAD " << 4 << std::endl;
-            assembly << "STORE " << 1 << std::endl;
-            assembly << children[0]->build();
-            assembly << "LOAD " << 4 << std::endl;
-            assembly << "SUB " << 1 << std::endl;       // a - b
-            assembly << "JNEG " << 3 << std::endl;      // If a - b < 0 jump 3 lines forward
-            assembly << "LOAD " << 6 << std::endl;      // Load 1
-            assembly << "JUMP " << 2 << std::endl;      // Jump 2 lines to go around else
-            assembly << "LOAD " << 5 << std::endl;      // If a - b < 0 load 0
-            assembly << "STORE " << 4 << std::endl;     // Store result in R4
-        } else if (operation == ">") {
-            assembly << children[1]->build();
-            assembly << "LOAD " << 4 << std::endl;
-            assembly << "STORE " << 1 << std::endl;
-            assembly << children[0]->build();
-            assembly << "LOAD " << 4 << std::endl;
-            assembly << "SUB " << 1 << std::endl;       // a - b
-            assembly << "JPOS " << 3 << std::endl;      // If a - b > 0 jump 3 lines forward
-            assembly << "LOAD " << 5 << std::endl;      // Load 0
-            assembly << "JUMP " << 2 << std::endl;      // Jump 2 lines to go around else
-            assembly << "LOAD " << 6 << std::endl;      // If a - b > 0 load 1
-            assembly << "STORE " << 4 << std::endl;     // Store result in R4
-        } else if (operation == "!=") {
-            assembly << children[1]->build();
-            assembly << "LOAD " << 4 << std::endl;
-            assembly << "STORE " << 1 << std::endl;
-            assembly << children[0]->build();
-            assembly << "LOAD " << 4 << std::endl;
-            assembly << "SUB " << 1 << std::endl;       // a - b
-            assembly << "JZERO " << 3 << std::endl;     // If a - b = 0 jump 3 lines forward
-            assembly << "LOAD " << 6 << std::endl;      // Load 1
-            assembly << "JUMP " << 2 << std::endl;      // Jump 2 lines to go around else
-            assembly << "LOAD " << 5 << std::endl;      // If a - b = 0 load 0
-            assembly << "STORE " << 4 << std::endl;     // Store result in R4
-        }
+        assembly << children[1]->build();
+        assembly << "LOAD " << 4 << std::endl;
+        assembly << "STORE " << 1 << std::endl;
+        assembly << children[0]->build();
+        assembly << "LOAD " << 4 << std::endl;
+        assembly << "SUB " << 1 << std::endl;           // a - b
+        assembly << emit_template(comparison());         // 1 or 0 into R4
 
-        return assembly.str();
+        return locate(assembly.str());
     }
 };
 
 class ValueNode : public Node {
 public:
-    explicit ValueNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "VALUE"; }
+    explicit ValueNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::VALUE, token, id) {}
+    bool getConstant(long long& value) const override { return children[0]->getConstant(value); }
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
 
@@ -942,8 +1458,15 @@ public:
 
 class NumberNode : public Node {
 public:
-    explicit NumberNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "NUMBER"; }
+    explicit NumberNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::NUMBER, token, id) {}
+    bool getConstant(long long& value) const override {
+        try {
+            value = std::stoll(token->getValue());
+        } catch (const std::exception& e) {
+            return false;
+        }
+        return true;
+    }
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
 
@@ -962,12 +1485,23 @@ public:
 
 class IdentifierNode : public Node {
 public:
-    explicit IdentifierNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "IDENTIFIER"; }
+    explicit IdentifierNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::IDENTIFIER, token, id) {}
+    bool getConstant(long long& value) const override {
+        auto bound = boundIterators.find(token);
+        if (bound == boundIterators.end()) {
+            return false;
+        }
+        value = bound->second;
+        return true;
+    }
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
+        long long value;
 
-        if (token->getFunction() == TokenFunction::ARG) {
+        if (getConstant(value)) {
+            assembly << "LOAD " << constant_token(value)->getAddress() << std::endl;   // Iterator of an unrolled loop
+            assembly << "STORE " << 4 << std::endl;
+        } else if (token->getFunction() == TokenFunction::ARG) {
             assembly << "LOADI " << token->getAddress() << std::endl;
             assembly << "STORE " << 4 << std::endl;
         } else {
@@ -981,12 +1515,26 @@ public:
 
 class TableNode : public Node {
 public:
-    explicit TableNode(Token* token = nullptr, long long id = -1) : Node(token, id) {}
-    std::string getNodeType() const override { return "TABEL"; }
+    long long pointer = -1;     // Cell with the address of the element, filled in by StrengthReduction
+
+    explicit TableNode(Token* token = nullptr, long long id = -1) : Node(NodeKind::TABEL, token, id) {}
     std::string build(std::vector<Token*> *tokens = nullptr) const override {
         std::ostringstream assembly;
+        long long index;
 
-        if (token->getFunction() == TokenFunction::T_ARG) {
+        if (children[0]->getConstant(index)) {
+            if (token->getFunction() == TokenFunction::T_ARG) {
+                assembly << "LOAD " << token->getAddress() << std::endl;                    // Get address of index0
+                assembly << "ADD " << constant_token(index)->getAddress() << std::endl;     // Add the constant index
+                assembly << "LOADI " << 0 << std::endl;                                     // Load value from table
+            } else {
+                assembly << "LOAD " << token->getAddress() + index << std::endl;            // Load the cell directly
+            }
+            assembly << "STORE " << 4 << std::endl;                                         // Store value in R4
+        } else if (pointer >= 0) {
+            assembly << "LOADI " << pointer << std::endl;                // Load value from the element the pointer holds
+            assembly << "STORE " << 4 << std::endl;                     // Store value in R4
+        } else if (token->getFunction() == TokenFunction::T_ARG) {
             assembly << children[0]->build();                           // Store index in R4
             assembly << "LOAD " << token->getAddress() << std::endl;    // Get address of index0
             assembly << "ADD " << 4 << std::endl;                       // Calculate absolute address
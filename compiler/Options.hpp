@@ -0,0 +1,47 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <string>
+#include <vector>
+
+
+class Options {
+public:
+    static Options& getInstance() {
+        static Options instance;
+        return instance;
+    }
+
+    bool printTokens = false;       // -t      Print tokens instead of compiling
+    bool sourceMap = false;         // --map   Write <output>.map with the origin of every instruction
+    bool quiet = false;             // --quiet  No progress or debug output, implied by --serve
+    bool binary = false;            // --binary  Write the binary program format, the map goes into the program
+    long long unrollBudget = 256;   // --unroll-budget <n>  Instructions an unrolled FOR loop may add, 0 disables unrolling
+    long long unrollFactor = 4;     // --unroll-factor <n>  Body copies per iteration of a partially unrolled FOR loop
+    std::string cacheDirectory;     // --cache <dir>  Reuse the code of unchanged procedures from earlier compilations
+    long long jobs = 0;             // --jobs <n>  Threads generating code of procedures, 0 uses every core
+    long long maxErrors = 20;       // --max-errors <n>  Errors after which compilation stops, 0 never stops
+    long long evalFuel = 1000000;   // --eval-fuel <n>  Instructions run at compile time before the first READ, 0 disables partial evaluation
+    long long evalSize = 1024;      // --eval-size <n>  Instructions the evaluated outcome may take
+    std::string level = "2";        // -O0, -O1, -O2, -Os  Pipeline of optimization passes
+    bool small = false;             // Level is -Os, set once the pipeline is configured
+    std::vector<std::string> disabledPasses;    // --disable-pass <name>  Passes left out of the pipeline
+    std::string printAfter;         // --print-after <name>  Print the AST or the assembly after a pass
+    bool profileGenerate = false;   // --profile-generate  Count profiled nodes, writes <output>.blocks for the VM
+    std::string profileUse;         // --profile-use <file>  Profile written by the VM to lay out, inline and unroll by
+    bool timePasses = false;        // --time-passes  Report the time spent in every phase
+    bool stats = false;             // --stats  Report counters, allocations and peak memory
+    bool costReport = false;        // --cost-report  Report the statically estimated cost of every procedure and loop
+    bool statsJson = false;         // --stats-format json  Report as one JSON object instead of text
+
+private:
+    Options() = default;
+    ~Options() = default;
+
+    Options(const Options&) = delete;
+    Options& operator=(const Options&) = delete;
+};
+
+#define OPTIONS Options::getInstance()
+
+#endif // OPTIONS_HPP
@@ -0,0 +1,411 @@
+#ifndef OUTLINER_HPP
+#define OUTLINER_HPP
+
+#include <algorithm>
+#include <climits>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "postprocessing.hpp"
+
+/*
+    Moves instruction sequences that repeat across the assembled units into shared stubs, for -Os.
+    Jumps inside the units are resolved already, so the sequences are compared as the linker will
+    emit them; relocatable addresses of the same token are the same text. A suffix array of all units
+    with its longest common prefixes lists every repeat, jumps, returns and unit boundaries never
+    take part in one. An occurrence is replaced with
+        SET &3; STORE <cell>; JUMP *OUTLINED_<n>
+    and the stub, the sequence followed by RTRN <cell>, returns after the jump. Stubs never call each
+    other, so they share the return cell. The call overwrites the accumulator, a sequence has to set
+    it before reading it, and nothing may jump into the middle of an occurrence.
+
+    A repeat is outlined at the occurrences where the instructions saved are worth more than the
+    cycles the call adds, weighted by the backward jumps around them as estimate_cycles weights
+    loops and, in procedures, by the weights of their calls, and only if the program gets shorter
+    with the stub. The repeats worth the most are taken first.
+*/
+class Outliner {
+public:
+    static constexpr long long MIN_LENGTH = 4;              // Shorter sequences cannot pay for the call
+    static constexpr long long MAX_LENGTH = 256;
+    static constexpr long long INSTRUCTION_WORTH = 100;     // Cycles one instruction less is worth
+    static constexpr long long MAX_WEIGHT = 1000000;
+
+    // Outlines into stubs appended to units, cell is the return cell of the stubs
+    void run(std::vector<Unit>& units, long long cell) {
+        this->cell = cell;
+        callCost = instruction_cost("SET") + instruction_cost("STORE") + instruction_cost("JUMP") + instruction_cost("RTRN");
+        flatten(units);
+
+        std::vector<Candidate> candidates = repeats();
+        std::vector<Candidate> chosen;
+        for (auto& candidate : candidates) {
+            if (select(candidate) > 0) {
+                for (auto position : candidate.positions) {
+                    std::fill(used.begin() + position, used.begin() + position + candidate.length, true);
+                }
+                chosen.push_back(candidate);
+            }
+        }
+        if (chosen.empty()) {
+            return;
+        }
+
+        rewrite(units, chosen);
+    }
+
+    // Estimated cycles the calls added
+    long long added() const {
+        return cycles;
+    }
+
+private:
+    struct Candidate {
+        long long length = 0;
+        std::vector<long long> positions;   // Occurrences, into the flattened program
+        long long score = 0;
+    };
+
+    long long cell = 0;
+    long long callCost = 0;
+    long long cycles = 0;
+
+    std::vector<long long> symbols;     // Instruction of every position, unique for the ones that cannot repeat
+    std::vector<size_t> unitOf;
+    std::vector<long long> indexOf;     // Position within the unit
+    std::vector<long long> weights;     // Loop weight of every position
+    std::vector<bool> entries;          // Positions a jump or a return may reach
+    std::vector<bool> used;
+    std::vector<long long> reached;     // Entries before every position
+    std::vector<const std::string*> text;
+
+    static std::string opcode(const std::string& instruction) {
+        return instruction.substr(0, instruction.find(' '));
+    }
+
+    static std::string operand(const std::string& instruction) {
+        size_t space = instruction.find(' ');
+        return space == std::string::npos ? "" : instruction.substr(space + 1);
+    }
+
+    static bool jump(const std::string& op) {
+        return op == "JUMP" || op == "JPOS" || op == "JZERO" || op == "JNEG";
+    }
+
+    // Whether the instruction can be part of a stub, control flow and return addresses stay in their unit
+    static bool movable(const std::string& instruction) {
+        std::string op = opcode(instruction);
+        return !jump(op) && op != "RTRN" && op != "HALT" && operand(instruction).rfind('&', 0) != 0;
+    }
+
+    // Loop weight of every instruction of a unit, 10 for every backward jump around it, so that the
+    // loops of multiplication and division count as well as the ones of the source
+    static std::vector<long long> loops(const Unit& unit) {
+        std::vector<long long> depths(unit.code.size() + 1, 0);
+        for (size_t i = 0; i < unit.code.size(); i++) {
+            std::string target = operand(unit.code[i]);
+            if (jump(opcode(unit.code[i])) && !target.empty() && target[0] == '-') {
+                depths[i + std::stoll(target)]++;
+                depths[i + 1]--;
+            }
+        }
+
+        std::vector<long long> weights(unit.code.size(), 1);
+        for (size_t i = 0, depth = 0; i < unit.code.size(); i++) {
+            depth += depths[i];
+            for (size_t j = 0; j < depth && weights[i] < MAX_WEIGHT; j++) {
+                weights[i] *= 10;
+            }
+            weights[i] = std::min(weights[i], MAX_WEIGHT);
+        }
+        return weights;
+    }
+
+    // Loop weight of every instruction of every unit, with the weights of the calls of the procedures;
+    // units only call the ones before them
+    static std::vector<std::vector<long long>> frequencies(const std::vector<Unit>& units) {
+        std::unordered_map<std::string, size_t> labels;
+        for (size_t u = 0; u < units.size(); u++) {
+            labels[units[u].label] = u;
+        }
+        std::vector<long long> runs(units.size(), 0);
+        std::vector<std::vector<long long>> weights(units.size());
+        for (size_t u = units.size(); u-- > 0;) {
+            runs[u] = units[u].label == "MAIN" ? 1 : std::min(runs[u], MAX_WEIGHT);
+            weights[u] = loops(units[u]);
+            for (size_t i = 0; i < units[u].code.size(); i++) {
+                weights[u][i] = std::min(weights[u][i] * runs[u], MAX_WEIGHT);
+                std::string target = operand(units[u].code[i]);
+                if (opcode(units[u].code[i]) != "JUMP" || target.rfind('*', 0) != 0) {
+                    continue;
+                }
+                auto callee = labels.find(target.substr(1));
+                if (callee != labels.end()) {
+                    runs[callee->second] += weights[u][i];
+                }
+            }
+        }
+        return weights;
+    }
+
+    void flatten(const std::vector<Unit>& units) {
+        std::unordered_map<std::string, long long> ids;
+        std::vector<std::vector<long long>> frequency = frequencies(units);
+        long long unique = -1;
+
+        for (size_t u = 0; u < units.size(); u++) {
+            const Unit& unit = units[u];
+            long long start = symbols.size();
+            for (size_t i = 0; i < unit.code.size(); i++) {
+                const std::string& instruction = unit.code[i];
+                if (movable(instruction)) {
+                    symbols.push_back(ids.emplace(instruction, ids.size()).first->second);
+                } else {
+                    symbols.push_back(unique--);
+                }
+                unitOf.push_back(u);
+                indexOf.push_back(i);
+                weights.push_back(frequency[u][i]);
+                text.push_back(&instruction);
+            }
+            symbols.push_back(unique--);    // Repeats end with the unit
+            unitOf.push_back(u);
+            indexOf.push_back(unit.code.size());
+            weights.push_back(1);
+            text.push_back(nullptr);
+
+            entries.resize(symbols.size(), false);
+            for (size_t i = 0; i < unit.code.size(); i++) {
+                std::string op = opcode(unit.code[i]);
+                std::string target = operand(unit.code[i]);
+                if (jump(op) && !target.empty() && target[0] != '*') {
+                    entries[start + i + std::stoll(target)] = true;
+                } else if (op == "SET" && !target.empty() && target[0] == '&') {
+                    entries[start + i + std::stoll(target.substr(1))] = true;
+                }
+            }
+            for (const auto& block : unit.blocks) {
+                entries[start + block.entry] = true;
+            }
+        }
+        used.assign(symbols.size(), false);
+        reached.assign(symbols.size() + 1, 0);
+        for (size_t i = 0; i < symbols.size(); i++) {
+            reached[i + 1] = reached[i] + (entries[i] ? 1 : 0);
+        }
+    }
+
+    // Suffix array by prefix doubling, the symbols of every position as the first ranks
+    std::vector<long long> suffixes() const {
+        long long n = symbols.size();
+        std::vector<long long> order(n), rank(symbols), next(n);
+        std::iota(order.begin(), order.end(), 0);
+
+        for (long long step = 1;; step *= 2) {
+            auto key = [&](long long i) { return std::make_pair(rank[i], i + step < n ? rank[i + step] : LLONG_MIN); };
+            std::sort(order.begin(), order.end(), [&](long long a, long long b) { return key(a) < key(b); });
+            next[order[0]] = 0;
+            for (long long i = 1; i < n; i++) {
+                next[order[i]] = next[order[i - 1]] + (key(order[i - 1]) < key(order[i]) ? 1 : 0);
+            }
+            rank = next;
+            if (rank[order[n - 1]] == n - 1) {
+                break;
+            }
+        }
+        return order;
+    }
+
+    // Every repeat of at least MIN_LENGTH instructions, from the intervals of the longest common prefixes
+    std::vector<Candidate> repeats() {
+        std::vector<Candidate> candidates;
+        long long n = symbols.size();
+        if (n < 2) {
+            return candidates;
+        }
+
+        // Longest common prefix of every suffix with the one before it (Kasai)
+        std::vector<long long> order = suffixes();
+        std::vector<long long> rank(n), lcp(n + 1, 0);
+        for (long long i = 0; i < n; i++) {
+            rank[order[i]] = i;
+        }
+        for (long long i = 0, h = 0; i < n; i++) {
+            if (rank[i] == 0) {
+                h = 0;
+                continue;
+            }
+            long long j = order[rank[i] - 1];
+            while (i + h < n && j + h < n && symbols[i + h] == symbols[j + h] && symbols[i + h] >= 0) {
+                h++;
+            }
+            lcp[rank[i]] = h;
+            h = h > 0 ? h - 1 : 0;
+        }
+
+        // Suffixes sharing a prefix of at least h form an interval of the array
+        std::vector<std::pair<long long, long long>> open = {{0, 0}};   // Prefix length, first suffix
+        for (long long i = 1; i <= n; i++) {
+            long long first = i - 1;
+            while (lcp[i] < open.back().first) {
+                auto [length, from] = open.back();
+                open.pop_back();
+                if (length >= MIN_LENGTH) {
+                    Candidate candidate;
+                    candidate.length = std::min(length, MAX_LENGTH);
+                    candidate.positions.assign(order.begin() + from, order.begin() + i);
+                    std::sort(candidate.positions.begin(), candidate.positions.end());
+                    if (entry(candidate.positions[0], candidate.length)) {
+                        candidates.push_back(std::move(candidate));
+                    }
+                }
+                first = from;
+            }
+            if (lcp[i] > open.back().first) {
+                open.emplace_back(lcp[i], first);
+            }
+        }
+
+        for (auto& candidate : candidates) {
+            select(candidate);
+        }
+        std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+            return a.score > b.score;
+        });
+        return candidates;
+    }
+
+    // Whether the sequence sets the accumulator before reading it, the call overwrites it
+    bool entry(long long position, long long length) const {
+        for (long long i = position; i < position + length; i++) {
+            std::string op = opcode(*text[i]);
+            bool cleared = operand(*text[i]) == "0";
+            if (op == "SET" || ((op == "LOAD" || op == "LOADI") && !cleared) || (op == "GET" && cleared)) {
+                return true;
+            }
+            if (op != "GET" && !(op == "PUT" && !cleared)) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // Keeps the occurrences worth outlining that are still free, returns the instructions saved
+    long long select(Candidate& candidate) const {
+        long long length = candidate.length;
+        long long worth = (length - 3) * INSTRUCTION_WORTH;
+        std::vector<long long> positions;
+        long long end = -1;
+        candidate.score = -(length + 1) * INSTRUCTION_WORTH;
+
+        for (auto position : candidate.positions) {
+            if (position < end) {
+                continue;   // Overlaps the previous occurrence
+            }
+            bool free = reached[position + length] == reached[position + 1];
+            for (long long i = position; i < position + length && free; i++) {
+                free = !used[i];
+            }
+            long long call = callCost * weights[position];
+            if (!free || call >= worth) {
+                continue;
+            }
+            positions.push_back(position);
+            candidate.score += worth - call;
+            end = position + length;
+        }
+
+        candidate.positions = positions;
+        long long saving = static_cast<long long>(positions.size()) * (length - 3) - (length + 1);
+        if (saving <= 0 || candidate.score <= 0) {
+            candidate.positions.clear();
+            return 0;
+        }
+        return saving;
+    }
+
+    // Replaces the chosen occurrences with calls and appends the stubs
+    void rewrite(std::vector<Unit>& units, const std::vector<Candidate>& chosen) {
+        size_t count = units.size();
+        std::vector<std::vector<std::pair<long long, size_t>>> sites(count);   // Start and stub, by unit
+
+        for (size_t s = 0; s < chosen.size(); s++) {
+            const Candidate& candidate = chosen[s];
+            long long first = candidate.positions[0];
+            const Unit& origin = units[unitOf[first]];
+
+            Unit stub;
+            stub.label = "OUTLINED_" + std::to_string(s);
+            for (long long i = 0; i < candidate.length; i++) {
+                long long index = indexOf[first + i];
+                stub.locations.push_back(origin.locations[origin.origins[index]]);
+                stub.origins.push_back(i);
+                stub.code.push_back(origin.code[index]);
+            }
+            stub.code.push_back("RTRN " + std::to_string(cell));
+            stub.origins.push_back(0);
+            units.push_back(stub);
+
+            for (auto position : candidate.positions) {
+                sites[unitOf[position]].emplace_back(indexOf[position], s);
+                cycles += callCost * weights[position];
+            }
+        }
+
+        for (size_t u = 0; u < count; u++) {
+            if (sites[u].empty()) {
+                continue;
+            }
+            std::sort(sites[u].begin(), sites[u].end());
+            Unit& unit = units[u];
+            std::vector<long long> moved(unit.code.size() + 1, -1);    // New index of every old one
+            std::vector<long long> from;                                // Old index of every new one, -1 for calls
+            std::vector<std::string> code;
+            std::vector<size_t> origins;
+            size_t next = 0;
+
+            for (size_t i = 0; i < unit.code.size();) {
+                moved[i] = code.size();
+                if (next < sites[u].size() && sites[u][next].first == static_cast<long long>(i)) {
+                    size_t stub = sites[u][next++].second;
+                    for (const auto& instruction : {std::string("SET &3"), "STORE " + std::to_string(cell), "JUMP *OUTLINED_" + std::to_string(stub)}) {
+                        code.push_back(instruction);
+                        origins.push_back(unit.origins[i]);
+                        from.push_back(-1);
+                    }
+                    i += chosen[stub].length;
+                    continue;
+                }
+                code.push_back(unit.code[i]);
+                origins.push_back(unit.origins[i]);
+                from.push_back(i);
+                i++;
+            }
+            moved[unit.code.size()] = code.size();
+
+            // Jumps and return addresses are relative, recompute them from the new positions
+            for (size_t i = 0; i < code.size(); i++) {
+                if (from[i] < 0) {
+                    continue;
+                }
+                std::string op = opcode(code[i]);
+                std::string target = operand(code[i]);
+                if (jump(op) && !target.empty() && target[0] != '*') {
+                    code[i] = op + " " + std::to_string(moved[from[i] + std::stoll(target)] - static_cast<long long>(i));
+                } else if (op == "SET" && !target.empty() && target[0] == '&') {
+                    code[i] = "SET &" + std::to_string(moved[from[i] + std::stoll(target.substr(1))] - static_cast<long long>(i));
+                }
+            }
+            for (auto& block : unit.blocks) {
+                block.entry = moved[block.entry];
+                block.branch = block.branch < 0 ? block.branch : moved[block.branch];
+            }
+
+            unit.code = std::move(code);
+            unit.origins = std::move(origins);
+        }
+    }
+};
+
+#endif // OUTLINER_HPP
@@ -0,0 +1,196 @@
+#ifndef PARTIAL_EVALUATOR_HPP
+#define PARTIAL_EVALUATOR_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "BinaryProgram.hpp"
+#include "postprocessing.hpp"
+
+/*
+    Runs the linked program at compile time until it first reads input, halts or runs out of fuel,
+    with the semantics and costs of the VM. Up to there the run does not depend on the input, so it
+    can be replaced with its outcome: the values it writes and the memory it leaves behind.
+
+    A program that halts becomes its output alone. Otherwise the first instruction of the prologue
+    jumps to a snapshot appended to the program, which writes the output so far, stores every
+    nonzero cell, restores the accumulator and jumps to the instruction the run stopped at. Jumps are
+    relative and return addresses stay valid, nothing else moves. The snapshot is only used if it has
+    at most size instructions and costs less than the run it replaces, at most half of it unless the
+    program halts, so that a run that did little more than the prologue is kept as it is.
+*/
+class PartialEvaluator {
+public:
+    // With smaller, as for -Os, the outcome is only used if it makes the program shorter
+    PartialEvaluator(long long fuel, long long size, bool smaller = false) : fuel(fuel), size(size), smaller(smaller) {}
+
+    // Replaces the input independent start of assembly, returns false if it is left as it is
+    bool run(std::string& assembly, std::vector<SourceLocation>* map) {
+        std::vector<BinaryInstruction> program;
+        std::string error;
+        if (fuel <= 0 || !parse_text_program(assembly, program, error) || program.empty() || !execute(program)) {
+            return false;
+        }
+
+        std::vector<BinaryInstruction> snapshot;
+        unsigned long long cost = 0;
+        long long acc = 0;      // Accumulator of the snapshot code, the machine starts with 0
+        auto set = [&](long long value) {
+            if (acc != value) {
+                snapshot.push_back({OP_SET, value});
+                cost += 50;
+                acc = value;
+            }
+        };
+
+        for (long long value : output) {
+            set(value);
+            snapshot.push_back({OP_PUT, 0});     // The accumulator is cell 0
+            cost += 100;
+        }
+
+        if (finished) {
+            snapshot.push_back({OP_HALT, 0});
+            if (cost >= spent || static_cast<long long>(snapshot.size()) > size || (smaller && snapshot.size() >= program.size())) {
+                return false;
+            }
+            saving = spent - cost;
+            program = snapshot;
+            if (map) {
+                map->assign(program.size(), init());
+            }
+        } else {
+            // Cells of the same value share one SET
+            std::vector<std::pair<long long, long long>> cells;    // Value, address
+            for (const auto& [address, value] : memory) {
+                if (address != 0 && value != 0) {
+                    cells.emplace_back(value, address);
+                }
+            }
+            std::sort(cells.begin(), cells.end());
+            for (const auto& [value, address] : cells) {
+                set(value);
+                snapshot.push_back({OP_STORE, address});
+                cost += 10;
+            }
+            set(memory[0]);
+            long long start = program.size();
+            snapshot.push_back({OP_JUMP, pc - start - static_cast<long long>(snapshot.size())});
+            cost += 2;      // Both jumps
+
+            if (smaller || pc == 0 || cost * 2 > spent || static_cast<long long>(snapshot.size()) > size || jumpsTo(program, 0)) {
+                return false;
+            }
+            saving = spent - cost;
+            program[0] = {OP_JUMP, start};
+            program.insert(program.end(), snapshot.begin(), snapshot.end());
+            if (map) {
+                map->resize(program.size(), init());
+            }
+        }
+
+        assembly = format_text_program(program);
+        return true;
+    }
+
+    // Cycles the replaced run took less the cost of its outcome, 0 if it was kept
+    unsigned long long saved() const {
+        return saving;
+    }
+
+    // Whether the whole run was evaluated and only its output is left
+    bool halted() const {
+        return finished;
+    }
+
+private:
+    long long fuel;
+    long long size;
+    bool smaller;
+    unsigned long long saving = 0;
+
+    std::unordered_map<long long, long long> memory;
+    std::vector<long long> output;
+    long long pc = 0;
+    unsigned long long spent = 0;   // Cost of the evaluated run
+    bool finished = false;
+
+    static SourceLocation init() {
+        SourceLocation location;
+        location.procedure = "INIT";
+        return location;
+    }
+
+    // Whether a jump may reach instruction target, which can then not be replaced
+    static bool jumpsTo(const std::vector<BinaryInstruction>& program, long long target) {
+        for (size_t i = 0; i < program.size(); i++) {
+            uint32_t opcode = program[i].opcode;
+            if ((opcode == OP_JUMP || opcode == OP_JPOS || opcode == OP_JZERO || opcode == OP_JNEG)
+                && static_cast<long long>(i) + program[i].operand == target) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Mirrors run_machine of the VM, stops before GET or HALT or when fuel runs out. Returns false on
+    // a machine error, the program is then left for the VM to report.
+    bool execute(const std::vector<BinaryInstruction>& program) {
+        long long length = program.size();
+
+        for (long long steps = 0; steps < fuel; steps++) {
+            const BinaryInstruction& instruction = program[pc];
+            long long operand = instruction.operand;
+            long long& acc = memory[0];
+
+            if (instruction.opcode == OP_GET) {
+                return true;
+            }
+            if (instruction.opcode == OP_HALT) {
+                finished = true;
+                return true;
+            }
+            if (instruction.opcode != OP_SET && instruction.opcode != OP_JUMP && instruction.opcode != OP_JPOS
+                && instruction.opcode != OP_JZERO && instruction.opcode != OP_JNEG && operand < 0) {
+                return false;
+            }
+            if ((instruction.opcode == OP_LOADI || instruction.opcode == OP_STOREI || instruction.opcode == OP_ADDI
+                 || instruction.opcode == OP_SUBI) && memory[operand] < 0) {
+                return false;
+            }
+
+            switch (instruction.opcode) {
+                case OP_PUT:    output.push_back(memory[operand]); spent += 100; pc++; break;
+
+                case OP_LOAD:   acc = memory[operand]; spent += 10; pc++; break;
+                case OP_STORE:  memory[operand] = acc; spent += 10; pc++; break;
+                case OP_LOADI:  acc = memory[memory[operand]]; spent += 20; pc++; break;
+                case OP_STOREI: memory[memory[operand]] = acc; spent += 20; pc++; break;
+
+                case OP_ADD:    acc = (long long)((unsigned long long)acc + (unsigned long long)memory[operand]); spent += 10; pc++; break;
+                case OP_SUB:    acc = (long long)((unsigned long long)acc - (unsigned long long)memory[operand]); spent += 10; pc++; break;
+                case OP_ADDI:   acc = (long long)((unsigned long long)acc + (unsigned long long)memory[memory[operand]]); spent += 20; pc++; break;
+                case OP_SUBI:   acc = (long long)((unsigned long long)acc - (unsigned long long)memory[memory[operand]]); spent += 12; pc++; break;
+
+                case OP_SET:    acc = operand; spent += 50; pc++; break;
+                case OP_HALF:   acc >>= 1; spent += 5; pc++; break;
+
+                case OP_JUMP:   pc += operand; spent += 1; break;
+                case OP_JPOS:   pc += acc > 0 ? operand : 1; spent += 1; break;
+                case OP_JZERO:  pc += acc == 0 ? operand : 1; spent += 1; break;
+                case OP_JNEG:   pc += acc < 0 ? operand : 1; spent += 1; break;
+
+                case OP_RTRN:   pc = memory[operand]; spent += 10; break;
+                default: return false;
+            }
+
+            if (pc < 0 || pc >= length) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif // PARTIAL_EVALUATOR_HPP
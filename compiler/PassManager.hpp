@@ -0,0 +1,310 @@
+#ifndef PASS_MANAGER_HPP
+#define PASS_MANAGER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Node.hpp"
+#include "Options.hpp"
+#include "Statistics.hpp"
+#include "ErrorHandler.hpp"
+#include "postprocessing.hpp"
+#include "RangeAnalysis.hpp"
+#include "LoopInvariantMotion.hpp"
+#include "DivModFusion.hpp"
+#include "StrengthReduction.hpp"
+#include "ProfileLayout.hpp"
+
+// Where in the compilation a pass runs
+enum class PassStage {
+    PROGRAM,    // Once over the AST of all procedures and main, before code generation
+    UNIT,       // On the AST of every procedure and main, in the task generating its code
+    CODEGEN,    // Inside Node::build, switched on and off
+    ASSEMBLED,  // On the assembled units of all procedures and main, before linking
+    LINKED      // On the assembly of the linked program
+};
+
+struct Pass {
+    std::string name;
+    std::string description;
+    PassStage stage;
+    std::string levels;                 // Levels the pass is part of, out of 0, 1, 2 and s
+    std::vector<std::string> after;     // Passes that have to run first when both are enabled
+    std::function<void(Node*)> run;     // Transformation of one unit, UNIT passes only
+};
+
+/*
+    Registry of the optimization passes and the pipeline an optimization level selects: -O0 compiles
+    straight to code for fast test iterations, -O1 adds the cheap analyses, -O2 (the default) every pass
+    for the lowest cost and -Os only the passes that do not make the program longer. Passes declare the
+    ones they have to run after and are ordered by those dependencies, --disable-pass removes a pass
+    without touching the rest.
+
+    Every pass is timed for --time-passes. With --stats the code of a unit is also built, with diagnostics
+    muted, before and after every pass, so that what each pass saves in instructions and in statically
+    estimated cycles can be reported. --print-after prints the AST of every unit after an AST pass or the
+    assembly after a pass on it.
+*/
+class PassManager {
+public:
+    static PassManager& getInstance() {
+        static PassManager instance;
+        return instance;
+    }
+
+    // Selects the pipeline of OPTIONS.level, returns false and sets error on an unknown level or pass
+    bool configure(std::string& error) {
+        if (OPTIONS.level.size() != 1 || std::string("012s").find(OPTIONS.level) == std::string::npos) {
+            error = "Unknown optimization level -O" + OPTIONS.level;
+            return false;
+        }
+        for (const auto& name : OPTIONS.disabledPasses) {
+            if (!find(name)) {
+                error = "Unknown pass " + name;
+                return false;
+            }
+        }
+        if (!OPTIONS.printAfter.empty() && !find(OPTIONS.printAfter)) {
+            error = "Unknown pass " + OPTIONS.printAfter;
+            return false;
+        }
+
+        OPTIONS.small = OPTIONS.level == "s";
+        active.clear();
+        for (const auto& pass : passes) {
+            if (pass.levels.find(OPTIONS.level) != std::string::npos
+                && std::find(OPTIONS.disabledPasses.begin(), OPTIONS.disabledPasses.end(), pass.name) == OPTIONS.disabledPasses.end()) {
+                active.push_back(pass.name);
+            }
+        }
+
+        // Passes outside of the AST are switched off through their options
+        if (!enabled("unroll")) {
+            OPTIONS.unrollBudget = 0;
+        }
+        if (!enabled("evaluate") || OPTIONS.profileGenerate) {
+            OPTIONS.evalFuel = 0;   // Counted instructions have to stay where the compiler put them
+        }
+        return true;
+    }
+
+    // One line per pass with its levels and what it does, for error messages
+    std::string describe() const {
+        std::string text;
+        for (const auto& pass : passes) {
+            text += "  " + pass.name + std::string(10 - std::min<size_t>(pass.name.size(), 9), ' ') + "-O" + pass.levels
+                  + std::string(6 - std::min<size_t>(pass.levels.size(), 5), ' ') + pass.description + "\n";
+        }
+        return text;
+    }
+
+    bool enabled(const std::string& name) const {
+        return std::find(active.begin(), active.end(), name) != active.end();
+    }
+
+    // Enabled passes that change the code of units, part of the cache key
+    std::string signature() const {
+        std::string text;
+        for (const auto& pass : passes) {
+            if (pass.stage != PassStage::ASSEMBLED && pass.stage != PassStage::LINKED && enabled(pass.name)) {
+                text += pass.name + ",";
+            }
+        }
+        return text;
+    }
+
+    // Runs the enabled UNIT passes on one procedure or main, label names it in printed output
+    void runUnit(Node* unit, const std::string& label) {
+        for (const auto& pass : passes) {
+            if (pass.stage != PassStage::UNIT || !enabled(pass.name)) {
+                continue;
+            }
+            Cost before = measure({unit});
+            long long started = now();
+            pass.run(unit);
+            long long time = now() - started;
+            Cost after = measure({unit});
+            record(pass.name, time, before, after);
+            printAST(pass.name, label, {unit});
+        }
+
+        if (OPTIONS.stats && enabled("unroll")) {
+            Node::unrolling = false;
+            Cost before = measure({unit});
+            Node::unrolling = true;
+            record("unroll", 0, before, measure({unit}));     // Unrolling is timed as code generation
+        }
+    }
+
+    // Runs a PROGRAM pass over all units at once
+    void runProgram(const std::string& name, const std::vector<Node*>& units, const std::function<void()>& body) {
+        if (!enabled(name)) {
+            return;
+        }
+        Cost before = measure(units);
+        long long started = now();
+        body();
+        long long time = now() - started;
+        Cost after = measure(units);
+        record(name, time, before, after);
+        printAST(name, "program", units);
+    }
+
+    // Runs an ASSEMBLED pass on the units, body returns the cycles it saved
+    void runAssembled(const std::string& name, std::vector<Unit>& units, const std::function<long long()>& body) {
+        if (!enabled(name)) {
+            return;
+        }
+        long long instructions = size(units);
+        long long started = now();
+        long long cycles = body();
+        long long time = now() - started;
+        instructions -= size(units);
+        if (OPTIONS.timePasses || OPTIONS.stats) {
+            STATS.pass(name, time, instructions, cycles);
+        }
+        if (OPTIONS.printAfter == name) {
+            std::lock_guard<std::mutex> lock(mtx);
+            std::cout << "After " << name << ":" << std::endl;
+            for (const auto& unit : units) {
+                std::cout << unit.label << ":" << std::endl;
+                for (const auto& instruction : unit.code) {
+                    std::cout << "  " << instruction << std::endl;
+                }
+            }
+        }
+    }
+
+    // Runs a LINKED pass on the assembly, body returns the cycles it saved
+    void runLinked(const std::string& name, std::string& assembly, const std::function<long long()>& body) {
+        if (!enabled(name)) {
+            return;
+        }
+        long long instructions = std::count(assembly.begin(), assembly.end(), '\n');
+        long long started = now();
+        long long cycles = body();
+        long long time = now() - started;
+        instructions -= std::count(assembly.begin(), assembly.end(), '\n');
+        if (OPTIONS.timePasses || OPTIONS.stats) {
+            STATS.pass(name, time, instructions, cycles);
+        }
+        if (OPTIONS.printAfter == name) {
+            std::lock_guard<std::mutex> lock(mtx);
+            std::cout << "After " << name << ":" << std::endl << assembly << std::endl;
+        }
+    }
+
+private:
+    struct Cost {
+        long long instructions = 0;
+        long long cycles = 0;
+    };
+
+    std::vector<Pass> passes;           // Registered, in pipeline order
+    std::vector<std::string> active;    // Names of the enabled passes
+    std::mutex mtx;                     // Printing from concurrent tasks
+
+    PassManager() {
+        add({"args", "Pass unwritten scalar arguments by value, copy written ones in and out",
+             PassStage::PROGRAM, "12s", {}, nullptr});
+        add({"sccp", "Propagate constants and copies on SSA form, fold them and delete code that cannot run",
+             PassStage::PROGRAM, "12s", {"args"}, nullptr});
+        add({"inline", "Build hot procedures in place of their calls, by --profile-use",
+             PassStage::PROGRAM, "2", {"args", "sccp"}, nullptr});
+        add({"frames", "Overlay the memory of procedures that are never active at the same time",
+             PassStage::PROGRAM, "12s", {"inline"}, nullptr});
+        add({"ranges", "Value ranges of scalars, drop sign handling and zero checks of * / %",
+             PassStage::UNIT, "12s", {}, [](Node* unit) { RangeAnalysis().run(unit); }});
+        add({"licm", "Compute loop-invariant * / % once before WHILE and REPEAT loops",
+             PassStage::UNIT, "2", {"ranges"}, [](Node* unit) { LoopInvariantMotion().run(unit); }});
+        add({"divmod", "One division for / and % of the same operands",
+             PassStage::UNIT, "12s", {"ranges", "licm"}, [](Node* unit) { DivModFusion().run(unit); }});
+        add({"strength", "Keep element addresses of tables indexed by loop counters",
+             PassStage::UNIT, "2", {"licm"}, [](Node* unit) { StrengthReduction().run(unit); }});
+        add({"layout", "Order IF ELSE arms and WHILE conditions, leave cold FOR loops rolled, by --profile-use",
+             PassStage::UNIT, "12s", {}, [](Node* unit) { ProfileLayout().run(unit); }});
+        add({"unroll", "Unroll FOR loops with constant bounds",
+             PassStage::CODEGEN, "2", {}, nullptr});
+        add({"outline", "Move repeated instruction sequences into shared stubs",
+             PassStage::ASSEMBLED, "s", {}, nullptr});
+        add({"evaluate", "Replace the input independent start of the program with its outcome",
+             PassStage::LINKED, "2s", {}, nullptr});
+    }
+
+    PassManager(const PassManager&) = delete;
+    PassManager& operator=(const PassManager&) = delete;
+
+    // Inserts pass after the passes it depends on and before the ones that depend on it
+    void add(Pass pass) {
+        size_t position = passes.size();
+        for (size_t i = 0; i < passes.size(); i++) {
+            const auto& after = passes[i].after;
+            if (std::find(after.begin(), after.end(), pass.name) != after.end()) {
+                position = std::min(position, i);
+            }
+        }
+        passes.insert(passes.begin() + position, std::move(pass));
+    }
+
+    const Pass* find(const std::string& name) const {
+        for (const auto& pass : passes) {
+            if (pass.name == name) {
+                return &pass;
+            }
+        }
+        return nullptr;
+    }
+
+    static long long now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Instructions and estimated cycles of the code the units build now, only measured for --stats
+    static Cost measure(const std::vector<Node*>& units) {
+        Cost cost;
+        if (!OPTIONS.stats) {
+            return cost;
+        }
+        bool muted = ErrorHandler::getInstance().mute(true);
+        for (auto unit : units) {
+            std::string code = unit->build();
+            cost.instructions += count_instructions(code);
+            cost.cycles += estimate_cycles(code);
+        }
+        ErrorHandler::getInstance().mute(muted);
+        return cost;
+    }
+
+    static long long size(const std::vector<Unit>& units) {
+        long long instructions = 0;
+        for (const auto& unit : units) {
+            instructions += unit.code.size();
+        }
+        return instructions;
+    }
+
+    static void record(const std::string& name, long long time, const Cost& before, const Cost& after) {
+        if (OPTIONS.timePasses || OPTIONS.stats) {
+            STATS.pass(name, time, before.instructions - after.instructions, before.cycles - after.cycles);
+        }
+    }
+
+    void printAST(const std::string& name, const std::string& label, const std::vector<Node*>& units) {
+        if (OPTIONS.printAfter != name) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        std::cout << "After " << name << " on " << label << ":" << std::endl;
+        for (auto unit : units) {
+            unit->print();
+        }
+    }
+};
+
+#define PASSES PassManager::getInstance()
+
+#endif // PASS_MANAGER_HPP
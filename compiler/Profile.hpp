@@ -0,0 +1,101 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Node.hpp"
+
+// Counts of one profiled node, summed over the copies unrolling and inlining made of it
+struct BlockCounts {
+    unsigned long long count = 0;       // Times the node was entered, calls for a call
+    unsigned long long whenTrue = 0;    // Times its condition held
+    unsigned long long whenFalse = 0;   // Times it did not
+};
+
+/*
+    Execution counts of a run of a --profile-generate build, written by the VM with --profile-out and
+    read for --profile-use. Conditionals, loops and calls are numbered in preorder within their unit,
+    so their IDs stay the same between both builds as long as the source does. For a WHILE the
+    condition holds once per iteration and fails once per entry, for a REPEAT the other way round.
+    Nodes missing from the profile, because the source changed, are left alone by the passes reading it.
+*/
+class Profile {
+public:
+    static Profile& getInstance() {
+        static Profile instance;
+        return instance;
+    }
+
+    // Reads the lines "<block> <count> <true> <false>" of a profile, returns false and sets error if it cannot
+    bool load(const std::string& fileName, std::string& error) {
+        std::ifstream file(fileName);
+        if (!file.is_open()) {
+            error = "Cannot open profile " + fileName;
+            return false;
+        }
+
+        blocks.clear();
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::istringstream fields(line);
+            std::string id;
+            BlockCounts counts;
+            if (!(fields >> id >> counts.count >> counts.whenTrue >> counts.whenFalse)) {
+                error = "Malformed profile line: " + line;
+                return false;
+            }
+            blocks[id] = counts;
+        }
+        return true;
+    }
+
+    bool empty() const { return blocks.empty(); }
+
+    // Counts of the node, nullptr if the profile does not know it
+    const BlockCounts* find(const Node* node) const {
+        if (node->block.empty()) {
+            return nullptr;
+        }
+        auto found = blocks.find(node->block);
+        return found == blocks.end() ? nullptr : &found->second;
+    }
+
+    // Gives the conditionals, loops and calls of a unit their IDs, label names the unit
+    static void number(Node* unit, const std::string& label) {
+        long long next = 0;
+        std::vector<Node*> pending{unit};
+        while (!pending.empty()) {
+            Node* node = pending.back();
+            pending.pop_back();
+            if (profiled(node->kind)) {
+                node->block = label + ":" + std::to_string(next++);
+            }
+            pending.insert(pending.end(), node->children.rbegin(), node->children.rend());
+        }
+    }
+
+private:
+    std::unordered_map<std::string, BlockCounts> blocks;
+
+    Profile() = default;
+    ~Profile() = default;
+
+    Profile(const Profile&) = delete;
+    Profile& operator=(const Profile&) = delete;
+
+    static bool profiled(NodeKind kind) {
+        return kind == NodeKind::IF_COMMAND || kind == NodeKind::IF_ELSE_COMMAND || kind == NodeKind::WHILE_COMMAND
+            || kind == NodeKind::REPEAT_COMMAND || kind == NodeKind::FORTO_COMMAND || kind == NodeKind::FORDOWNTO_COMMAND
+            || kind == NodeKind::PROC_CALL;
+    }
+};
+
+#define PROFILE Profile::getInstance()
+
+#endif // PROFILE_HPP
@@ -0,0 +1,48 @@
+#ifndef PROFILE_LAYOUT_HPP
+#define PROFILE_LAYOUT_HPP
+
+#include "Node.hpp"
+#include "Profile.hpp"
+
+/*
+    Lays out conditionals and loops by the counts of the profile. Of the two arms of an IF ELSE the
+    one the conditional jump reaches costs a jump, the one falling through two, the arm that ran more
+    often is made the one reached by the jump. A WHILE that iterated more often than it was entered
+    gets its condition after the body, one jump per iteration instead of two for one more on entry.
+    FOR loops that were never entered are not unrolled, the copies would only make the program longer.
+    The code is the same size either way.
+*/
+class ProfileLayout {
+public:
+    void run(Node* unit) {
+        if (!PROFILE.empty()) {
+            visit(unit);
+        }
+    }
+
+private:
+    void visit(Node* node) {
+        const BlockCounts* counts = PROFILE.find(node);
+        if (counts) {
+            switch (node->kind) {
+                case NodeKind::IF_ELSE_COMMAND:
+                    static_cast<IfElseCommandNode*>(node)->swapped = counts->whenFalse > counts->whenTrue;
+                    break;
+                case NodeKind::WHILE_COMMAND:
+                    static_cast<WhileCommandNode*>(node)->rotated = counts->whenTrue > counts->whenFalse;
+                    break;
+                case NodeKind::FORTO_COMMAND:
+                case NodeKind::FORDOWNTO_COMMAND:
+                    static_cast<ForCommandNode*>(node)->cold = counts->count == 0;
+                    break;
+                default:
+                    break;
+            }
+        }
+        for (auto child : node->children) {
+            visit(child);
+        }
+    }
+};
+
+#endif // PROFILE_LAYOUT_HPP
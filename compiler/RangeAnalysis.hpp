@@ -0,0 +1,316 @@
+#ifndef RANGE_ANALYSIS_HPP
+#define RANGE_ANALYSIS_HPP
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "Node.hpp"
+#include "Interval.hpp"
+
+/*
+    Interval analysis of scalar variables over the structured control flow of the AST.
+    Every procedure and main are analysed separately from unknown values. Loops are iterated to a fixed
+    point with widening. The operand ranges found for *, / and % are stored in the expression nodes,
+    where code generation uses them to drop sign handling, zero checks and the multiply swap.
+*/
+class RangeAnalysis {
+public:
+    // Analyses one procedure or main
+    void run(Node* unit) {
+        if (unit->kind == NodeKind::PROCEDURE) {
+            commands(unit->children[1], State());
+            return;
+        }
+
+        for (auto node : unit->children) {
+            if (node->kind == NodeKind::COMMANDS) {
+                commands(node, State());
+            }
+        }
+    }
+
+private:
+    // Values of the scalars at one program point, missing variables can hold anything
+    struct State {
+        bool reachable = true;
+        std::unordered_map<const Token*, Interval> values;
+
+        Interval get(const Token* token) const {
+            auto found = values.find(token);
+            return found == values.end() ? Interval() : found->second;
+        }
+
+        bool operator==(const State& other) const {
+            return reachable == other.reachable && values == other.values;
+        }
+    };
+
+    static State unreachable() {
+        State state;
+        state.reachable = false;
+        return state;
+    }
+
+    static State join(const State& a, const State& b) {
+        if (!a.reachable) return b;
+        if (!b.reachable) return a;
+
+        State joined;
+        for (const auto& [token, range] : a.values) {
+            auto other = b.values.find(token);
+            if (other != b.values.end() && !range.join(other->second).top()) {
+                joined.values[token] = range.join(other->second);
+            }
+        }
+        return joined;
+    }
+
+    static State widen(const State& previous, const State& next) {
+        State widened;
+        widened.reachable = next.reachable;
+        for (const auto& [token, range] : next.values) {
+            Interval bounded = previous.get(token).widen(range);
+            if (!bounded.top()) {
+                widened.values[token] = bounded;
+            }
+        }
+        return widened;
+    }
+
+    // Scalars whose values are tracked, tables are not
+    static bool tracked(const Token* token) {
+        return token->getType() == TokenType::IDENTIFIER
+            && (token->getFunction() == TokenFunction::DEFAULT
+                || token->getFunction() == TokenFunction::ITERATOR
+                || token->getFunction() == TokenFunction::ARG
+                || token->getFunction() == TokenFunction::V_ARG
+                || token->getFunction() == TokenFunction::VR_ARG);
+    }
+
+    // Procedure arguments are references and may alias each other, writing one can change the others
+    static void write(State& state, const Token* token, const Interval& range) {
+        if (!tracked(token)) {
+            return;
+        }
+
+        if (token->getFunction() == TokenFunction::ARG) {
+            for (auto it = state.values.begin(); it != state.values.end();) {
+                if (it->first->getFunction() == TokenFunction::ARG && it->first != token) {
+                    it->second = it->second.join(range);
+                    if (it->second.top()) {
+                        it = state.values.erase(it);
+                        continue;
+                    }
+                }
+                ++it;
+            }
+        }
+
+        if (range.top()) {
+            state.values.erase(token);
+        } else {
+            state.values[token] = range;
+        }
+    }
+
+    State commands(Node* node, State state) {
+        for (auto child : node->children) {
+            if (!state.reachable) {
+                break;
+            }
+            state = command(child, state);
+        }
+        return state;
+    }
+
+    State command(Node* node, State state) {
+        switch (node->kind) {
+            case NodeKind::ASSIGNMENT_COMMAND: {
+                Interval range = expression(node->children[1], state);
+                if (node->children[0]->kind == NodeKind::IDENTIFIER) {
+                    write(state, node->children[0]->token, range);
+                }
+                break;
+            }
+            case NodeKind::IF_COMMAND: {
+                auto [then, otherwise] = condition(node->children[0], state);
+                state = join(commands(node->children[1], then), otherwise);
+                break;
+            }
+            case NodeKind::IF_ELSE_COMMAND: {
+                auto [then, otherwise] = condition(node->children[0], state);
+                state = join(commands(node->children[1], then), commands(node->children[2], otherwise));
+                break;
+            }
+            case NodeKind::WHILE_COMMAND: {
+                State head = state;
+                for (int iteration = 0;; iteration++) {
+                    State next = join(head, join(state, commands(node->children[1], condition(node->children[0], head).first)));
+                    if (iteration > 0) {
+                        next = widen(head, next);
+                    }
+                    if (next == head) {
+                        break;
+                    }
+                    head = next;
+                }
+                state = condition(node->children[0], head).second;
+                break;
+            }
+            case NodeKind::REPEAT_COMMAND: {
+                State head = state;
+                std::pair<State, State> exit;
+                for (int iteration = 0;; iteration++) {
+                    exit = condition(node->children[1], commands(node->children[0], head));
+                    State next = join(head, join(state, exit.second));
+                    if (iteration > 0) {
+                        next = widen(head, next);
+                    }
+                    if (next == head) {
+                        break;
+                    }
+                    head = next;
+                }
+                state = exit.first;
+                break;
+            }
+            case NodeKind::FORTO_COMMAND:
+            case NodeKind::FORDOWNTO_COMMAND: {
+                // The iterator only moves away from the first bound, the other one is checked before every trip
+                bool up = node->kind == NodeKind::FORTO_COMMAND;
+                Interval first = value(node->children[0], state);
+                bool written = node->children[2]->writes(node->token);
+                State head = state;
+                for (int iteration = 0;; iteration++) {
+                    Interval last = value(node->children[1], head);
+                    Interval iterator = written ? Interval() : (up ? Interval{first.lo, last.hi} : Interval{last.lo, first.hi});
+                    State body = head;
+                    write(body, node->token, iterator);
+                    State next = join(head, join(state, iterator.empty() ? unreachable() : commands(node->children[2], body)));
+                    if (iteration > 0) {
+                        next = widen(head, next);
+                    }
+                    if (next == head) {
+                        break;
+                    }
+                    head = next;
+                }
+                state = head;
+                write(state, node->token, Interval());
+                break;
+            }
+            case NodeKind::PROC_CALL_COMMAND:
+                for (auto passed : node->children[0]->children[0]->tokens) {
+                    write(state, passed, Interval());
+                }
+                break;
+            case NodeKind::READ_COMMAND:
+                if (node->children[0]->kind == NodeKind::IDENTIFIER) {
+                    write(state, node->children[0]->token, Interval());
+                }
+                break;
+            default:
+                break;
+        }
+
+        return state;
+    }
+
+    Interval value(Node* node, const State& state) const {
+        long long constant;
+        if (node->kind == NodeKind::VALUE) {
+            return value(node->children[0], state);
+        }
+        if (node->getConstant(constant)) {
+            return Interval::constant(constant);
+        }
+        if (node->kind == NodeKind::IDENTIFIER && tracked(node->token)) {
+            return state.get(node->token);
+        }
+        return Interval();
+    }
+
+    Interval expression(Node* node, const State& state) {
+        auto expression = static_cast<ExpressionNode*>(node);
+        if (expression->token == nullptr) {
+            return value(expression->children[0], state);
+        }
+
+        Interval a = value(expression->children[0], state);
+        Interval b = value(expression->children[1], state);
+        expression->ranges[0] = a;
+        expression->ranges[1] = b;
+
+        Operator operation = expression->op;
+        switch (operation) {
+            case Operator::PLUS:    return a + b;
+            case Operator::MINUS:   return a - b;
+            case Operator::TIMES:   return a * b;
+            case Operator::DIVIDE:  return a / b;
+            default:                return a % b;
+        }
+    }
+
+    // Narrows a and b to the values for which "a operation b" holds
+    static void refine(Operator operation, Interval& a, Interval& b) {
+        if (operation == Operator::LT) {
+            a.hi = std::min(a.hi, bound_add(b.hi, -1));
+            b.lo = std::max(b.lo, bound_add(a.lo, 1));
+        } else if (operation == Operator::LTE) {
+            a.hi = std::min(a.hi, b.hi);
+            b.lo = std::max(b.lo, a.lo);
+        } else if (operation == Operator::GT) {
+            refine(Operator::LT, b, a);
+        } else if (operation == Operator::GTE) {
+            refine(Operator::LTE, b, a);
+        } else if (operation == Operator::EQ) {
+            a = b = a.meet(b);
+        } else if (operation == Operator::NEQ) {
+            if (b.lo == b.hi && a.lo == b.lo) a.lo = bound_add(a.lo, 1);
+            if (b.lo == b.hi && a.hi == b.lo) a.hi = bound_add(a.hi, -1);
+            if (a.lo == a.hi && b.lo == a.lo) b.lo = bound_add(b.lo, 1);
+            if (a.lo == a.hi && b.hi == a.lo) b.hi = bound_add(b.hi, -1);
+        }
+    }
+
+    State assume(Node* node, const State& state, Operator operation) const {
+        Interval a = value(node->children[0], state);
+        Interval b = value(node->children[1], state);
+        refine(operation, a, b);
+        if (a.empty() || b.empty()) {
+            return unreachable();
+        }
+
+        State assumed = state;
+        for (int i = 0; i < 2; i++) {
+            Node* operand = node->children[i]->children[0];
+            if (operand->kind == NodeKind::IDENTIFIER && tracked(operand->token) && !(i == 0 ? a : b).top()) {
+                assumed.values[operand->token] = i == 0 ? a : b;
+            }
+        }
+        return assumed;
+    }
+
+    static Operator negation(Operator operation) {
+        switch (operation) {
+            case Operator::LT:  return Operator::GTE;
+            case Operator::GTE: return Operator::LT;
+            case Operator::GT:  return Operator::LTE;
+            case Operator::LTE: return Operator::GT;
+            case Operator::EQ:  return Operator::NEQ;
+            case Operator::NEQ: return Operator::EQ;
+            default:            return operation;
+        }
+    }
+
+    // States where the condition holds and where it does not
+    std::pair<State, State> condition(Node* node, const State& state) const {
+        if (!state.reachable) {
+            return {state, state};
+        }
+
+        return {assume(node, state, node->op), assume(node, state, negation(node->op))};
+    }
+};
+
+#endif // RANGE_ANALYSIS_HPP
@@ -0,0 +1,123 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+bool compile_source(const std::string& source, std::string& program, std::string& diagnostics);
+
+/*
+    Compile server for --serve. Requests and responses are length-prefixed:
+
+        request     <source length>\n<source>
+        response    OK|ERROR <program length> <diagnostics length>\n<program><diagnostics>
+
+    The program is the text or, with --binary, the binary format, diagnostics are the lines the
+    compiler would print. Requests are answered in order until the input ends. The options given next
+    to --serve apply to every request, nothing is written to the output file or the source map.
+    A request longer than MAX_REQUEST gets an ERROR response and ends the connection, as does a
+    client that goes away before reading its response.
+*/
+class Server {
+public:
+    static constexpr unsigned long long MAX_REQUEST = 64ULL << 20;    // Bytes of source
+
+    // Answers the requests read from input on output, returns when input ends or output fails
+    static void serve(FILE* input, FILE* output) {
+        std::string source, program, diagnostics;
+        while (read_request(input, source, diagnostics)) {
+            bool refused = !diagnostics.empty();
+            bool compiled = !refused && compile_source(source, program, diagnostics);
+            if (refused) {
+                program.clear();
+            }
+            std::fprintf(output, "%s %zu %zu\n", compiled ? "OK" : "ERROR", program.size(), diagnostics.size());
+            std::fwrite(program.data(), 1, program.size(), output);
+            std::fwrite(diagnostics.data(), 1, diagnostics.size(), output);
+            if (std::fflush(output) != 0 || refused) {
+                return;     // The client is gone, or the rest of an oversized request cannot be skipped
+            }
+        }
+    }
+
+    // Accepts connections on a Unix domain socket at path, one at a time, until the process is stopped
+    static bool listen(const std::string& path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Error: Socket path too long: " << path << std::endl;
+            return false;
+        }
+        std::strcpy(address.sun_path, path.c_str());
+
+        int server = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(path.c_str());
+        if (server < 0 || bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || ::listen(server, 16) < 0) {
+            std::cerr << "Error: Cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        std::signal(SIGPIPE, SIG_IGN);     // A client leaving early fails the write instead of ending the server
+        while (true) {
+            int connection = accept(server, nullptr, nullptr);
+            if (connection < 0 && (errno == EINTR || errno == ECONNABORTED)) {
+                continue;
+            }
+            if (connection < 0 && (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)) {
+                usleep(100000);             // Out of descriptors or memory, wait for some to be released
+                continue;
+            }
+            if (connection < 0) {
+                std::cerr << "Error: Cannot accept on " << path << ": " << std::strerror(errno) << std::endl;
+                close(server);
+                return false;
+            }
+            FILE* input = fdopen(connection, "r");
+            FILE* output = fdopen(dup(connection), "w");
+            if (input && output) {
+                serve(input, output);
+            }
+            if (input) {
+                std::fclose(input);
+            }
+            if (output) {
+                std::fclose(output);
+            }
+        }
+    }
+
+private:
+    // Reads the next request, error is set instead for one longer than MAX_REQUEST
+    static bool read_request(FILE* input, std::string& source, std::string& error) {
+        char header[32];
+        source.clear();
+        error.clear();
+        if (!std::fgets(header, sizeof(header), input)) {
+            return false;
+        }
+        char* end = nullptr;
+        errno = 0;
+        unsigned long long length = std::strtoull(header, &end, 10);
+        if (end == header || (*end != '\n' && *end != '\r')) {
+            return false;
+        }
+        if (errno == ERANGE || length > MAX_REQUEST) {
+            error = "Error: Request of " + std::string(header, end) + " bytes is longer than the limit of "
+                  + std::to_string(MAX_REQUEST) + " bytes\n";
+            return true;
+        }
+
+        source.resize(length);
+        return std::fread(source.data(), 1, length, input) == length;
+    }
+};
+
+#endif // SERVER_HPP
@@ -0,0 +1,238 @@
+#ifndef STATISTICS_HPP
+#define STATISTICS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include "Options.hpp"
+
+enum class Phase {
+    PARSE,          // Whole front end, includes the two below
+    LEX,
+    SEMANTIC,       // Symbol table checks in manageToken and manageTabel
+    PRINT,          // Debug output of the AST, tokens and assembly
+    CACHE,
+    ANALYSIS,       // Passes on the AST of the units, summed over tasks
+    CODEGEN,        // Node::build, summed over tasks
+    ASSEMBLY,       // Local label resolution, summed over tasks
+    LINK,
+    EVALUATION,     // Partial evaluation of the linked program
+    OUTPUT,         // Writing the program and the source map
+    COUNT
+};
+
+enum class Counter {
+    TOKENS,         // Tokens lexed
+    LOOKUPS,        // Symbol table and constant pool lookups
+    NODES,          // AST nodes created
+    LABELS,         // Label references resolved
+    INSTRUCTIONS,   // Instructions in the program
+    CACHE_HITS,
+    CACHE_MISSES,
+    CELLS,          // Memory cells up to the last variable of the linked program
+    COUNT
+};
+
+/*
+    Compilation statistics for --time-passes and --stats. Phases and counters are atomic so that
+    concurrent code generation tasks can add to them, nothing is measured unless asked for.
+*/
+class Statistics {
+public:
+    static Statistics& getInstance() {
+        static Statistics instance;
+        return instance;
+    }
+
+    // Allocations made through operator new, counted in main.cpp with --stats
+    static inline std::atomic<long long> allocations{0};
+    static inline std::atomic<long long> allocatedBytes{0};
+
+    void add(Counter counter, long long amount = 1) {
+        if (OPTIONS.stats) {
+            counters[static_cast<int>(counter)].fetch_add(amount, std::memory_order_relaxed);
+        }
+    }
+
+    void time(Phase phase, long long nanoseconds) {
+        phases[static_cast<int>(phase)].fetch_add(nanoseconds, std::memory_order_relaxed);
+    }
+
+    // Instructions attributed to AST node kinds by the source map
+    void instructions(const std::string& kind, long long count) {
+        std::lock_guard<std::mutex> lock(mtx);
+        kinds[kind] += count;
+    }
+
+    // Time a pass took and what it saved, instructions and statically estimated cycles, summed over units
+    void pass(const std::string& name, long long nanoseconds, long long instructions, long long cycles) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto found = std::find_if(passes.begin(), passes.end(), [&](const PassRecord& record) { return record.name == name; });
+        if (found == passes.end()) {
+            found = passes.insert(passes.end(), PassRecord{name});
+        }
+        found->nanoseconds += nanoseconds;
+        found->instructions += instructions;
+        found->cycles += cycles;
+    }
+
+    // Nanoseconds since the program started
+    long long elapsed() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void report(std::ostream& output, bool json) const {
+        static const char* phaseNames[] = {"parse", "lex", "semantic checks", "printing", "cache", "analysis",
+                                           "code generation", "assembly", "link", "evaluation", "output"};
+        static const char* counterNames[] = {"tokens lexed", "symbol lookups", "AST nodes", "labels resolved",
+                                             "instructions", "cache hits", "cache misses", "memory cells"};
+        static const bool nested[] = {false, true, true, false, false, false, false, false, false, false, false};
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        long long peak = usage.ru_maxrss;   // KiB on Linux
+        double total = elapsed() / 1e6;
+
+        if (json) {
+            const char* separator = "";
+            output << "{";
+            if (OPTIONS.timePasses) {
+                output << "\"phases_ms\": {";
+                for (int i = 0; i < static_cast<int>(Phase::COUNT); i++) {
+                    output << separator << "\"" << phaseNames[i] << "\": " << phases[i] / 1e6;
+                    separator = ", ";
+                }
+                output << separator << "\"total\": " << total << "}";
+                separator = ", ";
+            }
+            if (OPTIONS.stats) {
+                output << separator << "\"counters\": {";
+                separator = "";
+                for (int i = 0; i < static_cast<int>(Counter::COUNT); i++) {
+                    output << separator << "\"" << counterNames[i] << "\": " << counters[i];
+                    separator = ", ";
+                }
+                output << "}, \"memory\": {\"allocations\": " << allocations << ", \"allocated_bytes\": " << allocatedBytes
+                       << ", \"peak_rss_kib\": " << peak << "}, \"instructions_by_kind\": {";
+                separator = "";
+                for (const auto& [kind, count] : kinds) {
+                    output << separator << "\"" << kind << "\": " << count;
+                    separator = ", ";
+                }
+                output << "}";
+            }
+            if (!passes.empty()) {
+                output << separator << "\"passes\": {";
+                separator = "";
+                for (const auto& record : passes) {
+                    output << separator << "\"" << record.name << "\": {\"ms\": " << record.nanoseconds / 1e6;
+                    if (OPTIONS.stats) {
+                        output << ", \"instructions_removed\": " << record.instructions << ", \"cycles_saved\": " << record.cycles;
+                    }
+                    output << "}";
+                    separator = ", ";
+                }
+                output << "}";
+            }
+            output << "}" << std::endl;
+            return;
+        }
+
+        if (OPTIONS.timePasses) {
+            output << std::left << std::setw(24) << "phase" << std::right << std::setw(12) << "ms" << std::endl;
+            for (int i = 0; i < static_cast<int>(Phase::COUNT); i++) {
+                output << std::left << std::setw(24) << (nested[i] ? std::string("  ") + phaseNames[i] : phaseNames[i])
+                       << std::right << std::setw(12) << std::fixed << std::setprecision(3) << phases[i] / 1e6 << std::endl;
+            }
+            output << std::left << std::setw(24) << "total" << std::right << std::setw(12) << total << std::endl;
+            output << "(analysis, code generation and assembly are summed over concurrent tasks)" << std::endl;
+        }
+        if (OPTIONS.stats) {
+            for (int i = 0; i < static_cast<int>(Counter::COUNT); i++) {
+                output << std::left << std::setw(24) << counterNames[i] << std::right << std::setw(12) << counters[i] << std::endl;
+            }
+            output << std::left << std::setw(24) << "allocations" << std::right << std::setw(12) << allocations << std::endl;
+            output << std::left << std::setw(24) << "allocated bytes" << std::right << std::setw(12) << allocatedBytes << std::endl;
+            output << std::left << std::setw(24) << "peak RSS (KiB)" << std::right << std::setw(12) << peak << std::endl;
+            output << "instructions by node kind:" << std::endl;
+            for (const auto& [kind, count] : kinds) {
+                output << "  " << std::left << std::setw(22) << kind << std::right << std::setw(12) << count << std::endl;
+            }
+        }
+        if (!passes.empty()) {
+            output << std::left << std::setw(24) << "pass" << std::right << std::setw(12) << "ms";
+            if (OPTIONS.stats) {
+                output << std::setw(22) << "instructions removed" << std::setw(16) << "cycles saved";
+            }
+            output << std::endl;
+            for (const auto& record : passes) {
+                output << std::left << std::setw(24) << record.name << std::right << std::setw(12) << std::fixed
+                       << std::setprecision(3) << record.nanoseconds / 1e6;
+                if (OPTIONS.stats) {
+                    output << std::setw(22) << record.instructions << std::setw(16) << record.cycles;
+                }
+                output << std::endl;
+            }
+            if (OPTIONS.stats) {
+                output << "(negative if the pass added instructions or cycles; cycles are estimated statically with loop" << std::endl
+                       << " bodies weighted by 10, evaluate reports the cycles of the run it replaced)" << std::endl;
+            }
+        }
+    }
+
+private:
+    Statistics() = default;
+    ~Statistics() = default;
+
+    Statistics(const Statistics&) = delete;
+    Statistics& operator=(const Statistics&) = delete;
+
+    static inline const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::atomic<long long> phases[static_cast<int>(Phase::COUNT)] = {};
+    std::atomic<long long> counters[static_cast<int>(Counter::COUNT)] = {};
+    struct PassRecord {
+        std::string name;
+        long long nanoseconds = 0;
+        long long instructions = 0;     // Removed
+        long long cycles = 0;           // Saved
+    };
+
+    std::map<std::string, long long> kinds;
+    std::vector<PassRecord> passes;     // In the order they first ran
+    std::mutex mtx;
+};
+
+#define STATS Statistics::getInstance()
+
+// Adds the time until stop() or the end of the scope to a phase when --time-passes is on
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Phase phase) : phase(phase), running(OPTIONS.timePasses) {
+        if (running) {
+            begin = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~PhaseTimer() { stop(); }
+
+    void stop() {
+        if (running) {
+            STATS.time(phase, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+            running = false;
+        }
+    }
+
+private:
+    Phase phase;
+    bool running;
+    std::chrono::steady_clock::time_point begin;
+};
+
+#endif // STATISTICS_HPP
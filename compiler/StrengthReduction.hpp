@@ -0,0 +1,216 @@
+#ifndef STRENGTH_REDUCTION_HPP
+#define STRENGTH_REDUCTION_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "Node.hpp"
+
+/*
+    Keeps the address of t[i] in a cell while a loop steps i by one, so that the body reaches the
+    element with a single LOADI or STOREI instead of computing t + i on every access. The index is the
+    iterator of a FOR loop, or a counter of a WHILE or REPEAT loop that is only ever changed by
+    k := k + 1 or k := k - 1 inside it. The loop points the cells at the elements when it starts and
+    steps them with the index. Counters must be variables of the unit, arguments passed by reference
+    may be changed through another name. A pointer is only kept if the accesses it saves, weighted by
+    their loop nesting, outweigh stepping it.
+*/
+class StrengthReduction {
+public:
+    // Reduces within one procedure or main
+    void run(Node* unit) {
+        owner = unit;
+        cells = 0;
+        active.clear();
+        visit(unit->kind == NodeKind::PROCEDURE ? unit->children[1] : unit);
+    }
+
+private:
+    static constexpr long long LOOP_WEIGHT = 10;    // Assumed iterations of a nested loop
+    static constexpr long long MAX_WEIGHT = 1000000;
+    static constexpr long long ACCESS_SAVING = 80;  // Index load and address arithmetic an access skips
+    static constexpr long long STEP_COST = 30;      // LOAD, ADD and STORE of the pointer cell
+
+    const Node* owner = nullptr;    // Unit whose frame holds the cells
+    long long cells = 0;
+    std::vector<InductionPointer> active;    // Pointers of the loops around the visited node
+
+    static std::vector<InductionPointer>* pointers(Node* loop) {
+        NodeKind type = loop->kind;
+        if (type == NodeKind::WHILE_COMMAND) {
+            return &static_cast<WhileCommandNode*>(loop)->pointers;
+        }
+        if (type == NodeKind::REPEAT_COMMAND) {
+            return &static_cast<RepeatCommandNode*>(loop)->pointers;
+        }
+        return &static_cast<ForCommandNode*>(loop)->pointers;
+    }
+
+    void visit(Node* node) {
+        NodeKind type = node->kind;
+        size_t outer = active.size();
+
+        if (type == NodeKind::FORTO_COMMAND || type == NodeKind::FORDOWNTO_COMMAND) {
+            visit(node->children[0]);   // Bounds are evaluated before the pointers are set
+            visit(node->children[1]);
+            if (!node->children[2]->writes(node->token)) {
+                reduce(node, node->token, 1);
+            }
+            visit(node->children[2]);
+            active.resize(outer);
+            return;
+        }
+
+        if (type == NodeKind::WHILE_COMMAND || type == NodeKind::REPEAT_COMMAND) {
+            std::vector<Token*> indices;
+            collectIndices(node, indices);
+            for (auto index : indices) {
+                long long steps = 0;
+                if (counter(index) && stepsOnly(node, index, 1, steps) && steps > 0) {
+                    reduce(node, index, steps);
+                }
+            }
+        }
+
+        if (type == NodeKind::TABEL) {
+            static_cast<TableNode*>(node)->pointer = find(node->token, node->children[0]);
+        }
+
+        if (type == NodeKind::ASSIGNMENT_COMMAND) {
+            auto assignment = static_cast<AssignmentCommandNode*>(node);
+            Node* target = node->children[0];
+            if (target->kind == NodeKind::TABEL) {
+                assignment->pointer = find(target->token, target->children[0]);
+            } else if ((assignment->step = step(node, target->token)) != 0) {
+                for (const auto& pointer : active) {
+                    if (pointer.index == target->token) {
+                        assignment->stepped.push_back(pointer);
+                    }
+                }
+            }
+        }
+
+        for (auto child : node->children) {
+            visit(child);
+        }
+        active.resize(outer);
+    }
+
+    // Keeps pointers for the tables the loop accesses with index, steps is the weight of stepping them
+    void reduce(Node* loop, Token* index, long long steps) {
+        std::vector<Token*> tables;
+        std::vector<long long> accesses;
+        countAccesses(loop, index, 1, tables, accesses);
+
+        for (size_t i = 0; i < tables.size(); i++) {
+            if (find(tables[i], index) >= 0 || accesses[i] * ACCESS_SAVING <= steps * STEP_COST) {
+                continue;   // Kept by an enclosing loop already or not worth it
+            }
+            InductionPointer pointer{tables[i], index, unit_cell(owner, "~i", cells++)};
+            pointers(loop)->push_back(pointer);
+            active.push_back(pointer);
+        }
+    }
+
+    long long find(const Token* table, const Token* index) const {
+        for (const auto& pointer : active) {
+            if (pointer.table == table && pointer.index == index) {
+                return pointer.cell;
+            }
+        }
+        return -1;
+    }
+
+    long long find(const Token* table, const Node* index) const {
+        return index->kind == NodeKind::IDENTIFIER ? find(table, index->token) : -1;
+    }
+
+    static long long deeper(long long weight) {
+        return std::min(weight * LOOP_WEIGHT, MAX_WEIGHT);
+    }
+
+    // Scalars of the unit, nothing but their own commands can change them
+    static bool counter(const Token* token) {
+        return token->getFunction() == TokenFunction::DEFAULT
+            || token->getFunction() == TokenFunction::V_ARG
+            || token->getFunction() == TokenFunction::VR_ARG;
+    }
+
+    // Variables indexing tables in the subtree
+    static void collectIndices(const Node* node, std::vector<Token*>& indices) {
+        if (node->kind == NodeKind::TABEL && node->children[0]->kind == NodeKind::IDENTIFIER
+            && std::find(indices.begin(), indices.end(), node->children[0]->token) == indices.end()) {
+            indices.push_back(node->children[0]->token);
+        }
+        for (auto child : node->children) {
+            collectIndices(child, indices);
+        }
+    }
+
+    // Weighted accesses to every table indexed by index within the subtree
+    static void countAccesses(const Node* node, const Token* index, long long weight,
+                              std::vector<Token*>& tables, std::vector<long long>& accesses) {
+        if (node->kind == NodeKind::TABEL && node->children[0]->kind == NodeKind::IDENTIFIER
+            && node->children[0]->token == index) {
+            auto found = std::find(tables.begin(), tables.end(), node->token);
+            if (found == tables.end()) {
+                tables.push_back(node->token);
+                accesses.push_back(weight);
+            } else {
+                accesses[found - tables.begin()] += weight;
+            }
+        }
+        for (auto child : node->children) {
+            countAccesses(child, index, child->isLoop() ? deeper(weight) : weight, tables, accesses);
+        }
+    }
+
+    // 1 or -1 if the assignment steps target by one, 0 otherwise
+    static long long step(const Node* assignment, const Token* target) {
+        const Node* expression = assignment->children[1];
+        if (expression->token == nullptr) {
+            return 0;
+        }
+        Operator operation = expression->op;
+        const Node* a = expression->children[0]->children[0];
+        const Node* b = expression->children[1]->children[0];
+        long long value;
+
+        if (a->kind == NodeKind::IDENTIFIER && a->token == target && b->getConstant(value) && (value == 1 || value == -1)) {
+            if (operation == Operator::PLUS) {
+                return value;
+            }
+            if (operation == Operator::MINUS) {
+                return -value;
+            }
+        }
+        if (operation == Operator::PLUS && b->kind == NodeKind::IDENTIFIER && b->token == target
+            && a->getConstant(value) && (value == 1 || value == -1)) {
+            return value;
+        }
+        return 0;
+    }
+
+    // Returns true if the subtree changes index only by stepping it, steps is their weighted count
+    static bool stepsOnly(const Node* node, const Token* index, long long weight, long long& steps) {
+        NodeKind type = node->kind;
+        if (type == NodeKind::ASSIGNMENT_COMMAND && node->children[0]->token == index) {
+            if (node->children[0]->kind != NodeKind::IDENTIFIER || step(node, index) == 0) {
+                return false;
+            }
+            steps += weight;
+        }
+        if ((type == NodeKind::READ_COMMAND && node->children[0]->token == index)
+            || (type == NodeKind::ARGS && std::find(node->tokens.begin(), node->tokens.end(), index) != node->tokens.end())) {
+            return false;
+        }
+        for (auto child : node->children) {
+            if (!stepsOnly(child, index, child->isLoop() ? deeper(weight) : weight, steps)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif // STRENGTH_REDUCTION_HPP
@@ -0,0 +1,293 @@
+#ifndef TEMPLATES_HPP
+#define TEMPLATES_HPP
+
+// Generated by superopt from the template specifications in superopt.cpp, do not edit.
+// Regenerate with make templates.
+
+#include <cstddef>
+
+enum class TemplateOperand {
+    NONE,
+    CELL,       // Fixed cell: the accumulator, a register or the constants 0 and 1
+    PARAMETER,  // Cell the code generator passes in, X
+    CONSTANT,   // Constant pool entry of the value
+    JUMP        // Relative jump inside the template, to its size at most
+};
+
+struct TemplateInstruction {
+    const char* opcode;
+    TemplateOperand kind;
+    long long value;
+};
+
+struct InstructionTemplate {
+    const TemplateInstruction* code;
+    size_t size;
+};
+
+enum class TemplateId {
+    BOOL_LT,
+    BOOL_LTE,
+    BOOL_EQ,
+    BOOL_GTE,
+    BOOL_GT,
+    BOOL_NEQ,
+    MUL_NEGATE_B,
+    MUL_NEGATE_A,
+    MUL_SIGN,
+    DIV_NEGATE_B,
+    DIV_NEGATE_A,
+    DIV_MIXED,
+    COUNT
+};
+
+// R4 = 1 if a < b else 0, the accumulator holds a - b
+// reference: JNEG 3; LOAD 5; JUMP 2; LOAD 6; STORE 4
+// cycles on average: reference 21.6, fast 21.6, small 21.6
+inline constexpr TemplateInstruction BOOL_LT_FAST[] = {
+    {"JNEG", TemplateOperand::JUMP, 3},
+    {"LOAD", TemplateOperand::CELL, 5},
+    {"JUMP", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+inline constexpr TemplateInstruction BOOL_LT_SMALL[] = {
+    {"JNEG", TemplateOperand::JUMP, 3},
+    {"LOAD", TemplateOperand::CELL, 5},
+    {"JUMP", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+
+// R4 = 1 if a <= b else 0, the accumulator holds a - b
+// reference: JPOS 3; LOAD 6; JUMP 2; LOAD 5; STORE 4
+// cycles on average: reference 21.5, fast 21.5, small 21.5
+inline constexpr TemplateInstruction BOOL_LTE_FAST[] = {
+    {"JPOS", TemplateOperand::JUMP, 3},
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"JUMP", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CELL, 5},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+inline constexpr TemplateInstruction BOOL_LTE_SMALL[] = {
+    {"JPOS", TemplateOperand::JUMP, 3},
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"JUMP", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CELL, 5},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+
+// R4 = 1 if a = b else 0, the accumulator holds a - b
+// reference: JZERO 3; LOAD 5; JUMP 2; LOAD 6; STORE 4
+// cycles on average: reference 21.9, fast 21.9, small 21.9
+inline constexpr TemplateInstruction BOOL_EQ_FAST[] = {
+    {"JZERO", TemplateOperand::JUMP, 3},
+    {"LOAD", TemplateOperand::CELL, 5},
+    {"JUMP", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+inline constexpr TemplateInstruction BOOL_EQ_SMALL[] = {
+    {"JZERO", TemplateOperand::JUMP, 3},
+    {"LOAD", TemplateOperand::CELL, 5},
+    {"JUMP", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+
+// R4 = 1 if a >= b else 0, the accumulator holds a - b
+// reference: JNEG 3; LOAD 6; JUMP 2; LOAD 5; STORE 4
+// cycles on average: reference 21.6, fast 21.6, small 21.6
+inline constexpr TemplateInstruction BOOL_GTE_FAST[] = {
+    {"JNEG", TemplateOperand::JUMP, 3},
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"JUMP", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CELL, 5},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+inline constexpr TemplateInstruction BOOL_GTE_SMALL[] = {
+    {"JNEG", TemplateOperand::JUMP, 3},
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"JUMP", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CELL, 5},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+
+// R4 = 1 if a > b else 0, the accumulator holds a - b
+// reference: JPOS 3; LOAD 5; JUMP 2; LOAD 6; STORE 4
+// cycles on average: reference 21.5, fast 21.5, small 21.5
+inline constexpr TemplateInstruction BOOL_GT_FAST[] = {
+    {"JPOS", TemplateOperand::JUMP, 3},
+    {"LOAD", TemplateOperand::CELL, 5},
+    {"JUMP", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+inline constexpr TemplateInstruction BOOL_GT_SMALL[] = {
+    {"JPOS", TemplateOperand::JUMP, 3},
+    {"LOAD", TemplateOperand::CELL, 5},
+    {"JUMP", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+
+// R4 = 1 if a != b else 0, the accumulator holds a - b
+// reference: JZERO 3; LOAD 6; JUMP 2; LOAD 5; STORE 4
+// cycles on average: reference 21.9, fast 19.8, small 19.8
+inline constexpr TemplateInstruction BOOL_NEQ_FAST[] = {
+    {"JZERO", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+inline constexpr TemplateInstruction BOOL_NEQ_SMALL[] = {
+    {"JZERO", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+
+// X = -X and the sign R7 = 1, X < 0 is in the accumulator and R7 = 0
+// reference: SUB X; SUB X; STORE X; LOAD 6; STORE 7
+// cycles on average: reference 50.0, fast 45.0, small 45.0
+inline constexpr TemplateInstruction MUL_NEGATE_B_FAST[] = {
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"STORE", TemplateOperand::CELL, 7},
+    {"HALF", TemplateOperand::NONE, 0},
+    {"SUB", TemplateOperand::PARAMETER, 0},
+    {"STORE", TemplateOperand::PARAMETER, 0},
+};
+inline constexpr TemplateInstruction MUL_NEGATE_B_SMALL[] = {
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"STORE", TemplateOperand::CELL, 7},
+    {"HALF", TemplateOperand::NONE, 0},
+    {"SUB", TemplateOperand::PARAMETER, 0},
+    {"STORE", TemplateOperand::PARAMETER, 0},
+};
+
+// X = -X and the sign R7 flips between 0 and 1, X < 0 is in the accumulator
+// reference: SUB X; SUB X; STORE X; LOAD 7; JPOS 4; ADD 6; STORE 7; JUMP 3; HALF; STORE 7
+// cycles on average: reference 59.0, fast 55.0, small 55.0
+inline constexpr TemplateInstruction MUL_NEGATE_A_FAST[] = {
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"SUB", TemplateOperand::CELL, 7},
+    {"STORE", TemplateOperand::CELL, 7},
+    {"HALF", TemplateOperand::NONE, 0},
+    {"SUB", TemplateOperand::PARAMETER, 0},
+    {"STORE", TemplateOperand::PARAMETER, 0},
+};
+inline constexpr TemplateInstruction MUL_NEGATE_A_SMALL[] = {
+    {"LOAD", TemplateOperand::CELL, 6},
+    {"SUB", TemplateOperand::CELL, 7},
+    {"STORE", TemplateOperand::CELL, 7},
+    {"HALF", TemplateOperand::NONE, 0},
+    {"SUB", TemplateOperand::PARAMETER, 0},
+    {"STORE", TemplateOperand::PARAMETER, 0},
+};
+
+// R4 = -R4 if the sign R7 is 1, unchanged if it is 0
+// reference: LOAD 7; JZERO 5; LOAD 4; SUB 4; SUB 4; JUMP 2; LOAD 4; STORE 4
+// cycles on average: reference 41.5, fast 23.4, small 23.5
+inline constexpr TemplateInstruction MUL_SIGN_FAST[] = {
+    {"LOAD", TemplateOperand::CELL, 7},
+    {"JZERO", TemplateOperand::JUMP, 5},
+    {"HALF", TemplateOperand::NONE, 0},
+    {"SUB", TemplateOperand::CELL, 4},
+    {"JZERO", TemplateOperand::JUMP, 2},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+inline constexpr TemplateInstruction MUL_SIGN_SMALL[] = {
+    {"LOAD", TemplateOperand::CELL, 7},
+    {"JZERO", TemplateOperand::JUMP, 4},
+    {"HALF", TemplateOperand::NONE, 0},
+    {"SUB", TemplateOperand::CELL, 4},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+
+// X = -X and the sign R7 = 2, X < 0 is in the accumulator and R7 = 0
+// reference: SUB X; SUB X; STORE X; LOAD 6; ADD 6; STORE 7
+// cycles on average: reference 60.0, fast 50.0, small 50.0
+inline constexpr TemplateInstruction DIV_NEGATE_B_FAST[] = {
+    {"SUB", TemplateOperand::PARAMETER, 0},
+    {"SUB", TemplateOperand::PARAMETER, 0},
+    {"STORE", TemplateOperand::PARAMETER, 0},
+    {"LOAD", TemplateOperand::CONSTANT, 2},
+    {"STORE", TemplateOperand::CELL, 7},
+};
+inline constexpr TemplateInstruction DIV_NEGATE_B_SMALL[] = {
+    {"SUB", TemplateOperand::PARAMETER, 0},
+    {"SUB", TemplateOperand::PARAMETER, 0},
+    {"STORE", TemplateOperand::PARAMETER, 0},
+    {"LOAD", TemplateOperand::CONSTANT, 2},
+    {"STORE", TemplateOperand::CELL, 7},
+};
+
+// X = -X and the sign R7 grows by 1, X < 0 is in the accumulator and R7 is 0 or 2
+// reference: SUB X; SUB X; STORE X; LOAD 7; ADD 6; STORE 7
+// cycles on average: reference 60.0, fast 60.0, small 60.0
+inline constexpr TemplateInstruction DIV_NEGATE_A_FAST[] = {
+    {"SUB", TemplateOperand::PARAMETER, 0},
+    {"SUB", TemplateOperand::PARAMETER, 0},
+    {"STORE", TemplateOperand::PARAMETER, 0},
+    {"LOAD", TemplateOperand::CELL, 7},
+    {"ADD", TemplateOperand::CELL, 6},
+    {"STORE", TemplateOperand::CELL, 7},
+};
+inline constexpr TemplateInstruction DIV_NEGATE_A_SMALL[] = {
+    {"SUB", TemplateOperand::PARAMETER, 0},
+    {"SUB", TemplateOperand::PARAMETER, 0},
+    {"STORE", TemplateOperand::PARAMETER, 0},
+    {"LOAD", TemplateOperand::CELL, 7},
+    {"ADD", TemplateOperand::CELL, 6},
+    {"STORE", TemplateOperand::CELL, 7},
+};
+
+// R4 = -(R4 + 1) if the remainder R1 is not 0, else -R4; the quotient of operands of mixed signs
+// reference: LOAD 1; JZERO 2; LOAD 6; ADD 4; STORE 8; LOAD 5; SUB 8; STORE 4
+// cycles on average: reference 69.0, fast 39.0, small 39.0
+inline constexpr TemplateInstruction DIV_MIXED_FAST[] = {
+    {"LOAD", TemplateOperand::CELL, 1},
+    {"JZERO", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CONSTANT, -1},
+    {"SUB", TemplateOperand::CELL, 4},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+inline constexpr TemplateInstruction DIV_MIXED_SMALL[] = {
+    {"LOAD", TemplateOperand::CELL, 1},
+    {"JZERO", TemplateOperand::JUMP, 2},
+    {"LOAD", TemplateOperand::CONSTANT, -1},
+    {"SUB", TemplateOperand::CELL, 4},
+    {"STORE", TemplateOperand::CELL, 4},
+};
+
+// Fewest cycles
+inline constexpr InstructionTemplate FAST_TEMPLATES[] = {
+    {BOOL_LT_FAST, 5},
+    {BOOL_LTE_FAST, 5},
+    {BOOL_EQ_FAST, 5},
+    {BOOL_GTE_FAST, 5},
+    {BOOL_GT_FAST, 5},
+    {BOOL_NEQ_FAST, 3},
+    {MUL_NEGATE_B_FAST, 5},
+    {MUL_NEGATE_A_FAST, 6},
+    {MUL_SIGN_FAST, 6},
+    {DIV_NEGATE_B_FAST, 5},
+    {DIV_NEGATE_A_FAST, 6},
+    {DIV_MIXED_FAST, 5},
+};
+
+// Fewest instructions
+inline constexpr InstructionTemplate SMALL_TEMPLATES[] = {
+    {BOOL_LT_SMALL, 5},
+    {BOOL_LTE_SMALL, 5},
+    {BOOL_EQ_SMALL, 5},
+    {BOOL_GTE_SMALL, 5},
+    {BOOL_GT_SMALL, 5},
+    {BOOL_NEQ_SMALL, 3},
+    {MUL_NEGATE_B_SMALL, 5},
+    {MUL_NEGATE_A_SMALL, 6},
+    {MUL_SIGN_SMALL, 5},
+    {DIV_NEGATE_B_SMALL, 5},
+    {DIV_NEGATE_A_SMALL, 6},
+    {DIV_MIXED_SMALL, 5},
+};
+
+#endif // TEMPLATES_HPP
@@ -22,7 +22,9 @@ enum class TokenFunction {
     ARG,        // Procedure argument
     T_ARG,      // Procedure argument that is a table
     PROC,       // Return address
-    ITERATOR    // Iterator
+    ITERATOR,   // Iterator
+    V_ARG,      // Procedure argument copied in by the caller, chosen by ArgumentModes
+    VR_ARG      // Procedure argument copied in and back out by the caller, chosen by ArgumentModes
 };
 
 class Token {
@@ -39,6 +41,8 @@ public:
     TokenFunction getFunction() const { return function; }
     std::vector<Token*> getArgs() const { return args; }
     bool isInitialized() const { return initialized; }
+    long long getLower() const { return lower; }
+    long long getUpper() const { return upper; }
 
     void setAddress(long long addr) { this->address = addr; }
     void setValue(std::string value) { this->value = value; }
@@ -47,6 +51,7 @@ public:
     void addArg(Token* arg) { this->args.push_back(arg); }
     void setArgs(const std::vector<Token*>& args) { this->args = args; }
     Token* initialize() { this->initialized = true;  return this; }
+    void setBounds(long long lower, long long upper) { this->lower = lower; this->upper = upper; }
 
     void print() const {
         std::cout << "Token(Type: " << tokenTypeToString(type)
@@ -68,6 +73,8 @@ private:
     TokenFunction function;
     std::vector<Token*> args;
     bool initialized = false;
+    long long lower = 0;    // Offsets of the first and last cell from the address, the bounds of a table
+    long long upper = 0;
 
     static std::string tokenTypeToString(TokenType type) {
         switch (type) {
@@ -127,6 +134,8 @@ private:
             case TokenFunction::T_ARG: return "TABLE_ARGUMENT";
             case TokenFunction::TABLE: return "TABLE";
             case TokenFunction::ITERATOR: return "ITERATOR";
+            case TokenFunction::V_ARG: return "VALUE_ARGUMENT";
+            case TokenFunction::VR_ARG: return "VALUE_RESULT_ARGUMENT";
             default: return "DEFAULT";
         }
     }
@@ -0,0 +1,326 @@
+#ifndef UNIT_CACHE_HPP
+#define UNIT_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <filesystem>
+#include <cstdlib>
+#include <unordered_map>
+#include "Token.hpp"
+#include "Node.hpp"
+#include "Options.hpp"
+#include "Linker.hpp"
+#include "postprocessing.hpp"
+#include "Statistics.hpp"
+#include "PassManager.hpp"
+
+extern std::vector<Token*> tokens;
+extern std::vector<Token*> procs;
+
+/*
+    On-disk cache of assembled procedures. A unit is stored under a hash of the procedure's AST, the
+    signatures of the procedures it calls and the options that change code generation. Relocatable
+    addresses are saved as symbols (name.x for a variable of procedure name, name. for its return address,
+    =v for a constant), jumps to other units and return addresses stay symbolic and source lines are kept
+    relative to the procedure. A hit skips analysis and code generation of the procedure.
+*/
+class UnitCache {
+public:
+    explicit UnitCache(const std::string& directory) : directory(directory) {
+        if (enabled()) {
+            std::error_code error;
+            std::filesystem::create_directories(directory, error);
+        }
+    }
+
+    bool enabled() const { return !directory.empty(); }
+
+    long long getHits() const { return hits; }
+    long long getMisses() const { return misses; }
+
+    std::string key(const Node* procedure) const {
+        if (!enabled()) {
+            return "";
+        }
+
+        std::ostringstream text;
+        text << VERSION << " " << OPTIONS.unrollBudget << " " << OPTIONS.unrollFactor << " " << PASSES.signature();
+        serialize(procedure, text);
+
+        unsigned long long hash = 14695981039346656037ULL;            // FNV-1a
+        for (unsigned char c : text.str()) {
+            hash = (hash ^ c) * 1099511628211ULL;
+        }
+
+        std::ostringstream hex;
+        hex << std::hex << std::setw(16) << std::setfill('0') << hash;
+        return hex.str();
+    }
+
+    // Reads the unit stored under key, false if it is missing or refers to something the program lacks
+    bool load(const std::string& key, const Node* procedure, Unit& unit) {
+        if (!enabled()) {
+            return false;
+        }
+
+        std::ifstream file(path(key), std::ios::binary);
+        std::ostringstream content;
+        content << file.rdbuf();
+        std::string text = content.str();
+
+        Unit loaded;
+        bool parsed = false;
+        try {
+            parsed = parse(text, procedure, loaded);
+        } catch (const std::exception&) { }     // A damaged unit is only a miss
+
+        if (!parsed) {
+            misses++;
+            STATS.add(Counter::CACHE_MISSES);
+            return false;
+        }
+
+        unit = std::move(loaded);
+        hits++;
+        STATS.add(Counter::CACHE_HITS);
+        return true;
+    }
+
+    void store(const std::string& key, const Node* procedure, const Unit& unit) const {
+        if (!enabled()) {
+            return;
+        }
+
+        long long base = procedure->line;
+        std::string output = std::string(VERSION) + "\n" + unit.label + " " + std::to_string(unit.code.size())
+                           + " " + std::to_string(unit.locations.size()) + "\n";
+        for (const auto& location : unit.locations) {
+            output += (location.line ? std::to_string(static_cast<long long>(location.line) - base) : "-")
+                    + " " + location.kind + " " + shift(location.loops, -base) + "\n";
+        }
+        for (size_t i = 0; i < unit.code.size(); i++) {
+            output += std::to_string(unit.origins[i]) + " ";
+            long long operand;
+            if (LINKER.address(unit.code[i], operand)) {
+                long long offset;
+                Token* token = LINKER.token(operand, offset);
+                output += unit.code[i].substr(0, unit.code[i].find(' ')) + " @" + symbol(token);
+                if (offset != 0) {
+                    output += "@" + std::to_string(offset);
+                }
+            } else {
+                output += unit.code[i];
+            }
+            output += "\n";
+        }
+
+        // Write a temporary file first so that an interrupted compilation never leaves half a unit
+        std::string temporary = path(key) + ".tmp";
+        std::ofstream file(temporary, std::ios::binary);
+        if (!file.is_open()) {
+            return;
+        }
+        file << output;
+        file.close();
+        std::error_code error;
+        std::filesystem::rename(temporary, path(key), error);
+    }
+
+private:
+    static constexpr const char* VERSION = "imp-unit-4";
+
+    std::string directory;
+    long long hits = 0;
+    long long misses = 0;
+    std::unordered_map<std::string, Token*> symbols;
+
+    std::string path(const std::string& key) const {
+        return (std::filesystem::path(directory) / (key + ".unit")).string();
+    }
+
+    // Name of a token that does not depend on the order of procedures or the addresses
+    static std::string symbol(const Token* token) {
+        std::string value = token->getValue();
+        if (token->getType() == TokenType::NUMBER) {
+            return "=" + value;
+        }
+        if (token->getType() != TokenType::IDENTIFIER) {
+            return value;
+        }
+        if (token->getFunction() == TokenFunction::PROC) {
+            return value + ".";
+        }
+        size_t dash = value.find('-');
+        if (dash == std::string::npos) {
+            return "." + value;
+        }
+        return procs[std::stoll(value.substr(0, dash))]->getValue() + "." + value.substr(dash + 1);
+    }
+
+    // Token named by symbol, constants and generated cells are allocated when the program does not have them yet
+    Token* lookup(const std::string& name) {
+        if (symbols.empty()) {
+            for (auto token : ::tokens) {
+                symbols[symbol(token)] = token;
+            }
+        }
+
+        auto found = symbols.find(name);
+        if (found != symbols.end()) {
+            return found->second;
+        }
+
+        Token* token = nullptr;
+        size_t dot = name.find('.');
+        if (name[0] == '=') {
+            try {
+                token = constant_token(std::stoll(name.substr(1)));
+            } catch (const std::exception&) {
+                return nullptr;
+            }
+        } else if (dot != std::string::npos && dot + 1 < name.size() && name[dot + 1] == '~') {
+            for (size_t i = 0; i < procs.size(); i++) {
+                if (procs[i]->getValue() == name.substr(0, dot)) {
+                    token = hidden_token(std::to_string(i) + "-" + name.substr(dot + 1));
+                }
+            }
+        }
+
+        if (token) {
+            symbols[name] = token;
+        }
+        return token;
+    }
+
+    // Replaces a stored symbol with the relocatable address of its token
+    bool relocate(std::string& instruction) {
+        size_t at = instruction.find(" @");
+        if (at == std::string::npos) {
+            return true;
+        }
+
+        std::string reference = instruction.substr(at + 2);
+        size_t separator = reference.find('@');
+        long long offset = 0;
+        if (separator != std::string::npos) {
+            offset = std::stoll(reference.substr(separator + 1));
+            reference = reference.substr(0, separator);
+        }
+
+        Token* token = lookup(reference);
+        if (!token) {
+            return false;
+        }
+        instruction = instruction.substr(0, at + 1) + std::to_string(token->getAddress() + offset);
+        return true;
+    }
+
+    // Returns the next line of text starting at position, false at the end
+    static bool next(const std::string& text, size_t& position, std::string& line) {
+        if (position >= text.size()) {
+            return false;
+        }
+        size_t end = text.find('\n', position);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        line.assign(text, position, end - position);
+        position = end + 1;
+        return true;
+    }
+
+    bool parse(const std::string& text, const Node* procedure, Unit& unit) {
+        size_t position = 0;
+        std::string line;
+        if (!next(text, position, line) || line != VERSION || !next(text, position, line)) {
+            return false;
+        }
+
+        std::istringstream sizes(line);
+        size_t instructions = 0, locations = 0;
+        if (!(sizes >> unit.label >> instructions >> locations)) {
+            return false;
+        }
+
+        std::string name = procedure->children[0]->token->getValue();
+        for (size_t i = 0; i < locations; i++) {
+            if (!next(text, position, line)) {
+                return false;
+            }
+            unit.locations.push_back(place(line, name, procedure->line));
+        }
+
+        unit.code.reserve(instructions);
+        unit.origins.reserve(instructions);
+        for (size_t i = 0; i < instructions; i++) {
+            if (!next(text, position, line)) {
+                return false;
+            }
+            size_t space = line.find(' ');
+            if (space == std::string::npos) {
+                return false;
+            }
+            size_t origin = std::strtoull(line.c_str(), nullptr, 10);
+            line.erase(0, space + 1);
+            if (origin >= unit.locations.size() || !relocate(line)) {
+                return false;
+            }
+            unit.code.push_back(std::move(line));
+            unit.origins.push_back(origin);
+        }
+
+        return true;
+    }
+
+    // Moves the lines of loops like FORTO_COMMAND@4/WHILE_COMMAND@10 by delta
+    static std::string shift(const std::string& loops, long long delta) {
+        if (loops == "-") {
+            return loops;
+        }
+
+        std::string shifted;
+        std::istringstream input(loops);
+        std::string loop;
+        while (std::getline(input, loop, '/')) {
+            size_t at = loop.find('@');
+            shifted += (shifted.empty() ? "" : "/") + loop.substr(0, at + 1) + std::to_string(std::stoll(loop.substr(at + 1)) + delta);
+        }
+        return shifted;
+    }
+
+    static SourceLocation place(const std::string& stored, const std::string& procedure, unsigned long long base) {
+        std::istringstream input(stored);
+        std::string line;
+        SourceLocation location;
+        input >> line >> location.kind >> location.loops;
+        location.line = line == "-" ? 0 : std::stoll(line) + base;
+        location.procedure = procedure;
+        location.loops = shift(location.loops, base);
+        return location;
+    }
+
+    static void serialize(const Node* node, std::ostream& output) {
+        output << "(" << node->getNodeType();
+        if (node->token) {
+            output << " " << static_cast<int>(node->token->getType()) << " " << static_cast<int>(node->token->getFunction())
+                   << " " << symbol(node->token);
+            if (node->kind == NodeKind::PROC_CALL) {
+                for (auto arg : node->token->getArgs()) {          // Signature of the callee
+                    output << " " << static_cast<int>(arg->getFunction()) << " " << symbol(arg);
+                }
+            }
+        }
+        for (auto listed : node->tokens) {                           // Declarations and arguments
+            output << " " << static_cast<int>(listed->getFunction()) << " " << symbol(listed);
+        }
+        for (auto child : node->children) {
+            serialize(child, output);
+        }
+        output << ")";
+    }
+};
+
+#endif // UNIT_CACHE_HPP
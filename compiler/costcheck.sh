@@ -0,0 +1,99 @@
+#!/bin/sh
+# Compiles the example programs bundled in labor4.zip, runs them on fixed inputs
+# in the VM, checks their outputs and compares code size and cost with the
+# baseline kept in costcheck.baseline.
+#
+# Usage: ./costcheck.sh [--update]
+#   --update              Rewrite costcheck.baseline with the current results.
+#   COSTCHECK_THRESHOLD   Allowed growth of instructions or cost in percent (default 1).
+
+cd "$(dirname "$0")" || exit 1
+
+CASES=costcheck.cases
+BASELINE=costcheck.baseline
+ZIP=../labor4.zip
+THRESHOLD=${COSTCHECK_THRESHOLD:-1}
+UPDATE=0
+[ "$1" = "--update" ] && UPDATE=1
+
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+unzip -q "$ZIP" -d "$WORK/src" || exit 1
+
+FAILED=0
+RESULTS="$WORK/results"
+: > "$RESULTS"
+
+while IFS='|' read -r name source inputs expected; do
+    case "$name" in ''|\#*) continue ;; esac
+
+    if ! ./compiler "$WORK/src/$source" "$WORK/$name.mr" > "$WORK/$name.log" 2>&1; then
+        if [ "$expected" = "ERROR" ]; then
+            echo "ok      $name (rejected as expected)"
+        else
+            echo "FAIL    $name: compilation failed, see output below"
+            tail -n 5 "$WORK/$name.log"
+            FAILED=1
+        fi
+        continue
+    fi
+
+    if [ "$expected" = "ERROR" ]; then
+        echo "FAIL    $name: compiled but should have been rejected"
+        FAILED=1
+        continue
+    fi
+
+    # shellcheck disable=SC2086
+    printf '%s\n' $inputs | ./vm "$WORK/$name.mr" > "$WORK/$name.out" 2>&1
+    outputs=$(grep -o '> -\{0,1\}[0-9]*' "$WORK/$name.out" | sed 's/> //' | tr '\n' ' ' | sed 's/ $//')
+    if [ "$outputs" != "$expected" ]; then
+        echo "FAIL    $name: expected '$expected', got '$outputs'"
+        FAILED=1
+        continue
+    fi
+
+    # Finished (cost: C; i/o: IO; instructions: N).
+    sed -n 's/^Finished (cost: \([0-9]*\); i\/o: \([0-9]*\); instructions: \([0-9]*\)).*/\3 \1 \2/p' "$WORK/$name.out" \
+        | { read -r instructions cost io; echo "$name $instructions $cost $io"; } >> "$RESULTS"
+done < "$CASES"
+
+if [ "$UPDATE" = 1 ]; then
+    if [ "$FAILED" = 1 ]; then
+        echo "Not updating $BASELINE, some programs failed."
+        exit 1
+    fi
+    { echo "# name instructions cost io"; cat "$RESULTS"; } > "$BASELINE"
+    echo "Updated $BASELINE."
+    exit 0
+fi
+
+# Compare with the baseline and print per-program deltas.
+awk -v threshold="$THRESHOLD" '
+    function delta(new, old) { return old == 0 ? 0 : (new - old) * 100.0 / old }
+    NR == FNR { if ($1 !~ /^#/) { base[$1] = 1; instr[$1] = $2; cost[$1] = $3; io[$1] = $4 } next }
+    FNR == 1 {
+        printf "%-14s %12s %9s %14s %9s %10s\n", "program", "instructions", "delta", "cost", "delta", "i/o"
+    }
+    {
+        if (!($1 in base)) {
+            printf "%-14s %12d %9s %14d %9s %10d  (not in baseline)\n", $1, $2, "-", $3, "-", $4
+            next
+        }
+        di = delta($2, instr[$1]); dc = delta($3, cost[$1])
+        status = (di > threshold || dc > threshold || $4 != io[$1]) ? "  REGRESSION" : ""
+        if (status != "") failed = 1
+        printf "%-14s %12d %+8.2f%% %14d %+8.2f%% %10d%s\n", $1, $2, di, $3, dc, $4, status
+        total_instr += $2; total_cost += $3; old_instr += instr[$1]; old_cost += cost[$1]
+    }
+    END {
+        printf "%-14s %12d %+8.2f%% %14d %+8.2f%%\n", "total", total_instr, delta(total_instr, old_instr), total_cost, delta(total_cost, old_cost)
+        exit failed
+    }
+' "$BASELINE" "$RESULTS" || FAILED=1
+
+if [ "$FAILED" = 1 ]; then
+    echo "costcheck failed (threshold ${THRESHOLD}%)."
+    exit 1
+fi
+echo "costcheck passed."
@@ -0,0 +1,787 @@
+// Differential fuzzer for the compiler.
+//
+// Generates random well-typed .imp programs and inputs for them, compiles every program at several
+// optimization levels, runs the results in the VM and compares what they write with the output of
+// the first level. Reports the cost of every level relative to the first one and shrinks every
+// program that fails, or that some level runs more than --max-ratio times as expensively as the first,
+// to a minimal one that still fails the same way. --replay checks saved programs instead, such as the
+// regression programs kept in regressions/.
+//
+// Generated programs always terminate and stay within the VM's numbers: WHILE and REPEAT loops count
+// a counter nothing else touches down to zero or up to a bound, FOR loops run over at most the 8
+// elements every table has, and every +, - and * result is brought back into a small range with %.
+// Procedures only call the ones declared before them. Tables are indexed by constants, FOR iterators,
+// counters of WHILE loops and scalars brought into bounds with %. READ appears anywhere, also into the
+// formals of procedures; what a READ past the end of the input leaves depends on the level, so such
+// runs are not compared.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// One command of a generated program, compound ones hold their nested commands
+struct Command {
+    std::vector<std::string> head;      // Lines before the first block, or the whole command
+    std::vector<Command> body;
+    std::vector<std::string> middle;    // Lines between the blocks, ELSE
+    std::vector<Command> other;
+    std::vector<std::string> tail;      // Lines after the last block
+    bool pinned = false;                // Initialization, the minimizer keeps it
+};
+
+struct Procedure {
+    std::string name;
+    std::vector<bool> tables;           // Whether every formal is a table
+    std::vector<std::string> formals;
+    std::vector<std::string> declarations;
+    std::vector<Command> commands;
+};
+
+struct Program {
+    std::vector<Procedure> procedures;
+    std::vector<std::string> declarations;
+    std::vector<Command> commands;
+    long long reads = 0;                // READ commands at the top of main, others may run any number of times
+};
+
+// Variables a command may use
+struct Scope {
+    std::vector<std::string> scalars;   // Assignable and passable
+    std::vector<std::string> tables;
+    std::vector<std::string> iterators; // Readable, always a valid index
+    std::vector<std::string>* counters; // Declarations receiving the counters of the loops
+};
+
+class Generator {
+public:
+    static constexpr long long SIZE = 8;    // Elements of every table
+    static constexpr long long EXTRA_INPUTS = 256;
+
+    explicit Generator(unsigned long long seed) : random(seed) {}
+
+    Program program() {
+        Program result;
+        low = pick(-4, 4);
+        long long procedures = pick(0, 3);
+        for (long long i = 0; i < procedures; i++) {
+            result.procedures.push_back(procedure(result.procedures));
+        }
+
+        Scope scope;
+        scope.counters = &result.declarations;
+        long long scalars = pick(2, 4);
+        for (long long i = 0; i < scalars; i++) {
+            std::string name = fresh("v");
+            result.declarations.push_back(name);
+            scope.scalars.push_back(name);
+            Command init;
+            init.pinned = true;
+            if (chance(50)) {
+                init.head.push_back("READ " + name + ";");
+                result.reads++;
+            } else {
+                init.head.push_back(name + " := " + number() + ";");
+            }
+            result.commands.push_back(init);
+        }
+        long long tables = pick(1, 2);
+        for (long long i = 0; i < tables; i++) {
+            std::string name = fresh("t");
+            result.declarations.push_back(name + "[" + std::to_string(low) + ":" + std::to_string(low + SIZE - 1) + "]");
+            scope.tables.push_back(name);
+            result.commands.push_back(fill(name, scope));
+        }
+        callable = &result.procedures;
+        available = result.procedures.size();
+        long long count = pick(4, 12);
+        for (long long i = 0; i < count; i++) {
+            result.commands.push_back(command(scope, 0));
+        }
+        for (const auto& name : scope.scalars) {
+            Command write;
+            write.head.push_back("WRITE " + name + ";");
+            result.commands.push_back(write);
+        }
+        return result;
+    }
+
+    // Values for the READ commands of program, with some for the ones in loops and procedures
+    std::vector<long long> inputs(const Program& program) {
+        std::vector<long long> values;
+        for (long long i = 0; i < program.reads + EXTRA_INPUTS; i++) {
+            values.push_back(chance(20) ? pick(-1000000, 1000000) : pick(-50, 50));
+        }
+        return values;
+    }
+
+private:
+    std::mt19937_64 random;
+    long long names = 0;
+    long long low = 0;                  // First index of every table
+    const std::vector<Procedure>* callable = nullptr;
+    size_t available = 0;               // Procedures the commands being generated may call
+
+    long long pick(long long lo, long long hi) {
+        return std::uniform_int_distribution<long long>(lo, hi)(random);
+    }
+
+    bool chance(long long percent) {
+        return pick(1, 100) <= percent;
+    }
+
+    template <typename T>
+    const T& any(const std::vector<T>& values) {
+        return values[pick(0, values.size() - 1)];
+    }
+
+    // Identifiers are lowercase letters only
+    std::string fresh(const std::string& prefix) {
+        std::string name;
+        for (long long n = names++; ; n = n / 26 - 1) {
+            name.insert(name.begin(), static_cast<char>('a' + n % 26));
+            if (n < 26) {
+                break;
+            }
+        }
+        return prefix + name;
+    }
+
+    std::string number() {
+        if (chance(10)) {
+            return std::to_string(pick(-1000000000, 1000000000));
+        }
+        return std::to_string(pick(-20, 20));
+    }
+
+    std::string index(const Scope& scope) {
+        if (!scope.iterators.empty() && chance(60)) {
+            return any(scope.iterators);
+        }
+        return std::to_string(pick(low, low + SIZE - 1));
+    }
+
+    std::string value(const Scope& scope) {
+        long long kind = pick(1, 100);
+        if (kind <= 30) {
+            return number();
+        }
+        if (kind <= 45 && !scope.iterators.empty()) {
+            return any(scope.iterators);
+        }
+        if (kind <= 70 && !scope.tables.empty()) {
+            return any(scope.tables) + "[" + index(scope) + "]";
+        }
+        return any(scope.scalars);
+    }
+
+    std::string target(const Scope& scope) {
+        if (!scope.tables.empty() && chance(35)) {
+            return any(scope.tables) + "[" + index(scope) + "]";
+        }
+        return any(scope.scalars);
+    }
+
+    std::string condition(const Scope& scope) {
+        static const std::vector<std::string> relations = {"=", "!=", ">", "<", ">=", "<="};
+        return value(scope) + " " + any(relations) + " " + value(scope);
+    }
+
+    // Sets every element of a table, so that no level reads memory the program never wrote
+    Command fill(const std::string& table, Scope& scope) {
+        std::string iterator = fresh("i");
+        Command loop;
+        loop.pinned = true;
+        loop.head.push_back("FOR " + iterator + " FROM " + std::to_string(low) + " TO " + std::to_string(low + SIZE - 1) + " DO");
+        Command set;
+        set.pinned = true;
+        set.head.push_back(table + "[" + iterator + "] := " + iterator + " * " + std::to_string(pick(-9, 9)) + ";");
+        loop.body.push_back(set);
+        loop.tail.push_back("ENDFOR");
+        return loop;
+    }
+
+    Command assignment(const Scope& scope) {
+        static const std::vector<std::string> operators = {"+", "-", "*", "/", "%"};
+        static const std::vector<long long> moduli = {7, 97, 1009, 65537, -13, -1009};
+        Command command;
+        std::string name = target(scope);
+        if (chance(20)) {
+            command.head.push_back(name + " := " + value(scope) + ";");
+            return command;
+        }
+        std::string operation = any(operators);
+        command.head.push_back(name + " := " + value(scope) + " " + operation + " " + value(scope) + ";");
+        if (operation == "+" || operation == "-" || operation == "*") {
+            command.head.push_back(name + " := " + name + " % " + std::to_string(any(moduli)) + ";");  // Keep it small
+        }
+        return command;
+    }
+
+    // Accesses a table at a scalar brought into its bounds, the index is a counter nothing else writes
+    Command indexed(const Scope& scope) {
+        static const std::vector<long long> moduli = {7, 97, 1009};
+        std::string counter = fresh("c");
+        scope.counters->push_back(counter);
+        std::string table = any(scope.tables);
+        std::string element = table + "[" + counter + "]";
+        Command command;
+        command.head.push_back(counter + " := " + any(scope.scalars) + " % " + std::to_string(SIZE) + ";");
+        command.head.push_back(counter + " := " + counter + " + " + std::to_string(low) + ";");
+        if (chance(50)) {
+            command.head.push_back(element + " := " + element + " + " + value(scope) + ";");
+            command.head.push_back(element + " := " + element + " % " + std::to_string(any(moduli)) + ";");
+        } else {
+            command.head.push_back(any(scope.scalars) + " := " + element + " / " + value(scope) + ";");
+        }
+        return command;
+    }
+
+    Command read(const Scope& scope) {
+        Command command;
+        command.head.push_back("READ " + target(scope) + ";");
+        return command;
+    }
+
+    Command call(const Scope& scope) {
+        const Procedure& callee = (*callable)[pick(0, available - 1)];
+        std::string arguments;
+        for (size_t i = 0; i < callee.formals.size(); i++) {
+            arguments += (i ? ", " : "") + (callee.tables[i] ? any(scope.tables) : any(scope.scalars));
+        }
+        Command command;
+        command.head.push_back(callee.name + "(" + arguments + ");");
+        return command;
+    }
+
+    void block(std::vector<Command>& commands, Scope& scope, long long depth) {
+        long long count = pick(1, 4);
+        for (long long i = 0; i < count; i++) {
+            commands.push_back(command(scope, depth + 1));
+        }
+    }
+
+    Command command(Scope& scope, long long depth) {
+        long long kind = depth >= 3 ? pick(1, 50) : pick(1, 100);
+        Command command;
+        if (kind <= 27) {
+            return assignment(scope);
+        }
+        if (kind <= 31) {
+            return read(scope);
+        }
+        if (kind <= 35) {
+            return scope.tables.empty() ? assignment(scope) : indexed(scope);
+        }
+        if (kind <= 45) {
+            command.head.push_back("WRITE " + value(scope) + ";");
+            return command;
+        }
+        if (kind <= 50 && available > 0 && !(scope.tables.empty() && std::any_of(callable->begin(), callable->begin() + available,
+                                                                                [](const Procedure& p) { return std::count(p.tables.begin(), p.tables.end(), true) > 0; }))) {
+            return call(scope);
+        }
+        if (kind <= 50) {
+            return assignment(scope);
+        }
+        if (kind <= 65) {
+            command.head.push_back("IF " + condition(scope) + " THEN");
+            block(command.body, scope, depth);
+            if (chance(50)) {
+                command.middle.push_back("ELSE");
+                block(command.other, scope, depth);
+            }
+            command.tail.push_back("ENDIF");
+            return command;
+        }
+        if (kind <= 82) {
+            std::string iterator = fresh("i");
+            std::string first = std::to_string(pick(low, low + SIZE - 1));
+            std::string last = std::to_string(pick(low, low + SIZE - 1));
+            if (chance(30) && !scope.scalars.empty()) {
+                // A bound only known at runtime, still within the tables
+                std::string counter = fresh("c");
+                scope.counters->push_back(counter);
+                command.head.push_back(counter + " := " + any(scope.scalars) + " % " + std::to_string(SIZE) + ";");
+                command.head.push_back(counter + " := " + counter + " + " + std::to_string(low) + ";");
+                first = counter;
+            }
+            bool down = chance(40);
+            command.head.push_back("FOR " + iterator + " FROM " + (down ? last : first) + (down ? " DOWNTO " : " TO ") + (down ? first : last) + " DO");
+            scope.iterators.push_back(iterator);
+            block(command.body, scope, depth);
+            scope.iterators.pop_back();
+            command.tail.push_back("ENDFOR");
+            return command;
+        }
+        std::string counter = fresh("c");
+        scope.counters->push_back(counter);
+        if (kind <= 86) {
+            // Counts up over elements of the tables, possibly none, the body may index them by the counter
+            long long first = pick(low, low + SIZE - 1);
+            command.head.push_back(counter + " := " + std::to_string(first) + ";");
+            command.head.push_back("WHILE " + counter + " <= " + std::to_string(pick(first - 1, low + SIZE - 1)) + " DO");
+            scope.iterators.push_back(counter);
+            block(command.body, scope, depth);
+            scope.iterators.pop_back();
+            command.tail.push_back(counter + " := " + counter + " + 1;");
+            command.tail.push_back("ENDWHILE");
+            return command;
+        }
+        if (kind <= 91) {
+            command.head.push_back(counter + " := " + std::to_string(pick(0, 4)) + ";");
+            command.head.push_back("WHILE " + counter + " > 0 DO");
+            block(command.body, scope, depth);
+            command.tail.push_back(counter + " := " + counter + " - 1;");
+            command.tail.push_back("ENDWHILE");
+            return command;
+        }
+        command.head.push_back(counter + " := " + std::to_string(pick(1, 4)) + ";");
+        command.head.push_back("REPEAT");
+        block(command.body, scope, depth);
+        command.tail.push_back(counter + " := " + counter + " - 1;");
+        command.tail.push_back("UNTIL " + counter + " <= 0;");
+        return command;
+    }
+
+    Procedure procedure(const std::vector<Procedure>& earlier) {
+        Procedure result;
+        result.name = fresh("p");
+        Scope scope;
+        scope.counters = &result.declarations;
+
+        long long formals = pick(1, 3);
+        for (long long i = 0; i < formals; i++) {
+            bool table = chance(30);
+            std::string name = fresh(table ? "t" : "a");
+            result.tables.push_back(table);
+            result.formals.push_back(name);
+            (table ? scope.tables : scope.scalars).push_back(name);
+        }
+        long long locals = pick(0, 2);
+        for (long long i = 0; i < locals || scope.scalars.empty(); i++) {
+            std::string name = fresh("l");
+            result.declarations.push_back(name);
+            scope.scalars.push_back(name);
+            Command init;
+            init.pinned = true;
+            init.head.push_back(name + " := " + number() + ";");
+            result.commands.push_back(init);
+        }
+        if (chance(30)) {
+            std::string name = fresh("t");
+            result.declarations.push_back(name + "[" + std::to_string(low) + ":" + std::to_string(low + SIZE - 1) + "]");
+            scope.tables.push_back(name);
+            result.commands.push_back(fill(name, scope));
+        }
+
+        callable = &earlier;
+        available = earlier.size();
+        long long count = pick(1, 6);
+        for (long long i = 0; i < count; i++) {
+            result.commands.push_back(command(scope, 1));
+        }
+        return result;
+    }
+};
+
+void render(std::ostringstream& out, const std::vector<Command>& commands, int indent) {
+    std::string pad(indent * 2, ' ');
+    for (const auto& command : commands) {
+        for (const auto& line : command.head) {
+            out << pad << line << "\n";
+        }
+        render(out, command.body, indent + 1);
+        for (const auto& line : command.middle) {
+            out << pad << line << "\n";
+        }
+        render(out, command.other, indent + 1);
+        for (const auto& line : command.tail) {
+            out << pad << line << "\n";
+        }
+    }
+}
+
+std::string join(const std::vector<std::string>& names) {
+    std::string text;
+    for (size_t i = 0; i < names.size(); i++) {
+        text += (i ? ", " : "") + names[i];
+    }
+    return text;
+}
+
+std::string render(const Program& program) {
+    std::ostringstream out;
+    for (const auto& procedure : program.procedures) {
+        std::vector<std::string> formals;
+        for (size_t i = 0; i < procedure.formals.size(); i++) {
+            formals.push_back((procedure.tables[i] ? "T " : "") + procedure.formals[i]);
+        }
+        out << "PROCEDURE " << procedure.name << "(" << join(formals) << ") IS\n";
+        if (!procedure.declarations.empty()) {
+            out << "  " << join(procedure.declarations) << "\n";
+        }
+        out << "BEGIN\n";
+        render(out, procedure.commands, 1);
+        out << "END\n\n";
+    }
+    out << "PROGRAM IS\n";
+    if (!program.declarations.empty()) {
+        out << "  " << join(program.declarations) << "\n";
+    }
+    out << "BEGIN\n";
+    render(out, program.commands, 1);
+    out << "END\n";
+    return out.str();
+}
+
+long long lines(const std::string& text) {
+    return std::count(text.begin(), text.end(), '\n');
+}
+
+// What a program did when compiled with one setting
+struct Outcome {
+    enum Status { OK, COMPILE_ERROR, VM_ERROR } status = OK;
+    std::vector<long long> outputs;
+    long long cost = 0;
+    long long reads = 0;
+};
+
+class Harness {
+public:
+    std::string compiler = "./compiler";
+    std::string vm = "./vm";
+    std::vector<std::string> levels = {"-O0", "-O1", "-O2", "-Os"};
+    std::filesystem::path work;
+    long long timeout = 20;     // Seconds a compilation or run may take
+    double maxRatio = 1.2;      // Cost against the first level above which a run fails, 0 never fails
+
+    Outcome run(const std::string& source, const std::vector<long long>& inputs, const std::string& level) {
+        std::ofstream(work / "program.imp") << source;
+        std::ofstream input(work / "input.txt");
+        for (long long value : inputs) {
+            input << value << "\n";
+        }
+        input.close();
+
+        Outcome outcome;
+        std::filesystem::remove(work / "program.mr");
+        std::string compile = "timeout " + std::to_string(timeout) + " " + compiler + " " + quoted(work / "program.imp") + " "
+                            + quoted(work / "program.mr") + " --quiet " + level + " > " + quoted(work / "compile.log") + " 2>&1";
+        if (std::system(compile.c_str()) != 0 || !std::filesystem::exists(work / "program.mr")) {
+            outcome.status = Outcome::COMPILE_ERROR;
+            return outcome;
+        }
+
+        std::string execute = "timeout " + std::to_string(timeout) + " " + vm + " " + quoted(work / "program.mr") + " < "
+                            + quoted(work / "input.txt") + " > " + quoted(work / "run.log") + " 2>&1";
+        int status = std::system(execute.c_str());
+        std::ifstream log(work / "run.log");
+        std::string line;
+        bool finished = false;
+        while (std::getline(log, line)) {
+            for (size_t read = line.find("? "); read != std::string::npos; read = line.find("? ", read + 2)) {
+                outcome.reads++;
+            }
+            size_t prompt = line.find("> ");
+            if (prompt != std::string::npos && line.find("Finished") == std::string::npos) {
+                outcome.outputs.push_back(std::atoll(line.c_str() + prompt + 2));
+            }
+            size_t cost = line.find("Finished (cost: ");
+            if (cost != std::string::npos) {
+                outcome.cost = std::atoll(line.c_str() + cost + 16);
+                finished = true;
+            }
+        }
+        if (status != 0 || !finished) {
+            outcome.status = Outcome::VM_ERROR;
+        }
+        return outcome;
+    }
+
+    // Empty if every level agrees with the first, otherwise the first level that does not and how
+    std::string check(const std::string& source, const std::vector<std::vector<long long>>& inputs,
+                      std::vector<std::vector<long long>>* costs = nullptr) {
+        for (const auto& vector : inputs) {
+            Outcome reference = run(source, vector, levels[0]);
+            if (reference.status != Outcome::OK) {
+                return reference.status == Outcome::COMPILE_ERROR ? "invalid at " + levels[0] : "vm error at " + levels[0];
+            }
+            if (reference.reads > static_cast<long long>(vector.size())) {
+                continue;   // Ran out of input
+            }
+            std::vector<long long> row = {reference.cost};
+            for (size_t i = 1; i < levels.size(); i++) {
+                Outcome outcome = run(source, vector, levels[i]);
+                if (outcome.status == Outcome::COMPILE_ERROR) {
+                    return "compile error at " + levels[i];
+                }
+                if (outcome.status == Outcome::VM_ERROR) {
+                    return "vm error at " + levels[i];
+                }
+                if (outcome.outputs != reference.outputs) {
+                    return "output mismatch at " + levels[i];
+                }
+                if (maxRatio > 0 && outcome.cost > maxRatio * reference.cost) {
+                    return "costlier than " + levels[0] + " at " + levels[i];
+                }
+                row.push_back(outcome.cost);
+            }
+            if (costs) {
+                costs->push_back(row);
+            }
+        }
+        return "";
+    }
+
+private:
+    static std::string quoted(const std::filesystem::path& path) {
+        return "'" + path.string() + "'";
+    }
+};
+
+// Removes commands and unwraps compound ones as long as the program keeps failing the same way
+class Minimizer {
+public:
+    Minimizer(Harness& harness, const std::vector<std::vector<long long>>& inputs, const std::string& failure)
+        : harness(harness), inputs(inputs), failure(failure) {}
+
+    void run(Program& program) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto& procedure : program.procedures) {
+                changed |= reduce(program, procedure.commands);
+            }
+            changed |= reduce(program, program.commands);
+            for (size_t i = program.procedures.size(); i-- > 0;) {
+                Program smaller = program;
+                smaller.procedures.erase(smaller.procedures.begin() + i);
+                if (fails(smaller)) {
+                    program = smaller;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+private:
+    Harness& harness;
+    const std::vector<std::vector<long long>>& inputs;
+    std::string failure;
+
+    bool fails(const Program& program) {
+        return harness.check(render(program), inputs) == failure;
+    }
+
+    bool reduce(Program& program, std::vector<Command>& commands) {
+        bool changed = false;
+        for (size_t i = commands.size(); i-- > 0;) {
+            if (!commands[i].pinned) {
+                Command removed = commands[i];
+                commands.erase(commands.begin() + i);
+                if (fails(program)) {
+                    changed = true;
+                    continue;
+                }
+                commands.insert(commands.begin() + i, removed);
+
+                // Keep only the blocks of a compound command
+                std::vector<Command> inner = removed.body;
+                inner.insert(inner.end(), removed.other.begin(), removed.other.end());
+                if (!inner.empty()) {
+                    commands.erase(commands.begin() + i);
+                    commands.insert(commands.begin() + i, inner.begin(), inner.end());
+                    if (fails(program)) {
+                        changed = true;
+                        continue;
+                    }
+                    commands.erase(commands.begin() + i, commands.begin() + i + inner.size());
+                    commands.insert(commands.begin() + i, removed);
+                }
+            }
+            changed |= reduce(program, commands[i].body);
+            changed |= reduce(program, commands[i].other);
+        }
+        return changed;
+    }
+};
+
+// Checks every saved program of directory against the inputs next to it, one vector per line of <name>.in
+long long replay(Harness& harness, const std::string& directory) {
+    std::vector<std::filesystem::path> sources;
+    if (!std::filesystem::is_directory(directory)) {
+        std::cerr << "No directory " << directory << std::endl;
+        return 1;
+    }
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        if (entry.path().extension() == ".imp") {
+            sources.push_back(entry.path());
+        }
+    }
+    std::sort(sources.begin(), sources.end());
+
+    long long failed = 0;
+    for (const auto& source : sources) {
+        std::ifstream file(source);
+        std::stringstream text;
+        text << file.rdbuf();
+
+        std::vector<std::vector<long long>> inputs;
+        std::ifstream input(std::filesystem::path(source).replace_extension(".in"));
+        std::string line;
+        while (std::getline(input, line)) {
+            std::istringstream values(line);
+            std::vector<long long> vector;
+            long long value;
+            while (values >> value) {
+                vector.push_back(value);
+            }
+            inputs.push_back(vector);
+        }
+        if (inputs.empty()) {
+            inputs.emplace_back();
+        }
+
+        std::string failure = harness.check(text.str(), inputs);
+        std::cout << (failure.empty() ? "ok      " : "FAIL    ") << source.filename().string()
+                  << (failure.empty() ? "" : ": " + failure) << std::endl;
+        failed += !failure.empty();
+    }
+    std::cout << sources.size() << " programs, " << failed << " failed" << std::endl;
+    return failed;
+}
+
+std::vector<std::string> split(const std::string& text) {
+    std::vector<std::string> parts;
+    std::istringstream input(text);
+    std::string part;
+    while (std::getline(input, part, ',')) {
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+int main(int argc, char* argv[]) {
+    long long runs = 100;
+    unsigned long long seed = 1;
+    long long vectors = 2;
+    std::string failures = "fuzz-failures";
+    std::string replayed;
+    Harness harness;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = std::atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--inputs") == 0 && i + 1 < argc) {
+            vectors = std::max(1LL, std::atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--levels") == 0 && i + 1 < argc) {
+            harness.levels = split(argv[++i]);
+        } else if (strcmp(argv[i], "--compiler") == 0 && i + 1 < argc) {
+            harness.compiler = argv[++i];
+        } else if (strcmp(argv[i], "--vm") == 0 && i + 1 < argc) {
+            harness.vm = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            failures = argv[++i];
+        } else if (strcmp(argv[i], "--max-ratio") == 0 && i + 1 < argc) {
+            harness.maxRatio = std::atof(argv[++i]);
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayed = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--runs <n>] [--seed <n>] [--inputs <n>] [--levels -O0,-O1,-O2,-Os]"
+                      << " [--compiler <path>] [--vm <path>] [--out <dir>] [--max-ratio <r>] [--replay <dir>]" << std::endl;
+            return 1;
+        }
+    }
+    if (harness.levels.size() < 2) {
+        std::cerr << "Error: --levels needs at least two settings" << std::endl;
+        return 1;
+    }
+
+    harness.work = std::filesystem::temp_directory_path() / ("impfuzz-" + std::to_string(seed));
+    std::filesystem::create_directories(harness.work);
+
+    if (!replayed.empty()) {
+        long long failed = replay(harness, replayed);
+        std::filesystem::remove_all(harness.work);
+        return failed > 0 ? 1 : 0;
+    }
+
+    long long failed = 0;
+    std::vector<double> logRatios(harness.levels.size(), 0.0);
+    std::vector<double> worst(harness.levels.size(), 0.0);
+    std::vector<double> best(harness.levels.size(), 1e300);
+    std::vector<long long> costlier(harness.levels.size(), 0);
+    long long measured = 0;
+
+    for (long long run = 0; run < runs; run++) {
+        unsigned long long programSeed = seed + run;
+        Generator generator(programSeed);
+        Program program = generator.program();
+        std::vector<std::vector<long long>> inputs;
+        for (long long i = 0; i < vectors; i++) {
+            inputs.push_back(generator.inputs(program));
+        }
+
+        std::vector<std::vector<long long>> costs;
+        std::string failure = harness.check(render(program), inputs, &costs);
+        if (!failure.empty()) {
+            long long before = lines(render(program));
+            Minimizer(harness, inputs, failure).run(program);
+            std::string source = render(program);
+
+            std::filesystem::create_directories(failures);
+            std::string base = failures + "/seed-" + std::to_string(programSeed);
+            std::ofstream(base + ".imp") << source;
+            std::ofstream input(base + ".in");
+            for (const auto& vector : inputs) {
+                for (long long value : vector) {
+                    input << value << " ";
+                }
+                input << "\n";
+            }
+            std::cout << "FAIL    seed " << programSeed << ": " << failure << ", minimized from " << before << " to "
+                      << lines(source) << " lines in " << base << ".imp" << std::endl;
+            failed++;
+            continue;
+        }
+
+        for (const auto& row : costs) {
+            measured++;
+            for (size_t i = 1; i < row.size(); i++) {
+                double ratio = row[0] > 0 ? static_cast<double>(row[i]) / row[0] : 1.0;
+                logRatios[i] += std::log(std::max(ratio, 1e-9));
+                worst[i] = std::max(worst[i], ratio);
+                best[i] = std::min(best[i], ratio);
+                costlier[i] += row[i] > row[0];
+            }
+        }
+    }
+    std::filesystem::remove_all(harness.work);
+
+    std::cout << runs << " programs, " << failed << " failed, " << measured << " runs compared" << std::endl;
+    if (measured > 0) {
+        std::cout << std::left << std::setw(10) << "level" << std::right << std::setw(14) << "cost ratio" << std::setw(10) << "best"
+                  << std::setw(10) << "worst" << std::setw(10) << "costlier" << "   (against " << harness.levels[0] << ")" << std::endl;
+        for (size_t i = 1; i < harness.levels.size(); i++) {
+            std::cout << std::left << std::setw(10) << harness.levels[i] << std::right << std::fixed << std::setprecision(3)
+                      << std::setw(14) << std::exp(logRatios[i] / measured) << std::setw(10) << best[i]
+                      << std::setw(10) << worst[i] << std::setw(10) << costlier[i] << std::endl;
+        }
+    }
+
+    return failed > 0 ? 1 : 0;
+}
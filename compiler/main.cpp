@@ -1,39 +1,162 @@
 #include "Token.hpp"
 #include "Node.hpp"
+#include "Options.hpp"
+#include "Statistics.hpp"
+#include "ErrorHandler.hpp"
+#include "Server.hpp"
+#include "PassManager.hpp"
+#include "Profile.hpp"
 #include <iostream>
 #include <cstdio>
 #include <cstring>
+#include <cstdlib>
 #include <filesystem>
+#include <new>
 #include "parser.tab.h"
 #include "lex.yy.h"
 
 std::string parsedFileName;
 std::string outputFileName;
 
+// Allocations are counted for --stats
+void* operator new(std::size_t size) {
+    if (OPTIONS.stats) {
+        Statistics::allocations.fetch_add(1, std::memory_order_relaxed);
+        Statistics::allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+// Parses a non-negative numeric option value
+bool parseCount(const char* text, long long& value) {
+    char* end = nullptr;
+    value = std::strtoll(text, &end, 10);
+    return end != text && *end == '\0' && value >= 0;
+}
+
+// Reports what --time-passes and --stats collected
+void reportStatistics() {
+    // Reports go to standard error, away from the compiler's progress output
+    if (OPTIONS.timePasses || OPTIONS.stats) {
+        STATS.report(std::cerr, OPTIONS.statsJson);
+    }
+}
+
 int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        std::cerr << "Usage: " << argv[0] << " <source-file> <output-file> [-t]" << std::endl;
+    bool serving = argc >= 2 && strcmp(argv[1], "--serve") == 0;
+    if (argc < 3 && !serving) {
+        std::cerr << "Usage: " << argv[0] << " <source-file> <output-file> [-t] [--map] [--binary] [--quiet] [--unroll-budget <n>] [--unroll-factor <n>] [--cache <dir>] [--jobs <n>] [--max-errors <n>] [--eval-fuel <n>] [--eval-size <n>] [-O0|-O1|-O2|-Os] [--disable-pass <name>] [--print-after <name>] [--profile-generate] [--profile-use <file>] [--time-passes] [--stats] [--cost-report] [--stats-format text|json]" << std::endl;
+        std::cerr << "       " << argv[0] << " --serve [<socket>] [options]" << std::endl;
         return 1;
     }
 
-    std::filesystem::path path(argv[1]);
-    if (path.extension() != ".imp") {
-        std::cerr << "Error: Input file must have a .imp extension" << std::endl;
-        return 1;
+    int first = 3;      // First option
+    std::string socketPath;
+    if (serving) {
+        first = 2;
+        if (argc > 2 && argv[2][0] != '-') {
+            socketPath = argv[first++];
+        }
+    } else {
+        std::filesystem::path path(argv[1]);
+        if (path.extension() != ".imp") {
+            std::cerr << "Error: Input file must have a .imp extension" << std::endl;
+            return 1;
+        }
+
+        parsedFileName = path.filename().string();
+        outputFileName = argv[2];
+
+        std::filesystem::path outputPath(outputFileName);
+        if (outputPath.extension() != ".mr") {
+            outputFileName += ".mr";
+        }
     }
 
-    parsedFileName = path.filename().string();
-    outputFileName = argv[2];
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            OPTIONS.printTokens = true;
+        } else if (strcmp(argv[i], "--map") == 0) {
+            OPTIONS.sourceMap = true;
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            OPTIONS.binary = true;
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            OPTIONS.quiet = true;
+        } else if (strcmp(argv[i], "--unroll-budget") == 0 && i + 1 < argc && parseCount(argv[i + 1], OPTIONS.unrollBudget)) {
+            i++;
+        } else if (strcmp(argv[i], "--unroll-factor") == 0 && i + 1 < argc && parseCount(argv[i + 1], OPTIONS.unrollFactor)) {
+            i++;
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            OPTIONS.cacheDirectory = argv[++i];
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc && parseCount(argv[i + 1], OPTIONS.jobs)) {
+            i++;
+        } else if (strcmp(argv[i], "--max-errors") == 0 && i + 1 < argc && parseCount(argv[i + 1], OPTIONS.maxErrors)) {
+            i++;
+        } else if (strcmp(argv[i], "--eval-fuel") == 0 && i + 1 < argc && parseCount(argv[i + 1], OPTIONS.evalFuel)) {
+            i++;
+        } else if (strcmp(argv[i], "--eval-size") == 0 && i + 1 < argc && parseCount(argv[i + 1], OPTIONS.evalSize)) {
+            i++;
+        } else if (strncmp(argv[i], "-O", 2) == 0) {
+            OPTIONS.level = argv[i] + 2;
+        } else if (strcmp(argv[i], "--disable-pass") == 0 && i + 1 < argc) {
+            OPTIONS.disabledPasses.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "--print-after") == 0 && i + 1 < argc) {
+            OPTIONS.printAfter = argv[++i];
+        } else if (strcmp(argv[i], "--profile-generate") == 0) {
+            OPTIONS.profileGenerate = true;
+        } else if (strcmp(argv[i], "--profile-use") == 0 && i + 1 < argc) {
+            OPTIONS.profileUse = argv[++i];
+        } else if (strcmp(argv[i], "--time-passes") == 0) {
+            OPTIONS.timePasses = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            OPTIONS.stats = true;
+        } else if (strcmp(argv[i], "--cost-report") == 0) {
+            OPTIONS.costReport = true;
+        } else if (strcmp(argv[i], "--stats-format") == 0 && i + 1 < argc
+                   && (strcmp(argv[i + 1], "text") == 0 || strcmp(argv[i + 1], "json") == 0)) {
+            OPTIONS.statsJson = strcmp(argv[++i], "json") == 0;
+        } else {
+            std::cerr << "Error: Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
 
-    std::filesystem::path outputPath(outputFileName);
-    if (outputPath.extension() != ".mr") {
-        outputFileName += ".mr";
+    std::string error;
+    if (!PASSES.configure(error)) {
+        std::cerr << "Error: " << error << std::endl << "Passes:" << std::endl << PASSES.describe();
+        return 1;
+    }
+    if (!OPTIONS.profileUse.empty() && !PROFILE.load(OPTIONS.profileUse, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
     }
 
-    bool printTokens = (argc >= 4 && strcmp(argv[3], "-t") == 0);
+    if (serving) {
+        OPTIONS.quiet = true;   // Standard output may carry the responses
+        if (socketPath.empty()) {
+            Server::serve(stdin, stdout);
+        } else if (!Server::listen(socketPath)) {
+            return 1;
+        }
+        reportStatistics();
+        return 0;
+    }
 
-    std::cout << "Parsed file name: " << parsedFileName << std::endl;
-    std::cout << "Output file name: " << outputFileName << std::endl;
+    if (!OPTIONS.quiet) {
+        std::cout << "Parsed file name: " << parsedFileName << std::endl;
+        std::cout << "Output file name: " << outputFileName << std::endl;
+    }
 
     FILE* file = fopen(argv[1], "r");
     if (!file) {
@@ -43,15 +166,22 @@ int main(int argc, char* argv[]) {
 
     yyin = file;
 
-    if (printTokens) {
-        while (yylex()) {
-            yylval.token->print();
+    try {
+        if (OPTIONS.printTokens) {
+            while (yylex()) {
+                yylval.token->print();
+            }
+        } else {
+            yyparse();
         }
-    } else {
-        yyparse();
+    } catch (const CompilationAborted&) {
+        ErrorHandler::getInstance().printErrors();
+        return 1;
     }
 
     fclose(file);
 
+    reportStatistics();
+
     return 0;
 }
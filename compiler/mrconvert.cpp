@@ -0,0 +1,62 @@
+// Converts .mr programs between the text and the binary format.
+//
+// A text program becomes binary with <input>.map, if there is one, as its map section.
+// A binary program becomes text, its map section is written to <output>.map.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "BinaryProgram.hpp"
+
+bool write_file(const std::string& fileName, const std::string& content) {
+    std::ofstream output(fileName, std::ios::binary);
+    if (!output.is_open()) {
+        std::cerr << "Error: Cannot write file " << fileName << std::endl;
+        return false;
+    }
+    output << content;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <input.mr> <output.mr>" << std::endl;
+        return 1;
+    }
+
+    std::string content;
+    if (!read_program_file(argv[1], content)) {
+        std::cerr << "Error: Cannot open file " << argv[1] << std::endl;
+        return 1;
+    }
+
+    std::vector<BinaryInstruction> program;
+    std::vector<BinaryOrigin> map;
+    std::string error;
+
+    if (is_binary_program(content)) {
+        if (!decode_binary_program(content, program, &map, error)) {
+            std::cerr << "Error: " << error << std::endl;
+            return 1;
+        }
+        if (!write_file(argv[2], format_text_program(program))
+            || (!map.empty() && !write_file(std::string(argv[2]) + ".map", format_text_map(map)))) {
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!parse_text_program(content, program, error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    std::string mapText;
+    if (read_program_file(std::string(argv[1]) + ".map", mapText)) {
+        map = parse_text_map(mapText);
+        if (map.size() != program.size()) {
+            std::cerr << "Warning: " << argv[1] << ".map does not match the program, leaving it out" << std::endl;
+        }
+    }
+    return write_file(argv[2], encode_binary_program(program, &map)) ? 0 : 1;
+}
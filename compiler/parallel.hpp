@@ -0,0 +1,51 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Runs task(0) ... task(count - 1) on up to jobs threads, 0 uses every core
+// Tasks are handed out in order, the first exception a task throws is rethrown once all threads finished
+inline void parallel_for(size_t count, long long jobs, const std::function<void(size_t)>& task) {
+    size_t threads = jobs > 0 ? jobs : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, count);
+
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next{0};
+    std::vector<std::exception_ptr> failures(threads);
+    std::vector<std::thread> workers;
+
+    for (size_t worker = 0; worker < threads; worker++) {
+        workers.emplace_back([&, worker]() {
+            try {
+                for (size_t i = next++; i < count; i = next++) {
+                    task(i);
+                }
+            } catch (...) {
+                failures[worker] = std::current_exception();
+                next = count;
+            }
+        });
+    }
+
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    for (auto& failure : failures) {
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+}
+
+#endif // PARALLEL_HPP
@@ -11,9 +11,24 @@
 #include <algorithm>
 #include "Token.hpp"
 #include "Node.hpp"
+#include "PassManager.hpp"
+#include "ArgumentModes.hpp"
+#include "Inlining.hpp"
+#include "ConstantPropagation.hpp"
+#include "FrameLayout.hpp"
+#include "Outliner.hpp"
+#include "Profile.hpp"
+#include "CostEstimator.hpp"
+#include "Linker.hpp"
+#include "UnitCache.hpp"
+#include "parallel.hpp"
 #include "postprocessing.hpp"
+#include "BinaryProgram.hpp"
+#include "PartialEvaluator.hpp"
 #include "parser.tab.h"
 #include "ErrorHandler.hpp"
+#include "Options.hpp"
+#include "Statistics.hpp"
 
 extern const std::string parsedFileName;
 extern const std::string outputFileName;
@@ -44,8 +59,22 @@ long long condition_counter = 0;
 long long command_counter = 0;
 long long expression_counter = 0;
 
+std::vector<unsigned long long> for_lines;    // Lines of the FOR keywords of the loops being parsed
+
+std::string* compiledProgram = nullptr;      // Receives the program instead of the output file, see compile_source
+
+// Progress of the parser, silenced by --quiet
+void trace(const char* message) {
+    if (!OPTIONS.quiet) {
+        std::puts(message);
+    }
+}
+
 
 Token* manageToken(Token* newToken, bool declaration = false, bool declarationInProc = false) {
+    PhaseTimer timer(Phase::SEMANTIC);
+    STATS.add(Counter::LOOKUPS);
+
     if (proc_counter != -1 && newToken->getFunction() != TokenFunction::PROC
                            && newToken->getFunction() != TokenFunction::TABLE
                            && newToken->getType() == TokenType::IDENTIFIER)
@@ -65,9 +94,9 @@ Token* manageToken(Token* newToken, bool declaration = false, bool declarationIn
                         || ((*it)->getFunction() == TokenFunction::ARG && newToken->getFunction() == TokenFunction::T_ARG)
                         || ((*it)->getFunction() == TokenFunction::ARG && newToken->getFunction() == TokenFunction::DEFAULT)
                         || ((*it)->getFunction() == TokenFunction::ARG && newToken->getFunction() == TokenFunction::ARG)))
-            LOG_ERROR("Cannot create multiple variables with the same name in the same scope.", newToken);
+            LOG_ERROR(ErrorCode::DUPLICATE_VARIABLE, newToken);
         if (declaration && (*it)->getFunction() == TokenFunction::PROC)
-            LOG_ERROR("Cannot create multiple procedures with the same name.", newToken);
+            LOG_ERROR(ErrorCode::DUPLICATE_PROCEDURE, newToken);
         return *it;
     }
 
@@ -77,13 +106,13 @@ Token* manageToken(Token* newToken, bool declaration = false, bool declarationIn
     var_counter++;
 
     if (!declaration && newToken->getType() != TokenType::NUMBER)
-        LOG_ERROR("Undeclared variable.", newToken);
+        LOG_ERROR(ErrorCode::UNDECLARED_VARIABLE, newToken);
     return newToken;
 }
 
 Token* manageTabel(Token* identifier, Token* lower_bound, Token* upper_bound) {
     if (std::stoll(lower_bound->getValue()) > std::stoll(upper_bound->getValue())) {
-        LOG_ERROR("Lower bound is greater than upper bound", identifier);
+        LOG_ERROR(ErrorCode::INVALID_BOUNDS, identifier);
     }
 
     if (proc_counter != -1 && identifier->getFunction() != TokenFunction::PROC && identifier->getType() == TokenType::IDENTIFIER) {
@@ -91,6 +120,7 @@ Token* manageTabel(Token* identifier, Token* lower_bound, Token* upper_bound) {
     }
 
     identifier->setAddress(var_counter-std::stoll(lower_bound->getValue()));    // Set absolute address of 0th index
+    identifier->setBounds(std::stoll(lower_bound->getValue()), std::stoll(upper_bound->getValue()));
     manageToken(identifier, true);                                              // Add identifier to the tokens withh 0th index's address
 
     var_counter += std::stoll(upper_bound->getValue()) - std::stoll(lower_bound->getValue());
@@ -99,7 +129,11 @@ Token* manageTabel(Token* identifier, Token* lower_bound, Token* upper_bound) {
 }
 
 bool saveToFile(const std::string& content) {
-    std::ofstream outFile(outputFileName);
+    if (compiledProgram) {
+        *compiledProgram = content;
+        return true;
+    }
+    std::ofstream outFile(outputFileName, std::ios::binary);
     if (outFile.is_open()) {
         outFile << content;
         outFile.close();
@@ -110,9 +144,8 @@ bool saveToFile(const std::string& content) {
 }
 
 void vibecheck(){
-    if (!ErrorHandler::getInstance().getErrors().empty()) {
-        ErrorHandler::getInstance().printErrors();
-        exit(1);
+    if (ErrorHandler::getInstance().errorCount() > 0) {
+        throw CompilationAborted();
     }
 }
 
@@ -153,62 +186,241 @@ program_all:
         tokens.push_back(one->initialize());
     }
     procedures { proc_counter = -1; } main {
+        if (OPTIONS.timePasses) {
+            STATS.time(Phase::PARSE, STATS.elapsed());
+        }
         vibecheck();
 
         Node* AST = new ProgramAllNode();
         AST->addChild($2);  // Add procedures node
         AST->addChild($4);  // Add main node
-        printf("Parsed program_all\n");
+        trace("Parsed program_all");
 
         vibecheck();
 
-        AST->print();
+        PhaseTimer printTimer(Phase::PRINT);
+        if (!OPTIONS.quiet) {
+            AST->print();
+        }
         for (auto token : tokens) {
-            token->print();
+            if (!OPTIONS.quiet) {
+                token->print();
+            }
             if (!token->isInitialized() && token->getFunction() != TokenFunction::PROC)
-                LOG_ERROR("Uninitialized variable.", token);
+                LOG_ERROR(ErrorCode::UNINITIALIZED_VARIABLE, token);
+        }
+        printTimer.stop();
+
+        // From here on code refers to relocatable addresses, the linker assigns the real ones.
+        LINKER.begin(tokens, var_counter);
+        // Cached units know neither the profile nor their blocks, and skip the passes the cost report has to see
+        bool profiling = OPTIONS.profileGenerate || !OPTIONS.profileUse.empty();
+        UnitCache cache(profiling || OPTIONS.costReport ? "" : OPTIONS.cacheDirectory);
+
+        // Procedure heads first, calls need the arguments of the procedures they call.
+        PhaseTimer headTimer(Phase::CODEGEN);
+        std::vector<ProcedureNode*> procedures = static_cast<ProceduresNode*>($2)->list();
+        for (auto procedure : procedures) {
+            procedure->children[0]->build();
+        }
+        std::vector<Node*> all(procedures.begin(), procedures.end());
+        all.push_back($4);
+        std::vector<std::string> labels;
+        for (auto procedure : procedures) {
+            labels.push_back("PROC_" + procedure->children[0]->token->getValue());
         }
+        labels.push_back("MAIN");
+        for (size_t i = 0; profiling && i < all.size(); i++) {
+            Profile::number(all[i], labels[i]);     // IDs the profile refers to nodes by
+        }
+        PASSES.runProgram("args", all, [&] {
+            ArgumentModes().run(procedures, $4);    // Arguments the callee never writes are copied in
+        });
+        PASSES.runProgram("sccp", all, [&] {
+            ConstantPropagation().run(procedures, $4);  // Constants and copies, also into copied in arguments
+        });
+        bool inlined = false;
+        PASSES.runProgram("inline", all, [&] {
+            inlined = Inlining().run(procedures, $4);   // Hot calls build the procedure in their place
+        });
+        PASSES.runProgram("frames", all, [&] {
+            FrameLayout().run(procedures);          // Procedures never active at once share their memory
+        });
+        headTimer.stop();
+
+        // Every procedure is a separate unit, unchanged ones come from the cache. Main is the last unit.
+        std::vector<Unit> units(procedures.size() + 1);
+        std::vector<std::string> keys(procedures.size());
+        std::vector<size_t> pending;
+        PhaseTimer loadTimer(Phase::CACHE);
+        for (size_t i = 0; i < procedures.size(); i++) {
+            keys[i] = cache.key(procedures[i]);
+            if (!cache.load(keys[i], procedures[i], units[i])) {
+                pending.push_back(i);
+            }
+        }
+        pending.push_back(procedures.size());
+        loadTimer.stop();
+
+        // Run the passes of the optimization level on the AST of the remaining units, then generate their
+        // code, both concurrently. Units with inlined calls build procedures the passes of other units change,
+        // their passes then run one after the other, procedures before their callers. Errors are reported in
+        // program order.
+        std::vector<std::vector<Diagnostic>> errors(units.size());
+        parallel_for(pending.size(), inlined ? 1 : OPTIONS.jobs, [&](size_t task) {
+            size_t i = pending[task];
+            if (ErrorHandler::getInstance().aborted()) {
+                return;     // Too many errors already, the program will not be linked
+            }
+            ErrorHandler::getInstance().capture(&errors[i]);
+            PhaseTimer analysisTimer(Phase::ANALYSIS);
+            PASSES.runUnit(all[i], labels[i]);
+            analysisTimer.stop();
+            ErrorHandler::getInstance().capture(nullptr);
+        });
+        parallel_for(pending.size(), OPTIONS.jobs, [&](size_t task) {
+            size_t i = pending[task];
+            if (ErrorHandler::getInstance().aborted()) {
+                return;
+            }
+            ErrorHandler::getInstance().capture(&errors[i]);
+            PhaseTimer codegenTimer(Phase::CODEGEN);
+            std::string assembly = i < procedures.size() ? all[i]->build() : AST->build();
+            codegenTimer.stop();
+
+            PhaseTimer assemblyTimer(Phase::ASSEMBLY);
+            units[i] = assemble_unit(assembly, labels[i]);
+            assemblyTimer.stop();
+            ErrorHandler::getInstance().capture(nullptr);
+        });
 
-        // Build assembly.
-        std::string assembly = AST->build(&tokens);
+        for (size_t i = 0; i < units.size(); i++) {
+            ErrorHandler::getInstance().merge(errors[i]);
+        }
         vibecheck();
-        std::cout << "First pass assembly:" << std::endl << assembly << std::endl;
 
-        assembly = calculate_jumps(assembly);
+        if (OPTIONS.costReport) {
+            CostEstimator estimator;
+            for (size_t i = 0; i < all.size(); i++) {
+                estimator.unit(all[i], labels[i]);
+            }
+            estimator.report(std::cerr, OPTIONS.statsJson);
+        }
+
+        PhaseTimer storeTimer(Phase::CACHE);
+        for (size_t i : pending) {
+            if (i < procedures.size()) {
+                cache.store(keys[i], procedures[i], units[i]);
+            }
+        }
+        storeTimer.stop();
+
+        if (cache.enabled() && !OPTIONS.quiet) {
+            std::cout << "Cache: " << cache.getHits() << " hits, " << cache.getMisses() << " misses" << std::endl;
+        }
+
+        // Share the instruction sequences that repeat across the units, the cache keeps them unshared.
+        PASSES.runAssembled("outline", units, [&] {
+            Outliner outliner;
+            outliner.run(units, hidden_token("~outline")->getAddress());
+            return -outliner.added();
+        });
+
+        std::vector<SourceLocation> map;
+        std::vector<BlockSite> blocks;
+        PhaseTimer linkTimer(Phase::LINK);
+        std::string assembly = LINKER.link(units, OPTIONS.sourceMap ? &map : nullptr, OPTIONS.profileGenerate ? &blocks : nullptr);
+        linkTimer.stop();
         vibecheck();
-        std::cout << "Assembly with calculated jumps:" << std::endl << assembly << std::endl;
+
+        // Replace the start of the run that does not depend on the input with its outcome.
+        PhaseTimer evaluationTimer(Phase::EVALUATION);
+        PartialEvaluator evaluator(OPTIONS.evalFuel, OPTIONS.evalSize, OPTIONS.small);
+        bool halted = false;
+        PASSES.runLinked("evaluate", assembly, [&] {
+            halted = evaluator.run(assembly, OPTIONS.sourceMap ? &map : nullptr) && evaluator.halted();
+            return static_cast<long long>(evaluator.saved());
+        });
+        evaluationTimer.stop();
+
+        if (OPTIONS.stats) {
+            const std::vector<Unit> none;   // Only the output of an evaluated program is left
+            long long prologue = std::count(assembly.begin(), assembly.end(), '\n');
+            for (const auto& unit : halted ? none : units) {
+                std::vector<long long> counts(unit.locations.size(), 0);
+                for (size_t origin : unit.origins) {
+                    counts[origin]++;
+                }
+                for (size_t j = 0; j < counts.size(); j++) {
+                    STATS.instructions(unit.locations[j].kind, counts[j]);
+                }
+                prologue -= unit.code.size();
+            }
+            STATS.instructions("INIT", prologue);
+            STATS.add(Counter::INSTRUCTIONS, std::count(assembly.begin(), assembly.end(), '\n'));
+        }
+
+        PhaseTimer assemblyPrintTimer(Phase::PRINT);
+        if (!OPTIONS.quiet) {
+            std::cout << "Assembly with calculated jumps:" << std::endl << assembly << std::endl;
+        }
+        assemblyPrintTimer.stop();
 
         delete AST;
 
-        if (!saveToFile(assembly)) {
+        PhaseTimer outputTimer(Phase::OUTPUT);
+        if (OPTIONS.binary) {
+            // The map is a section of the binary program instead of a sidecar
+            std::vector<BinaryInstruction> program;
+            std::vector<BinaryOrigin> origins;
+            std::string error;
+            for (const auto& location : map) {
+                origins.push_back({location.line, location.kind, location.procedure, location.loops});
+            }
+            if (!parse_text_program(assembly, program, error) || !saveToFile(encode_binary_program(program, OPTIONS.sourceMap ? &origins : nullptr))) {
+                std::cout << "FATAL COMPILATION ERROR" << std::endl;
+            }
+        } else {
+            if (!saveToFile(assembly)) {
+                std::cout << "FATAL COMPILATION ERROR" << std::endl;
+            }
+
+            if (OPTIONS.sourceMap && !compiledProgram && !save_source_map(outputFileName + ".map", map)) {
+                std::cout << "FATAL COMPILATION ERROR" << std::endl;
+            }
+        }
+        if (OPTIONS.profileGenerate && !compiledProgram && !save_block_sites(outputFileName + ".blocks", blocks)) {
             std::cout << "FATAL COMPILATION ERROR" << std::endl;
         }
+        outputTimer.stop();
     }
     ;
 
 procedures:
     procedures PROCEDURE proc_head IS declarations T_BEGIN commands END {
-        $$ = new ProceduresNode($2, proc_counter);
-        $$->addChild($1);  // Add previous procedures
-        $$->addChild($3);  // Add proc_head
-        $$->addChild($7);  // Add commands
-        $$->addChild($5);  // Add declarations
+        Node* procedure = new ProcedureNode($2, proc_counter);
+        procedure->addChild($3);  // Add proc_head
+        procedure->addChild($7);  // Add commands
+        procedure->addChild($5);  // Add declarations
+        $$ = $1;
+        $$->addChild(procedure);  // Append to the previous procedures
         procs.push_back($3->token);
         proc_counter++;
-        printf("Parsed procedures with declarations\n");
+        trace("Parsed procedures with declarations");
     }
     | procedures PROCEDURE proc_head IS T_BEGIN commands END {
-        $$ = new ProceduresNode($2, proc_counter);
-        $$->addChild($1);  // Add previous procedures
-        $$->addChild($3);  // Add proc_head
-        $$->addChild($6);  // Add commands
+        Node* procedure = new ProcedureNode($2, proc_counter);
+        procedure->addChild($3);  // Add proc_head
+        procedure->addChild($6);  // Add commands
+        $$ = $1;
+        $$->addChild(procedure);  // Append to the previous procedures
         procs.push_back($3->token);
         proc_counter++;
-        printf("Parsed procedures without declarations\n");
+        trace("Parsed procedures without declarations");
     }
     | %empty {
         $$ = new ProceduresNode();
-        printf("Parsed empty procedures\n");
+        trace("Parsed empty procedures");
     }
     ;
 
@@ -216,86 +428,91 @@ proc_head:
     IDENTIFIER T_LPAREN args_decl T_RPAREN {
         $$ = new ProcHeadNode(manageToken($1->setFunction(TokenFunction::PROC), true)); // Add IDENTIFIER token
         $$->addChild($3);  // Add arguments declaration
-        printf("Parsed procedure head\n");
+        trace("Parsed procedure head");
     }
     ;
 
 proc_call:
     IDENTIFIER T_LPAREN args T_RPAREN {
         $$ = new ProcCallNode(manageToken($1->setFunction(TokenFunction::PROC))); // Add IDENTIFIER token
+        $$->setLine($1->getLine());
         $$->addChild($3);  // Add arguments
         std::string token_value = $1->getValue();
         bool found = std::any_of(procs.begin(), procs.end(), [token_value](Token* t) {
             return t->getValue() == token_value;
         });
         if (!found)
-            LOG_ERROR("Cannot call procedure inside itself.", $1);
-        printf("Parsed procedure call\n");
+            LOG_ERROR(ErrorCode::RECURSIVE_CALL, $1);
+        trace("Parsed procedure call");
     }
     ;
 
 args_decl:
     args_decl T_COMMA IDENTIFIER {
-        $$ = new ArgsDeclNode(manageToken($3->setFunction(TokenFunction::ARG)->initialize(), true));  // Add IDENTIFIER token
-        $$->addChild($1);  // Add previous argument declaration
-        printf("Parsed arguments declaration (multiple)\n");
+        $$ = $1;
+        $$->addToken(manageToken($3->setFunction(TokenFunction::ARG)->initialize(), true));  // Append IDENTIFIER token
+        trace("Parsed arguments declaration (multiple)");
     }
     | args_decl T_COMMA T_TABLE IDENTIFIER {
-        $$ = new ArgsDeclNode(manageToken($4->setFunction(TokenFunction::T_ARG)->initialize(), true));  // Add IDENTIFIER token
-        $$->addChild($1);  // Add previous argument declaration
-        printf("Parsed arguments declaration with table\n");
+        $$ = $1;
+        $$->addToken(manageToken($4->setFunction(TokenFunction::T_ARG)->initialize(), true));  // Append IDENTIFIER token
+        trace("Parsed arguments declaration with table");
     }
     | IDENTIFIER {
-        $$ = new ArgsDeclNode(manageToken($1->setFunction(TokenFunction::ARG)->initialize(), true)); // Add IDENTIFIER token
-        printf("Parsed single argument declaration\n");
+        $$ = new ArgsDeclNode();
+        $$->addToken(manageToken($1->setFunction(TokenFunction::ARG)->initialize(), true)); // Add IDENTIFIER token
+        trace("Parsed single argument declaration");
     }
     | T_TABLE IDENTIFIER {
-        $$ = new ArgsDeclNode(manageToken($2->setFunction(TokenFunction::T_ARG)->initialize(), true)); // Add IDENTIFIER token
-        printf("Parsed single table argument declaration\n");
+        $$ = new ArgsDeclNode();
+        $$->addToken(manageToken($2->setFunction(TokenFunction::T_ARG)->initialize(), true)); // Add IDENTIFIER token
+        trace("Parsed single table argument declaration");
     }
     ;
 
 args:
     args T_COMMA IDENTIFIER {
-        $$ = new ArgsNode(manageToken($3->initialize())); // Add IDENTIFIER token
-        $$->addChild($1);  // Add previous arguments
-        printf("Parsed arguments (multiple)\n");
+        $$ = $1;
+        $$->addToken(manageToken($3->initialize())); // Append IDENTIFIER token
+        trace("Parsed arguments (multiple)");
     }
     | IDENTIFIER {
-        $$ = new ArgsNode(manageToken($1->initialize())); // Add IDENTIFIER token
-        printf("Parsed single argument\n");
+        $$ = new ArgsNode();
+        $$->addToken(manageToken($1->initialize())); // Add IDENTIFIER token
+        trace("Parsed single argument");
     }
     ;
 
 main:
     PROGRAM IS declarations T_BEGIN commands END {
         $$ = new MainNode();
+        $$->setLine($1->getLine());
         $$->addChild($3);  // Add declarations
         $$->addChild($5);  // Add commands
-        printf("Parsed main with declarations\n");
+        trace("Parsed main with declarations");
     }
     | PROGRAM IS T_BEGIN commands END {
         $$ = new MainNode();
+        $$->setLine($1->getLine());
         $$->addChild($4);  // Add commands
-        printf("Parsed main without declarations\n");
+        trace("Parsed main without declarations");
     }
     ;
 
 commands:
     commands command {
-        $$ = new CommandsNode();
-        $$->addChild($1);  // Add previous commands
-        $$->addChild($2);  // Add the current command
-        printf("Parsed commands (multiple)\n");
+        $$ = $1;
+        $$->addChild($2);  // Append the current command
+        trace("Parsed commands (multiple)");
     }
     | command {
         $$ = new CommandsNode();
         $$->addChild($1);  // Add the single command
-        printf("Parsed command (single)\n");
+        trace("Parsed command (single)");
     }
     | %empty {
         $$ = new CommandsNode();
-        printf("Parsed empty command\n");
+        trace("Parsed empty command");
     }
     ;
 
@@ -306,98 +523,108 @@ command:
         $1->token->initialize();
         $$->addChild($1);  // Add IDENTIFIER token
         $$->addChild($3);  // Add the expression
-        printf("Parsed assignment command\n");
+        trace("Parsed assignment command");
     }
     | IF condition THEN commands ELSE commands ENDIF {
         $$ = new IfElseCommandNode($1, command_counter++);
         $$->addChild($2);  // Add condition
         $$->addChild($4);  // Add then commands
         $$->addChild($6);  // Add else commands
-        printf("Parsed IF-ELSE command\n");
+        trace("Parsed IF-ELSE command");
     }
     | IF condition THEN commands ENDIF {
         $$ = new IfCommandNode($1, command_counter++);
         $$->addChild($2);  // Add condition
         $$->addChild($4);  // Add commands
-        printf("Parsed IF command\n");
+        trace("Parsed IF command");
     }
     | WHILE condition DO commands ENDWHILE {
         $$ = new WhileCommandNode($1, command_counter++);
         $$->addChild($2);  // Add condition
         $$->addChild($4);  // Add commands
-        printf("Parsed WHILE command\n");
+        trace("Parsed WHILE command");
     }
     | REPEAT commands UNTIL condition T_SEMICOLON {
         $$ = new RepeatCommandNode($1, command_counter++);
         $$->addChild($2);  // Add commands
         $$->addChild($4);  // Add condition
-        printf("Parsed REPEAT command\n");
+        trace("Parsed REPEAT command");
     }
     | for_init FROM value TO value DO commands ENDFOR {
         // TODO: error if identifier has the same value as initialized variable
         $$ = new ForToCommandNode($1, command_counter++); // Add IDENTIFIER token
+        $$->setLine(for_lines.back());
+        for_lines.pop_back();
         $$->addChild($3);  // Add the first value
         $$->addChild($5);  // Add the second value
         $$->addChild($7);  // Add commands
-        printf("Parsed FOR command (TO)\n");
+        trace("Parsed FOR command (TO)");
     }
     | for_init FROM value DOWNTO value DO commands ENDFOR {
         // TODO: error if identifier has the same value as initialized variable
         $$ = new ForDownToCommandNode($1, command_counter++); // Add IDENTIFIER token
+        $$->setLine(for_lines.back());
+        for_lines.pop_back();
         $$->addChild($3);  // Add the first value
         $$->addChild($5);  // Add the second value
         $$->addChild($7);  // Add commands
-        printf("Parsed FOR command (DOWNTO)\n");
+        trace("Parsed FOR command (DOWNTO)");
     }
     | proc_call T_SEMICOLON {
         $$ = new ProcCallCommandNode();
+        $$->setLine($1->line);
         $$->addChild($1);  // Add procedure call
-        printf("Parsed procedure call command\n");
+        trace("Parsed procedure call command");
     }
     | READ identifier T_SEMICOLON {
         $$ = new ReadCommandNode();
+        $$->setLine($1->getLine());
         $2->token->initialize();
         $$->addChild($2);  // Add IDENTIFIER token
-        printf("Parsed READ command\n");
+        trace("Parsed READ command");
     }
     | WRITE value T_SEMICOLON {
         $$ = new WriteCommandNode();
+        $$->setLine($1->getLine());
         $$->addChild($2);  // Add value
-        printf("Parsed WRITE command\n");
+        trace("Parsed WRITE command");
     }
     ;
 
 for_init:
     FOR IDENTIFIER {
         $$=manageToken($2->setFunction(TokenFunction::ITERATOR)->initialize(), true);
+        for_lines.push_back($1->getLine());
     }
 
 declarations:
     declarations T_COMMA IDENTIFIER {
-        $$ = new DeclarationsNode(manageToken($3->setAssignability(true), true, true));  // Add IDENTIFIER token
-        $$->addChild($1);               // Add previous declarations
+        $$ = $1;
+        $$->addToken(manageToken($3->setAssignability(true), true, true));  // Append IDENTIFIER token
 
-        printf("Parsed declarations (multiple)\n");
+        trace("Parsed declarations (multiple)");
     }
     | declarations T_COMMA IDENTIFIER T_LBRACKET number T_COLON number T_RBRACKET {
         Token* lower_bound = $5->token;
         Token* upper_bound = $7->token;
-        $$ = new DeclarationsNode(manageTabel($3->setFunction(TokenFunction::TABLE), lower_bound, upper_bound));
-        $$->addChild($1);  // Add previous declarations
+        $$ = $1;
+        $$->addToken(manageTabel($3->setFunction(TokenFunction::TABLE), lower_bound, upper_bound));  // Append table token
 
-        printf("Parsed declarations with array\n");
+        trace("Parsed declarations with array");
     }
     | IDENTIFIER {
-        $$ = new DeclarationsNode(manageToken($1->setAssignability(true), true, true));  // Add IDENTIFIER token
+        $$ = new DeclarationsNode();
+        $$->addToken(manageToken($1->setAssignability(true), true, true));  // Add IDENTIFIER token
 
-        printf("Parsed single declaration\n");
+        trace("Parsed single declaration");
     }
     | IDENTIFIER T_LBRACKET number T_COLON number T_RBRACKET {
         Token* lower_bound = $3->token;
         Token* upper_bound = $5->token;
-        $$ = new DeclarationsNode(manageTabel($1->setFunction(TokenFunction::TABLE), lower_bound, upper_bound));
+        $$ = new DeclarationsNode();
+        $$->addToken(manageTabel($1->setFunction(TokenFunction::TABLE), lower_bound, upper_bound));  // Add table token
 
-        printf("Parsed single array declaration\n");
+        trace("Parsed single array declaration");
     }
     ;
 
@@ -405,37 +632,37 @@ expression:
     value {
         $$ = new ExpressionNode();
         $$->addChild($1);  // Add value
-        printf("Parsed expression (single value)\n");
+        trace("Parsed expression (single value)");
     }
     | value T_PLUS value {
         $$ = new ExpressionNode($2);
         $$->addChild($1);  // Add first value
         $$->addChild($3);  // Add second value
-        printf("Parsed expression (addition)\n");
+        trace("Parsed expression (addition)");
     }
     | value T_MINUS value {
         $$ = new ExpressionNode($2);
         $$->addChild($1);  // Add first value
         $$->addChild($3);  // Add second value
-        printf("Parsed expression (subtraction)\n");
+        trace("Parsed expression (subtraction)");
     }
     | value T_MUL value {
         $$ = new ExpressionNode($2);
         $$->addChild($1);  // Add first value
         $$->addChild($3);  // Add second value
-        printf("Parsed expression (multiplication)\n");
+        trace("Parsed expression (multiplication)");
     }
     | value T_DIV value {
         $$ = new ExpressionNode($2, expression_counter++);
         $$->addChild($1);  // Add first value
         $$->addChild($3);  // Add second value
-        printf("Parsed expression (division)\n");
+        trace("Parsed expression (division)");
     }
     | value T_MOD value {
         $$ = new ExpressionNode($2, expression_counter++);
         $$->addChild($1);  // Add first value
         $$->addChild($3);  // Add second value
-        printf("Parsed expression (modulus)\n");
+        trace("Parsed expression (modulus)");
     }
     ;
 
@@ -444,37 +671,37 @@ condition:
         $$ = new ConditionNode($2, condition_counter++);
         $$->addChild($1);  // Add first value
         $$->addChild($3);  // Add second value
-        printf("Parsed condition (equal)\n");
+        trace("Parsed condition (equal)");
     }
     | value T_NEQ value {
         $$ = new ConditionNode($2, condition_counter++);
         $$->addChild($1);  // Add first value
         $$->addChild($3);  // Add second value
-        printf("Parsed condition (not equal)\n");
+        trace("Parsed condition (not equal)");
     }
     | value T_GT value {
         $$ = new ConditionNode($2, condition_counter++);
         $$->addChild($1);  // Add first value
         $$->addChild($3);  // Add second value
-        printf("Parsed condition (greater than)\n");
+        trace("Parsed condition (greater than)");
     }
     | value T_LT value {
         $$ = new ConditionNode($2, condition_counter++);
         $$->addChild($1);  // Add first value
         $$->addChild($3);  // Add second value
-        printf("Parsed condition (less than)\n");
+        trace("Parsed condition (less than)");
     }
     | value T_GTE value {
         $$ = new ConditionNode($2, condition_counter++);
         $$->addChild($1);  // Add first value
         $$->addChild($3);  // Add second value
-        printf("Parsed condition (greater than or equal)\n");
+        trace("Parsed condition (greater than or equal)");
     }
     | value T_LTE value {
         $$ = new ConditionNode($2, condition_counter++);
         $$->addChild($1);  // Add first value
         $$->addChild($3);  // Add second value
-        printf("Parsed condition (less than or equal)\n");
+        trace("Parsed condition (less than or equal)");
     }
     ;
 
@@ -482,12 +709,12 @@ value:
     number {
         $$ = new ValueNode();   // Add NUMBER token
         $$->addChild($1);
-        printf("Parsed value (number)\n");
+        trace("Parsed value (number)");
     }
     | identifier {
         $$ = new ValueNode();
         $$->addChild($1);       // Add IDENTIFIER token
-        printf("Parsed value (identifier)\n");
+        trace("Parsed value (identifier)");
     }
     ;
 
@@ -495,7 +722,7 @@ number:
     NUMBER {
         $1->initialize()->setAssignability(false);
         $$ = new NumberNode(manageToken($1)); // Add NUMBER token
-        printf("Parsed number\n");
+        trace("Parsed number");
     }
     | T_MINUS NUMBER {
         Token* negative_number = new Token(TokenType::NUMBER, $1->getValue() + $2->getValue(), $1->getLine(), $2->getColumn(), -1, false);
@@ -506,7 +733,7 @@ number:
         delete $2;
         $2 = nullptr;
         $$ = new NumberNode(manageToken(negative_number)); // Add NUMBER token
-        printf("Parsed negative number\n");
+        trace("Parsed negative number");
     }
 
 identifier:
@@ -514,31 +741,79 @@ identifier:
         Token* token = manageToken($1);
         $$ = new IdentifierNode(token);
         if (token->getFunction() == TokenFunction::TABLE || token->getFunction() == TokenFunction::T_ARG)
-            LOG_ERROR("Improper use of table.", token);
-        printf("Parsed identifier\n");
+            LOG_ERROR(ErrorCode::IMPROPER_TABLE_USE, token);
+        trace("Parsed identifier");
     }
     | IDENTIFIER T_LBRACKET IDENTIFIER T_RBRACKET {
         Token* index0 = manageToken($1->initialize());
         $$ = new TableNode(index0);
         $$->addChild(new IdentifierNode(manageToken($3)));
         if (!(index0->getFunction() == TokenFunction::TABLE || index0->getFunction() == TokenFunction::T_ARG))
-            LOG_ERROR("Improper use of table.", index0);
-        printf("Parsed array identifier (variable index)\n");
+            LOG_ERROR(ErrorCode::IMPROPER_TABLE_USE, index0);
+        trace("Parsed array identifier (variable index)");
     }
     | IDENTIFIER T_LBRACKET number T_RBRACKET {
         Token* index0 = manageToken($1->initialize());
         $$ = new TableNode(index0);
         $$->addChild($3);
         if (!(index0->getFunction() == TokenFunction::TABLE || index0->getFunction() == TokenFunction::T_ARG))
-            LOG_ERROR("Improper use of table.", index0);
-        printf("Parsed array identifier (number index)\n");
+            LOG_ERROR(ErrorCode::IMPROPER_TABLE_USE, index0);
+        trace("Parsed array identifier (number index)");
     }
     ;
 
 %%
 
 int yyerror(std::string s) {
-    LOG_ERROR(s, nullptr);
+    ErrorHandler::getInstance().log(ErrorCode::SYNTAX, s);
     vibecheck();
     return 1;
 }
+
+extern int yylineno;
+extern void yyrestart(FILE* input);
+
+// Forgets everything an earlier compilation left in the globals
+void reset_compilation() {
+    for (auto token : tokens) {
+        delete token;
+    }
+    tokens.clear();
+    procs.clear();
+    var_counter = 9;
+    proc_counter = 0;
+    condition_counter = 0;
+    command_counter = 0;
+    expression_counter = 0;
+    for_lines.clear();
+    ErrorHandler::getInstance().clearErrors();
+    yylineno = 1;
+}
+
+// Compiles source held in memory without touching the output file, for --serve.
+// Returns false if it did not compile, diagnostics holds the reported errors either way.
+bool compile_source(const std::string& source, std::string& program, std::string& diagnostics) {
+    reset_compilation();
+
+    std::string buffer = source + "\n";     // fmemopen rejects an empty buffer
+    FILE* input = fmemopen(buffer.data(), buffer.size(), "r");
+    if (!input) {
+        diagnostics = "ERROR: Cannot read the source\n";
+        return false;
+    }
+    yyrestart(input);
+
+    program.clear();
+    compiledProgram = &program;
+    bool compiled = true;
+    try {
+        compiled = yyparse() == 0;
+    } catch (const CompilationAborted&) {
+        compiled = false;
+    }
+    compiledProgram = nullptr;
+    fclose(input);
+
+    diagnostics = ErrorHandler::getInstance().formatErrors();
+    return compiled && ErrorHandler::getInstance().errorCount() == 0;
+}
@@ -2,95 +2,293 @@
 #define POSTPROCESSING_HPP
 
 #include <iostream>
+#include <algorithm>
+#include <cctype>
 #include <string>
 #include <sstream>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
-#include <regex>
+#include <fstream>
+#include "Statistics.hpp"
 
-// Function to process assembly code by resolving labels and replacing them with relative jumps
-std::string calculate_jumps(const std::string& assembly) {
-    std::istringstream input(assembly);
+// Origin of a single final instruction, collected from the #PROC / #LOC / #LOOP directives.
+struct SourceLocation {
+    unsigned long long line = 0;
+    std::string kind = "-";
+    std::string procedure = "-";
+    std::string loops = "-";    // Enclosing loops from the outermost, e.g. FORTO_COMMAND@4/WHILE_COMMAND@10
+};
+
+// Consumes a source map directive, returns false if the line is an instruction
+inline bool read_directive(const std::string& line, std::string& procedure, std::vector<SourceLocation>& scopes) {
+    std::istringstream directive(line);
+    std::string name;
+    directive >> name;
+
+    if (name == "#PROC") {
+        directive >> procedure;
+    } else if (name == "#LOC" || name == "#LOOP") {
+        SourceLocation location = scopes.empty() ? SourceLocation() : scopes.back();
+        directive >> location.line >> location.kind;
+        if (name == "#LOOP") {
+            std::string loop = location.kind + "@" + std::to_string(location.line);
+            location.loops = location.loops == "-" ? loop : location.loops + "/" + loop;
+        }
+        scopes.push_back(location);
+    } else if (name == "#ENDLOC") {
+        if (!scopes.empty()) {
+            scopes.pop_back();
+        }
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// Returns the labels defined at the start of line and the rest of the line after them
+inline std::string strip_labels(const std::string& line, std::vector<std::string>* labels = nullptr) {
+    size_t position = 0;
+    while (position < line.size() && line[position] == '*') {
+        size_t end = line.find(' ', position);
+        if (end == std::string::npos) {
+            break;
+        }
+        if (labels) {
+            labels->push_back(line.substr(position + 1, end - position - 1));
+        }
+        position = end + 1;
+    }
+    return line.substr(position);
+}
+
+// Counts the instructions of first pass assembly, labels and directives do not take space
+inline long long count_instructions(const std::string& code) {
+    std::istringstream input(code);
     std::string line;
-    std::vector<std::string> lines;
-    std::unordered_map<std::string, int> labelPositions;
+    long long count = 0;
 
-    // First pass: Store all labels and their corresponding line indices
-    int lineIndex = 0;
     while (std::getline(input, line)) {
-        std::smatch match;
-        std::regex labelRegex(R"((\*\w+ )+)"); // Match multiple labels starting with '*'
+        std::string instruction = strip_labels(line);
+        if (instruction.find_first_not_of(" \t") != std::string::npos && instruction[0] != '#') {
+            count++;
+        }
+    }
 
-        if (std::regex_search(line, match, labelRegex)) {
-            std::string labels = match[0].str(); // Use match[0] to get the full matched string
-            std::istringstream labelStream(labels);
-            std::string label;
+    return count;
+}
 
-            // Store each label's position
-            while (labelStream >> label) {
-                labelPositions[label.substr(1)] = lineIndex; // Remove '*' from label
-            }
+// Cost of one instruction in the VM's cost model
+inline long long instruction_cost(const std::string& instruction) {
+    static const std::unordered_map<std::string, long long> costs = {
+        {"GET", 100}, {"PUT", 100}, {"LOAD", 10}, {"STORE", 10}, {"LOADI", 20}, {"STOREI", 20},
+        {"ADD", 10}, {"SUB", 10}, {"ADDI", 20}, {"SUBI", 12}, {"SET", 50}, {"HALF", 5},
+        {"JUMP", 1}, {"JPOS", 1}, {"JZERO", 1}, {"JNEG", 1}, {"RTRN", 10}, {"HALT", 0}
+    };
+    auto found = costs.find(instruction.substr(0, instruction.find(' ')));
+    return found == costs.end() ? 0 : found->second;
+}
 
-            // Remove the labels from the line
-            line = std::regex_replace(line, labelRegex, "");
+// Static estimate of the cycles first pass assembly takes, every instruction weighted by loop_weight
+// per enclosing loop marked with #LOOP, up to max_weight
+inline long long estimate_cycles(const std::string& code, long long loop_weight = 10, long long max_weight = 1000000) {
+    std::istringstream input(code);
+    std::string line;
+    std::string procedure;
+    std::vector<SourceLocation> scopes;
+    std::vector<long long> weights;     // Weight of every open scope
+    long long cycles = 0;
 
-            // Add the modified line if it contains other instructions
-            if (!line.empty() && line.find_first_not_of(" \t") != std::string::npos) {
-                lines.push_back(line);
-                lineIndex++;
+    while (std::getline(input, line)) {
+        std::string instruction = strip_labels(line);
+        if (instruction.find_first_not_of(" \t") == std::string::npos) {
+            continue;
+        }
+        size_t depth = scopes.size();
+        if (read_directive(instruction, procedure, scopes)) {
+            if (scopes.size() > depth) {
+                long long outer = weights.empty() ? 1 : weights.back();
+                weights.push_back(instruction.rfind("#LOOP", 0) == 0 ? std::min(outer * loop_weight, max_weight) : outer);
+            } else if (scopes.size() < depth && !weights.empty()) {
+                weights.pop_back();
             }
-        } else {
-            lines.push_back(line);
-            lineIndex++;
+            continue;
         }
+        cycles += instruction_cost(instruction) * (weights.empty() ? 1 : weights.back());
     }
 
-    // Second pass: Replace label references with calculated relative jumps
-    for (std::string& instruction : lines) {
-        std::smatch match;
-        std::regex jumpRegex(R"(\b(JUMP|JPOS|JZERO|JNEG)\s+\*(\w+))");  // Match JUMP commands with labels
-        std::regex setRegex(R"(\b(SET)\s+\&(\d+))");                    // Match SET commands with &number
-
-        while (std::regex_search(instruction, match, jumpRegex)) {
-            std::string label = match[2];
-            std::string jumpType = match[1];
-
-            if (labelPositions.find(label) != labelPositions.end()) {
-                int targetLine = labelPositions[label];
-                int currentLine = &instruction - &lines[0];
-                int relativeJump = targetLine - currentLine;
-
-                instruction = std::regex_replace(
-                    instruction,
-                    jumpRegex,
-                    jumpType + " " + std::to_string(relativeJump)
-                );
-            } else {
-                throw std::runtime_error("Undefined label: " + label);
+    return cycles;
+}
+
+// Appends suffix to every label defined in code, so that a copy of it can be emitted next to the original
+// Jumps to labels defined elsewhere (procedures, MAIN, enclosing commands) are left untouched
+inline std::string relabel(const std::string& code, const std::string& suffix) {
+    std::istringstream input(code);
+    std::string line;
+    std::vector<std::string> labels;
+
+    while (std::getline(input, line)) {
+        strip_labels(line, &labels);
+    }
+
+    if (labels.empty()) {
+        return code;
+    }
+
+    std::unordered_set<std::string> defined(labels.begin(), labels.end());
+    std::string relabeled;
+    relabeled.reserve(code.size() + labels.size() * 2 * suffix.size());
+
+    for (size_t i = 0; i < code.size();) {
+        if (code[i] != '*') {
+            relabeled += code[i++];
+            continue;
+        }
+
+        size_t end = i + 1;
+        while (end < code.size() && (std::isalnum(static_cast<unsigned char>(code[end])) || code[end] == '_')) {
+            end++;
+        }
+        relabeled.append(code, i, end - i);
+        if (defined.count(code.substr(i + 1, end - i - 1))) {
+            relabeled += suffix;
+        }
+        i = end;
+    }
+
+    return relabeled;
+}
+
+// Instructions the VM counts a profiled node at, from the #BLOCK and #BRANCH directives of --profile-generate
+struct BlockSite {
+    std::string id;
+    long long entry = -1;       // First instruction of the node
+    long long branch = -1;      // Conditional jump deciding the node, -1 if it has none
+    bool jumpsIfTrue = false;   // Whether that jump is taken when the condition holds
+};
+
+// Code of one procedure or of main with the jumps inside it resolved. Jumps to other units (*LABEL),
+// return addresses (&n) and relocatable addresses are resolved by the linker.
+struct Unit {
+    std::string label;                      // Label other units jump to, PROC_<name> or MAIN
+    std::vector<std::string> code;
+    std::vector<SourceLocation> locations;  // Origins the instructions come from
+    std::vector<size_t> origins;            // Index into locations for every instruction
+    std::vector<BlockSite> blocks;          // Profiled nodes, relative to the start of the unit
+};
+
+// Consumes a profiling directive, returns false if the line is none
+inline bool read_block(const std::string& line, Unit& unit) {
+    std::istringstream directive(line);
+    std::string name, id, sense;
+    directive >> name >> id;
+
+    if (name == "#BLOCK") {
+        unit.blocks.push_back({id, static_cast<long long>(unit.code.size())});
+    } else if (name == "#BRANCH") {
+        directive >> sense;
+        for (auto block = unit.blocks.rbegin(); block != unit.blocks.rend(); ++block) {
+            if (block->id == id) {
+                block->branch = unit.code.size();
+                block->jumpsIfTrue = sense == "T";
+                break;
             }
         }
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// Turns first pass assembly into a unit, replacing jumps to the labels it defines with relative ones
+inline Unit assemble_unit(const std::string& assembly, const std::string& label) {
+    std::istringstream input(assembly);
+    std::string line;
+    std::unordered_map<std::string, long long> labelPositions;
+    std::vector<std::string> labels;
+    std::string procedure = "-";
+    std::vector<SourceLocation> scopes;
+    bool moved = true;      // A directive changed the origin since the last instruction
+    Unit unit;
+    unit.label = label;
+
+    // First pass: Store all labels and their corresponding instruction indices
+    while (std::getline(input, line)) {
+        labels.clear();
+        std::string instruction = strip_labels(line, &labels);
+        for (const auto& name : labels) {
+            labelPositions[name] = unit.code.size();
+        }
 
-        while (std::regex_search(instruction, match, setRegex)) {
-            std::string numberStr = match[2];
-            int number = std::stoi(numberStr);
-            int currentLine = &instruction - &lines[0];
-            int calculatedValue = currentLine + number;
+        if (instruction.find_first_not_of(" \t") == std::string::npos) {
+            continue;
+        }
+        if (read_directive(instruction, procedure, scopes)) {
+            moved = true;
+            continue;
+        }
+        if (read_block(instruction, unit)) {
+            continue;
+        }
 
-            instruction = std::regex_replace(
-                instruction,
-                setRegex,
-                "SET " + std::to_string(calculatedValue)
-            );
+        if (moved) {
+            unit.locations.push_back(scopes.empty() ? SourceLocation() : scopes.back());
+            unit.locations.back().procedure = procedure;
+            moved = false;
         }
+        unit.code.push_back(instruction);
+        unit.origins.push_back(unit.locations.size() - 1);
+    }
+
+    // Second pass: Replace references to local labels with relative jumps
+    long long resolved = 0;
+    for (size_t i = 0; i < unit.code.size(); i++) {
+        size_t reference = unit.code[i].find(" *");
+        if (reference == std::string::npos) {
+            continue;
+        }
+        auto target = labelPositions.find(unit.code[i].substr(reference + 2));
+        if (target != labelPositions.end()) {
+            unit.code[i] = unit.code[i].substr(0, reference + 1) + std::to_string(target->second - static_cast<long long>(i));
+            resolved++;
+        }
+    }
+    STATS.add(Counter::LABELS, resolved);
+
+    return unit;
+}
+
+// Writes the instruction-to-source map sidecar read by the VM profiler
+inline bool save_source_map(const std::string& fileName, const std::vector<SourceLocation>& map) {
+    std::ofstream outFile(fileName);
+    if (!outFile.is_open()) {
+        return false;
+    }
+
+    outFile << "# instruction line kind procedure loops" << std::endl;
+    for (size_t i = 0; i < map.size(); i++) {
+        outFile << i << " " << map[i].line << " " << map[i].kind << " "
+                << map[i].procedure << " " << map[i].loops << std::endl;
+    }
+
+    return true;
+}
+
+// Writes the profiled nodes of --profile-generate, the VM's --profile-out counts them
+inline bool save_block_sites(const std::string& fileName, const std::vector<BlockSite>& blocks) {
+    std::ofstream outFile(fileName);
+    if (!outFile.is_open()) {
+        return false;
     }
 
-    // Combine the processed lines back into a single string
-    std::ostringstream output;
-    for (const std::string& processedLine : lines) {
-        output << processedLine << "\n";
+    outFile << "# block entry branch jumps-if" << std::endl;
+    for (const auto& block : blocks) {
+        outFile << block.id << " " << block.entry << " " << block.branch << " " << (block.jumpsIfTrue ? "T" : "F") << std::endl;
     }
 
-    return output.str();
+    return true;
 }
 
 #endif // POSTPROCESSING_HPP
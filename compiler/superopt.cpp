@@ -0,0 +1,699 @@
+// Superoptimizer for the instruction templates of code generation.
+//
+// A template is a short piece of code with a specification: the cells it may read and write, the
+// values its inputs can take and what it has to leave in its outputs. The search enumerates
+// sequences of LOAD, STORE, ADD, SUB, HALF and forward jumps over those cells, shortest first. A
+// prefix is dropped as soon as the test inputs no longer reach its end, it repeats an instruction
+// without effect or its cycles so far cannot win any more. Candidates that are right on the test
+// inputs are checked on every input of a bounded range and a few extreme values; a counterexample
+// joins the test inputs and the length is searched again.
+//
+// Cycles are those of the VM, averaged over the test inputs. For every template the cheapest
+// sequence and the shortest one costing at most SLACK cycles more than the handwritten reference
+// are written to Templates.hpp, which code generation takes its sequences from (the short ones at
+// -Os). The handwritten reference competes as well, so a template never gets worse.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+enum class Op { LOAD, STORE, ADD, SUB, HALF, JUMP, JPOS, JZERO, JNEG };
+
+static const char* opName(Op op) {
+    switch (op) {
+        case Op::LOAD:  return "LOAD";
+        case Op::STORE: return "STORE";
+        case Op::ADD:   return "ADD";
+        case Op::SUB:   return "SUB";
+        case Op::HALF:  return "HALF";
+        case Op::JUMP:  return "JUMP";
+        case Op::JPOS:  return "JPOS";
+        case Op::JZERO: return "JZERO";
+        default:        return "JNEG";
+    }
+}
+
+static bool isJump(Op op) {
+    return op == Op::JUMP || op == Op::JPOS || op == Op::JZERO || op == Op::JNEG;
+}
+
+static long long cycles(Op op) {
+    switch (op) {
+        case Op::HALF:  return 5;
+        case Op::JUMP:
+        case Op::JPOS:
+        case Op::JZERO:
+        case Op::JNEG:  return 1;
+        default:        return 10;
+    }
+}
+
+static constexpr int ACC = -1;          // The accumulator, memory cell 0, as an operand
+static constexpr int MAX_CELLS = 8;
+static constexpr long long SLACK = 10;  // Cycles the short sequence may cost over the reference
+
+struct Instruction {
+    Op op;
+    int operand;    // Index of the cell, ACC, or the relative jump
+};
+
+struct Cell {
+    enum Kind { REGISTER, PARAMETER, CONSTANT } kind;
+    long long value;    // Address, number of the parameter or the constant
+    bool writable;
+};
+
+// Values an input may take
+struct Domain {
+    enum Kind { ANY, NEGATIVE, NONNEGATIVE, SET } kind;
+    std::vector<long long> values;     // For SET
+};
+
+struct Input {
+    int cell;       // ACC for the accumulator
+    Domain domain;
+};
+
+struct Template {
+    std::string name;
+    std::string description;
+    std::vector<Cell> cells;
+    std::vector<Input> inputs;
+    int accFrom = ACC - 1;                  // Cell the accumulator holds on entry, if not an input itself
+    std::vector<int> outputs;
+    std::function<std::vector<long long>(const std::vector<long long>&)> expected;  // Outputs for the inputs
+    std::vector<Instruction> reference;     // The handwritten sequence
+    int maxLength;
+};
+
+struct State {
+    long long acc = 0;
+    std::array<long long, MAX_CELLS> cells{};
+    int pc = 0;
+    long long cycles = 0;
+};
+
+struct Vector {
+    std::vector<long long> inputs;
+    State start;
+    std::vector<long long> outputs;
+};
+
+struct Result {
+    std::vector<Instruction> code;
+    long long cost = -1;    // Cycles summed over the cost inputs
+};
+
+static void step(const Instruction& instruction, State& state) {
+    long long operand = instruction.operand == ACC ? state.acc : state.cells[instruction.operand];
+    state.cycles += cycles(instruction.op);
+    switch (instruction.op) {
+        case Op::LOAD:  state.acc = operand; break;
+        case Op::STORE: state.cells[instruction.operand] = state.acc; break;
+        case Op::ADD:   state.acc = (long long)((unsigned long long)state.acc + (unsigned long long)operand); break;
+        case Op::SUB:   state.acc = (long long)((unsigned long long)state.acc - (unsigned long long)operand); break;
+        case Op::HALF:  state.acc >>= 1; break;
+        case Op::JUMP:  state.pc += instruction.operand; return;
+        case Op::JPOS:  state.pc += state.acc > 0 ? instruction.operand : 1; return;
+        case Op::JZERO: state.pc += state.acc == 0 ? instruction.operand : 1; return;
+        case Op::JNEG:  state.pc += state.acc < 0 ? instruction.operand : 1; return;
+    }
+    state.pc++;
+}
+
+class Superoptimizer {
+public:
+    explicit Superoptimizer(const Template& spec) : spec(spec) {
+        for (size_t i = 0; i < spec.cells.size(); i++) {
+            if (spec.cells[i].kind != Cell::CONSTANT || spec.cells[i].value != 0) {
+                readable.push_back(i);      // A constant 0 is no better than SUB 0
+            }
+            if (spec.cells[i].writable) {
+                writable.push_back(i);
+            }
+        }
+        tests = vectors(false, 101);
+        costed = tests.size();
+        checks = vectors(true, 202);
+    }
+
+    void run(Result& fast, Result& small, long long& referenceCost, long long& inputs) {
+        inputs = costed;
+        if (!correct(spec.reference, checks)) {
+            std::cerr << "Error: the reference of " << spec.name << " does not meet its specification" << std::endl;
+            std::exit(1);
+        }
+        referenceCost = cost(spec.reference);
+        best = {spec.reference, referenceCost};
+        shortest = best;
+        limit = referenceCost + SLACK * static_cast<long long>(costed);
+
+        for (int length = 1; length <= spec.maxLength; length++) {
+            do {
+                refuted = false;
+                code.assign(length, Instruction{Op::HALF, 0});
+                targets.assign(length + 1, 0);
+                runs.assign(length + 1, {});
+                runs[0].clear();
+                for (const auto& vector : tests) {
+                    runs[0].push_back(vector.start);
+                }
+                search(0, length);
+            } while (refuted);
+        }
+        fast = best;
+        small = shortest;
+    }
+
+    long long nodes = 0;
+
+private:
+    const Template& spec;
+    std::vector<int> readable;
+    std::vector<int> writable;
+    std::vector<Vector> tests;      // The first costed ones also measure the cycles
+    size_t costed = 0;
+    std::vector<Vector> checks;
+    Result best;
+    Result shortest;
+    long long limit = 0;
+    bool refuted = false;
+    std::vector<Instruction> code;
+    std::vector<int> targets;       // Jumps landing on every position
+    std::vector<std::vector<State>> runs;  // States of the tests before every position
+
+    static std::vector<long long> samples(const Domain& domain, bool bounded) {
+        static const std::vector<long long> extremes = {1LL << 40, (1LL << 40) + 3, (1LL << 60) + 1};
+        std::vector<long long> values;
+        switch (domain.kind) {
+            case Domain::ANY:
+                if (!bounded) {
+                    return {-5, -2, -1, 0, 1, 2, 3, 6};
+                }
+                for (long long v = -100; v <= 100; v++) values.push_back(v);
+                for (long long v : extremes) { values.push_back(v); values.push_back(-v); }
+                return values;
+            case Domain::NEGATIVE:
+                if (!bounded) {
+                    return {-1, -2, -3, -9};
+                }
+                for (long long v = -200; v <= -1; v++) values.push_back(v);
+                for (long long v : extremes) values.push_back(-v);
+                return values;
+            case Domain::NONNEGATIVE:
+                if (!bounded) {
+                    return {0, 1, 2, 5, 8};
+                }
+                for (long long v = 0; v <= 200; v++) values.push_back(v);
+                for (long long v : extremes) values.push_back(v);
+                return values;
+            default:
+                return domain.values;
+        }
+    }
+
+    // Every combination of the samples of the inputs, cells nothing initializes hold garbage
+    std::vector<Vector> vectors(bool bounded, long long garbage) const {
+        std::vector<Vector> result;
+        std::vector<std::vector<long long>> values;
+        for (const auto& input : spec.inputs) {
+            values.push_back(samples(input.domain, bounded));
+        }
+        std::vector<size_t> index(values.size(), 0);
+        while (true) {
+            Vector vector;
+            for (size_t i = 0; i < values.size(); i++) {
+                vector.inputs.push_back(values[i][index[i]]);
+            }
+            result.push_back(make(vector.inputs, garbage));
+
+            size_t i = 0;
+            while (i < index.size() && ++index[i] == values[i].size()) {
+                index[i++] = 0;
+            }
+            if (i == index.size()) {
+                break;
+            }
+        }
+        return result;
+    }
+
+    Vector make(const std::vector<long long>& inputs, long long garbage) const {
+        Vector vector;
+        vector.inputs = inputs;
+        for (size_t i = 0; i < spec.cells.size(); i++) {
+            const Cell& cell = spec.cells[i];
+            vector.start.cells[i] = cell.kind == Cell::CONSTANT ? cell.value : garbage + static_cast<long long>(i);
+        }
+        vector.start.acc = garbage;
+        for (size_t i = 0; i < spec.inputs.size(); i++) {
+            if (spec.inputs[i].cell == ACC) {
+                vector.start.acc = inputs[i];
+            } else {
+                vector.start.cells[spec.inputs[i].cell] = inputs[i];
+            }
+        }
+        if (spec.accFrom >= 0) {
+            vector.start.acc = vector.start.cells[spec.accFrom];
+        }
+        vector.outputs = spec.expected(inputs);
+        return vector;
+    }
+
+    bool meets(const Vector& vector, const State& state) const {
+        for (size_t i = 0; i < spec.outputs.size(); i++) {
+            long long value = spec.outputs[i] == ACC ? state.acc : state.cells[spec.outputs[i]];
+            if (value != vector.outputs[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static State execute(const std::vector<Instruction>& program, State state) {
+        while (state.pc >= 0 && state.pc < static_cast<int>(program.size())) {
+            step(program[state.pc], state);
+        }
+        return state;
+    }
+
+    // Returns false on the first vector the program fails, which then becomes a test
+    bool correct(const std::vector<Instruction>& program, const std::vector<Vector>& vectors, const Vector** failed = nullptr) const {
+        for (const auto& vector : vectors) {
+            State end = execute(program, vector.start);
+            if (end.pc != static_cast<int>(program.size()) || !meets(vector, end)) {
+                if (failed) {
+                    *failed = &vector;
+                }
+                return false;
+            }
+        }
+        return true;
+    }
+
+    long long cost(const std::vector<Instruction>& program) const {
+        long long total = 0;
+        for (size_t i = 0; i < costed; i++) {
+            total += execute(program, tests[i].start).cycles;
+        }
+        return total;
+    }
+
+    // Cycles the cost inputs need at least, whatever follows
+    long long bound(const std::vector<State>& states) const {
+        long long total = 0;
+        for (size_t i = 0; i < costed; i++) {
+            total += states[i].cycles;
+        }
+        return total;
+    }
+
+    bool useless(int position, const Instruction& next) const {
+        if (position == 0 || targets[position] > 0) {
+            return false;
+        }
+        const Instruction& previous = code[position - 1];
+        if (previous.op == Op::JUMP) {
+            return true;                                        // Nothing reaches it
+        }
+        bool overwrites = next.op == Op::LOAD || (next.op == Op::SUB && next.operand == ACC);
+        if (overwrites && (previous.op == Op::LOAD || previous.op == Op::ADD || previous.op == Op::SUB || previous.op == Op::HALF)) {
+            return true;                                        // The previous result is lost
+        }
+        if (next.op == Op::LOAD && previous.op == Op::STORE && previous.operand == next.operand) {
+            return true;
+        }
+        return next.op == Op::STORE && previous.op == Op::LOAD && previous.operand == next.operand;
+    }
+
+    void search(int position, int length) {
+        if (refuted) {
+            return;
+        }
+        nodes++;
+        const std::vector<State>& before = runs[position];
+
+        if (position == length) {
+            for (size_t i = 0; i < before.size(); i++) {
+                if (before[i].pc != length || !meets(tests[i], before[i])) {
+                    return;
+                }
+            }
+            const Vector* failed = nullptr;
+            if (!correct(code, checks, &failed)) {
+                tests.push_back(*failed);       // Counterexample, the length is searched again
+                refuted = true;
+                return;
+            }
+            consider(code);
+            return;
+        }
+
+        bool reached = false;
+        for (const auto& state : before) {
+            reached = reached || state.pc == position;
+        }
+        if (!reached) {
+            return;
+        }
+
+        auto attempt = [&](Instruction instruction) {
+            if (useless(position, instruction)) {
+                return;
+            }
+            code[position] = instruction;
+            std::vector<State>& after = runs[position + 1];
+            after = before;
+            for (auto& state : after) {
+                if (state.pc == position) {
+                    step(instruction, state);
+                }
+            }
+            long long least = bound(after);
+            bool shorter = length < static_cast<int>(shortest.code.size());
+            if (least > (shorter ? limit : best.cost) || (!shorter && least == best.cost && length >= static_cast<int>(best.code.size()))) {
+                return;
+            }
+            if (isJump(instruction.op)) {
+                targets[position + instruction.operand]++;
+                search(position + 1, length);
+                targets[position + instruction.operand]--;
+            } else {
+                search(position + 1, length);
+            }
+        };
+
+        for (int cell : readable) {
+            attempt({Op::LOAD, cell});
+            attempt({Op::ADD, cell});
+            attempt({Op::SUB, cell});
+        }
+        attempt({Op::ADD, ACC});
+        attempt({Op::SUB, ACC});
+        for (int cell : writable) {
+            attempt({Op::STORE, cell});
+        }
+        attempt({Op::HALF, 0});
+        for (int offset = 2; position + offset <= length; offset++) {
+            for (Op op : {Op::JUMP, Op::JPOS, Op::JZERO, Op::JNEG}) {
+                attempt({op, offset});
+            }
+        }
+    }
+
+    void consider(const std::vector<Instruction>& program) {
+        long long total = cost(program);
+        size_t size = program.size();
+        if (total < best.cost || (total == best.cost && size < best.code.size())) {
+            best = {program, total};
+        }
+        if (total <= limit && (size < shortest.code.size() || (size == shortest.code.size() && total < shortest.cost))) {
+            shortest = {program, total};
+        }
+    }
+};
+
+// Specifications of the templates, the references are the sequences code generation used before
+static std::vector<Template> templates() {
+    std::vector<Template> list;
+    const Cell r1{Cell::REGISTER, 1, false};
+    const Cell r4{Cell::REGISTER, 4, true};
+    const Cell r7{Cell::REGISTER, 7, true};
+    const Cell r8{Cell::REGISTER, 8, true};
+    const Cell x{Cell::PARAMETER, 0, true};
+    const Cell zero{Cell::CONSTANT, 0, false};
+    const Cell one{Cell::CONSTANT, 1, false};
+    const Cell two{Cell::CONSTANT, 2, false};
+    const Cell minusOne{Cell::CONSTANT, -1, false};
+    const Domain any{Domain::ANY, {}};
+    const Domain negative{Domain::NEGATIVE, {}};
+    const Domain nonNegative{Domain::NONNEGATIVE, {}};
+
+    // The accumulator holds a - b, R4 receives 1 if the comparison holds and 0 otherwise
+    struct Comparison {
+        const char* name;
+        const char* text;
+        Op jump;
+        bool whenJumping;
+        std::function<bool(long long)> holds;
+    };
+    const std::vector<Comparison> comparisons = {
+        {"BOOL_LT", "<", Op::JNEG, true, [](long long d) { return d < 0; }},
+        {"BOOL_LTE", "<=", Op::JPOS, false, [](long long d) { return d <= 0; }},
+        {"BOOL_EQ", "=", Op::JZERO, true, [](long long d) { return d == 0; }},
+        {"BOOL_GTE", ">=", Op::JNEG, false, [](long long d) { return d >= 0; }},
+        {"BOOL_GT", ">", Op::JPOS, true, [](long long d) { return d > 0; }},
+        {"BOOL_NEQ", "!=", Op::JZERO, false, [](long long d) { return d != 0; }},
+    };
+    for (const auto& comparison : comparisons) {
+        Template spec;
+        spec.name = comparison.name;
+        spec.description = std::string("R4 = 1 if a ") + comparison.text + " b else 0, the accumulator holds a - b";
+        spec.cells = {r4, zero, one};
+        spec.inputs = {{ACC, any}};
+        spec.outputs = {0};
+        auto holds = comparison.holds;
+        spec.expected = [holds](const std::vector<long long>& in) { return std::vector<long long>{holds(in[0]) ? 1 : 0}; };
+        int taken = comparison.whenJumping ? 2 : 1;
+        int fallen = comparison.whenJumping ? 1 : 2;
+        spec.reference = {{comparison.jump, 3}, {Op::LOAD, fallen}, {Op::JUMP, 2}, {Op::LOAD, taken}, {Op::STORE, 0}};
+        spec.maxLength = 5;
+        list.push_back(spec);
+    }
+
+    {
+        Template spec;
+        spec.name = "MUL_NEGATE_B";
+        spec.description = "X = -X and the sign R7 = 1, X < 0 is in the accumulator and R7 = 0";
+        spec.cells = {x, r7, zero, one};
+        spec.inputs = {{0, negative}, {1, {Domain::SET, {0}}}};
+        spec.accFrom = 0;
+        spec.outputs = {0, 1};
+        spec.expected = [](const std::vector<long long>& in) { return std::vector<long long>{-in[0], 1}; };
+        spec.reference = {{Op::SUB, 0}, {Op::SUB, 0}, {Op::STORE, 0}, {Op::LOAD, 3}, {Op::STORE, 1}};
+        spec.maxLength = 5;
+        list.push_back(spec);
+    }
+    {
+        Template spec;
+        spec.name = "MUL_NEGATE_A";
+        spec.description = "X = -X and the sign R7 flips between 0 and 1, X < 0 is in the accumulator";
+        spec.cells = {x, r7, zero, one};
+        spec.inputs = {{0, negative}, {1, {Domain::SET, {0, 1}}}};
+        spec.accFrom = 0;
+        spec.outputs = {0, 1};
+        spec.expected = [](const std::vector<long long>& in) { return std::vector<long long>{-in[0], 1 - in[1]}; };
+        spec.reference = {{Op::SUB, 0}, {Op::SUB, 0}, {Op::STORE, 0}, {Op::LOAD, 1}, {Op::JPOS, 4}, {Op::ADD, 3},
+                          {Op::STORE, 1}, {Op::JUMP, 3}, {Op::HALF, 0}, {Op::STORE, 1}};
+        spec.maxLength = 6;
+        list.push_back(spec);
+    }
+    {
+        Template spec;
+        spec.name = "MUL_SIGN";
+        spec.description = "R4 = -R4 if the sign R7 is 1, unchanged if it is 0";
+        spec.cells = {r4, r7, zero, one};
+        spec.inputs = {{0, any}, {1, {Domain::SET, {0, 1}}}};
+        spec.outputs = {0};
+        spec.expected = [](const std::vector<long long>& in) { return std::vector<long long>{in[1] ? -in[0] : in[0]}; };
+        spec.reference = {{Op::LOAD, 1}, {Op::JZERO, 5}, {Op::LOAD, 0}, {Op::SUB, 0}, {Op::SUB, 0}, {Op::JUMP, 2},
+                          {Op::LOAD, 0}, {Op::STORE, 0}};
+        spec.maxLength = 6;
+        list.push_back(spec);
+    }
+    {
+        Template spec;
+        spec.name = "DIV_NEGATE_B";
+        spec.description = "X = -X and the sign R7 = 2, X < 0 is in the accumulator and R7 = 0";
+        spec.cells = {x, r7, zero, one, two};
+        spec.inputs = {{0, negative}, {1, {Domain::SET, {0}}}};
+        spec.accFrom = 0;
+        spec.outputs = {0, 1};
+        spec.expected = [](const std::vector<long long>& in) { return std::vector<long long>{-in[0], 2}; };
+        spec.reference = {{Op::SUB, 0}, {Op::SUB, 0}, {Op::STORE, 0}, {Op::LOAD, 3}, {Op::ADD, 3}, {Op::STORE, 1}};
+        spec.maxLength = 6;
+        list.push_back(spec);
+    }
+    {
+        Template spec;
+        spec.name = "DIV_NEGATE_A";
+        spec.description = "X = -X and the sign R7 grows by 1, X < 0 is in the accumulator and R7 is 0 or 2";
+        spec.cells = {x, r7, zero, one};
+        spec.inputs = {{0, negative}, {1, {Domain::SET, {0, 2}}}};
+        spec.accFrom = 0;
+        spec.outputs = {0, 1};
+        spec.expected = [](const std::vector<long long>& in) { return std::vector<long long>{-in[0], in[1] + 1}; };
+        spec.reference = {{Op::SUB, 0}, {Op::SUB, 0}, {Op::STORE, 0}, {Op::LOAD, 1}, {Op::ADD, 3}, {Op::STORE, 1}};
+        spec.maxLength = 6;
+        list.push_back(spec);
+    }
+    {
+        Template spec;
+        spec.name = "DIV_MIXED";
+        spec.description = "R4 = -(R4 + 1) if the remainder R1 is not 0, else -R4; the quotient of operands of mixed signs";
+        spec.cells = {r4, r1, r8, zero, one, minusOne};
+        spec.inputs = {{0, nonNegative}, {1, nonNegative}};
+        spec.outputs = {0};
+        spec.expected = [](const std::vector<long long>& in) { return std::vector<long long>{-(in[0] + (in[1] != 0))}; };
+        spec.reference = {{Op::LOAD, 1}, {Op::JZERO, 2}, {Op::LOAD, 4}, {Op::ADD, 0}, {Op::STORE, 2}, {Op::LOAD, 3},
+                          {Op::SUB, 2}, {Op::STORE, 0}};
+        spec.maxLength = 6;
+        list.push_back(spec);
+    }
+    return list;
+}
+
+// Kind and value of an operand as written to Templates.hpp
+static std::pair<std::string, long long> operand(const Template& spec, const Instruction& instruction) {
+    if (instruction.op == Op::HALF) {
+        return {"NONE", 0};
+    }
+    if (isJump(instruction.op)) {
+        return {"JUMP", instruction.operand};
+    }
+    if (instruction.operand == ACC) {
+        return {"CELL", 0};
+    }
+    const Cell& cell = spec.cells[instruction.operand];
+    switch (cell.kind) {
+        case Cell::REGISTER:
+            return {"CELL", cell.value};
+        case Cell::PARAMETER:
+            return {"PARAMETER", cell.value};
+        default:
+            if (cell.value == 0 || cell.value == 1) {
+                return {"CELL", cell.value + 5};    // The constants the prologue sets
+            }
+            return {"CONSTANT", cell.value};
+    }
+}
+
+static std::string listing(const Template& spec, const std::vector<Instruction>& code) {
+    std::string text;
+    for (const auto& instruction : code) {
+        auto [kind, value] = operand(spec, instruction);
+        text += text.empty() ? "" : "; ";
+        text += opName(instruction.op);
+        if (kind == "PARAMETER") {
+            text += " X";
+        } else if (kind == "CONSTANT") {
+            text += " =" + std::to_string(value);
+        } else if (kind != "NONE") {
+            text += " " + std::to_string(value);
+        }
+    }
+    return text;
+}
+
+static void table(std::ostream& output, const Template& spec, const std::string& suffix, const Result& result) {
+    output << "inline constexpr TemplateInstruction " << spec.name << "_" << suffix << "[] = {" << std::endl;
+    for (const auto& instruction : result.code) {
+        auto [kind, value] = operand(spec, instruction);
+        output << "    {\"" << opName(instruction.op) << "\", TemplateOperand::" << kind << ", " << value << "}," << std::endl;
+    }
+    output << "};" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    std::string path = "Templates.hpp";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--out <file>]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Template> specs = templates();
+    std::vector<Result> fast(specs.size());
+    std::vector<Result> small(specs.size());
+    std::vector<long long> references(specs.size());
+    std::vector<long long> inputs(specs.size());
+
+    std::cout << std::left << std::setw(16) << "template" << std::right << std::setw(12) << "reference"
+              << std::setw(10) << "fast" << std::setw(10) << "small" << std::setw(14) << "nodes" << std::setw(10) << "ms" << std::endl;
+    for (size_t i = 0; i < specs.size(); i++) {
+        auto started = std::chrono::steady_clock::now();
+        Superoptimizer search(specs[i]);
+        search.run(fast[i], small[i], references[i], inputs[i]);
+        long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+        auto average = [&](const Result& result) {
+            std::ostringstream text;
+            text << std::fixed << std::setprecision(1) << static_cast<double>(result.cost) / inputs[i] << "/" << result.code.size();
+            return text.str();
+        };
+        std::cout << std::left << std::setw(16) << specs[i].name << std::right << std::setw(12)
+                  << average({specs[i].reference, references[i]}) << std::setw(10) << average(fast[i]) << std::setw(10)
+                  << average(small[i]) << std::setw(14) << search.nodes << std::setw(10) << ms << std::endl;
+    }
+    std::cout << "(average cycles over the test inputs / instructions)" << std::endl;
+
+    std::ofstream output(path);
+    if (!output) {
+        std::cerr << "Error: cannot write " << path << std::endl;
+        return 1;
+    }
+    output << "#ifndef TEMPLATES_HPP" << std::endl
+           << "#define TEMPLATES_HPP" << std::endl << std::endl
+           << "// Generated by superopt from the template specifications in superopt.cpp, do not edit." << std::endl
+           << "// Regenerate with make templates." << std::endl << std::endl
+           << "#include <cstddef>" << std::endl << std::endl
+           << "enum class TemplateOperand {" << std::endl
+           << "    NONE," << std::endl
+           << "    CELL,       // Fixed cell: the accumulator, a register or the constants 0 and 1" << std::endl
+           << "    PARAMETER,  // Cell the code generator passes in, X" << std::endl
+           << "    CONSTANT,   // Constant pool entry of the value" << std::endl
+           << "    JUMP        // Relative jump inside the template, to its size at most" << std::endl
+           << "};" << std::endl << std::endl
+           << "struct TemplateInstruction {" << std::endl
+           << "    const char* opcode;" << std::endl
+           << "    TemplateOperand kind;" << std::endl
+           << "    long long value;" << std::endl
+           << "};" << std::endl << std::endl
+           << "struct InstructionTemplate {" << std::endl
+           << "    const TemplateInstruction* code;" << std::endl
+           << "    size_t size;" << std::endl
+           << "};" << std::endl << std::endl
+           << "enum class TemplateId {" << std::endl;
+    for (const auto& spec : specs) {
+        output << "    " << spec.name << "," << std::endl;
+    }
+    output << "    COUNT" << std::endl << "};" << std::endl << std::endl;
+
+    for (size_t i = 0; i < specs.size(); i++) {
+        auto average = [&](long long total) {
+            std::ostringstream text;
+            text << std::fixed << std::setprecision(1) << static_cast<double>(total) / inputs[i];
+            return text.str();
+        };
+        output << "// " << specs[i].description << std::endl
+               << "// reference: " << listing(specs[i], specs[i].reference) << std::endl
+               << "// cycles on average: reference " << average(references[i]) << ", fast " << average(fast[i].cost)
+               << ", small " << average(small[i].cost) << std::endl;
+        table(output, specs[i], "FAST", fast[i]);
+        table(output, specs[i], "SMALL", small[i]);
+        output << std::endl;
+    }
+
+    for (const char* suffix : {"FAST", "SMALL"}) {
+        output << "// " << (std::string(suffix) == "FAST" ? "Fewest cycles" : "Fewest instructions") << std::endl
+               << "inline constexpr InstructionTemplate " << suffix << "_TEMPLATES[] = {" << std::endl;
+        for (size_t i = 0; i < specs.size(); i++) {
+            const Result& result = std::string(suffix) == "FAST" ? fast[i] : small[i];
+            output << "    {" << specs[i].name << "_" << suffix << ", " << result.code.size() << "}," << std::endl;
+        }
+        output << "};" << std::endl << std::endl;
+    }
+    output << "#endif // TEMPLATES_HPP" << std::endl;
+    std::cout << "Wrote " << path << std::endl;
+    return 0;
+}
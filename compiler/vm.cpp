@@ -0,0 +1,400 @@
+// Reference-cost virtual machine with an optional source-level profiler.
+//
+// Executes text or binary .mr programs with the same semantics and costs as the course VM
+// and, with --profile, attributes cost, execution counts and branch directions to every
+// instruction, rolled up per source line, loop and procedure using the map section of a
+// binary program or <program>.map. With --profile-out it writes the execution counts of the
+// nodes a --profile-generate build marked in <program>.blocks, for --profile-use.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include "BinaryProgram.hpp"
+
+// Same order as BinaryOpcode
+enum class Opcode {
+    GET, PUT, LOAD, STORE, LOADI, STOREI, ADD, SUB, ADDI, SUBI, SET, HALF, JUMP, JPOS, JZERO, JNEG, RTRN, HALT
+};
+
+struct Instruction {
+    Opcode opcode;
+    long long operand;
+};
+
+struct InstructionProfile {
+    unsigned long long count = 0;
+    unsigned long long cost = 0;
+    unsigned long long taken = 0;
+    unsigned long long notTaken = 0;
+};
+
+// Profiled node of a --profile-generate build, see BlockSite in postprocessing.hpp
+struct Block {
+    std::string id;
+    long long entry = -1;
+    long long branch = -1;
+    bool jumpsIfTrue = false;
+};
+
+struct Origin {
+    unsigned long long line = 0;
+    std::string kind = "-";
+    std::string procedure = "-";
+    std::string loops = "-";
+};
+
+// Loads a text or binary program, origins receives the map section of a binary one
+bool load_program(const std::string& fileName, std::vector<Instruction>& program, std::vector<Origin>& origins) {
+    std::string content;
+    if (!read_program_file(fileName, content)) {
+        std::cerr << "Error: Cannot open file " << fileName << std::endl;
+        return false;
+    }
+
+    std::vector<BinaryInstruction> instructions;
+    std::vector<BinaryOrigin> map;
+    std::string error;
+    bool loaded = is_binary_program(content) ? decode_binary_program(content, instructions, &map, error)
+                                             : parse_text_program(content, instructions, error);
+    if (!loaded) {
+        std::cerr << "Error: " << error << std::endl;
+        return false;
+    }
+
+    program.resize(instructions.size());
+    for (size_t i = 0; i < instructions.size(); i++) {
+        program[i] = {static_cast<Opcode>(instructions[i].opcode), instructions[i].operand};
+    }
+    for (const auto& origin : map) {
+        origins.push_back({origin.line, origin.kind, origin.procedure, origin.loops});
+    }
+    return true;
+}
+
+bool load_map(const std::string& fileName, std::vector<Origin>& origins) {
+    std::string content;
+    if (!read_program_file(fileName, content)) {
+        return false;
+    }
+
+    origins.clear();
+    for (const auto& origin : parse_text_map(content)) {
+        origins.push_back({origin.line, origin.kind, origin.procedure, origin.loops});
+    }
+    return true;
+}
+
+bool load_blocks(const std::string& fileName, std::vector<Block>& blocks) {
+    std::ifstream file(fileName);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        Block block;
+        std::string sense;
+        if (fields >> block.id >> block.entry >> block.branch >> sense) {
+            block.jumpsIfTrue = sense == "T";
+            blocks.push_back(block);
+        }
+    }
+    return true;
+}
+
+// Writes how often every block was entered and its condition held or not, copies of a node are summed
+bool save_block_profile(const std::string& fileName, const std::vector<Block>& blocks,
+                        const std::vector<InstructionProfile>& profile) {
+    std::ofstream file(fileName);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    struct Counts {
+        unsigned long long count = 0, whenTrue = 0, whenFalse = 0;
+    };
+    std::vector<std::string> order;
+    std::unordered_map<std::string, Counts> counts;
+    auto at = [&](long long index) { return index >= 0 && index < (long long)profile.size() ? profile[index] : InstructionProfile(); };
+    for (const auto& block : blocks) {
+        if (!counts.count(block.id)) {
+            order.push_back(block.id);
+        }
+        Counts& total = counts[block.id];
+        total.count += at(block.entry).count;
+        InstructionProfile branch = at(block.branch);
+        total.whenTrue += block.jumpsIfTrue ? branch.taken : branch.notTaken;
+        total.whenFalse += block.jumpsIfTrue ? branch.notTaken : branch.taken;
+    }
+
+    file << "# block count true false" << std::endl;
+    for (const auto& id : order) {
+        file << id << " " << counts[id].count << " " << counts[id].whenTrue << " " << counts[id].whenFalse << std::endl;
+    }
+    return true;
+}
+
+// Runs the program, returns false on a machine error
+bool run_machine(const std::vector<Instruction>& program, std::vector<InstructionProfile>* profile,
+                 unsigned long long& cost, unsigned long long& io) {
+    std::unordered_map<long long, long long> memory;
+    long long lr = 0;
+    cost = 0;
+    io = 0;
+
+    if (program.empty()) {
+        std::cerr << "Error: Empty program" << std::endl;
+        return false;
+    }
+
+    while (program[lr].opcode != Opcode::HALT) {
+        const Instruction& instruction = program[lr];
+        long long operand = instruction.operand;
+        long long& acc = memory[0];
+        unsigned long long before = cost;
+        long long from = lr;
+        int branch = -1;    // Direction of a conditional jump, -1 for other instructions
+
+        if (instruction.opcode != Opcode::SET && instruction.opcode != Opcode::JUMP && instruction.opcode != Opcode::JPOS
+            && instruction.opcode != Opcode::JZERO && instruction.opcode != Opcode::JNEG && operand < 0) {
+            std::cerr << "Error: Negative memory address on instruction " << lr << std::endl;
+            return false;
+        }
+
+        switch (instruction.opcode) {
+            case Opcode::GET:    std::cout << "? "; std::cin >> memory[operand]; io += 100; cost += 100; lr++; break;
+            case Opcode::PUT:    std::cout << "> " << memory[operand] << std::endl; io += 100; cost += 100; lr++; break;
+
+            case Opcode::LOAD:   acc = memory[operand]; cost += 10; lr++; break;
+            case Opcode::STORE:  memory[operand] = acc; cost += 10; lr++; break;
+            case Opcode::LOADI:  acc = memory[memory[operand]]; cost += 20; lr++; break;
+            case Opcode::STOREI: memory[memory[operand]] = acc; cost += 20; lr++; break;
+
+            case Opcode::ADD:    acc = (long long)((unsigned long long)acc + (unsigned long long)memory[operand]); cost += 10; lr++; break;
+            case Opcode::SUB:    acc = (long long)((unsigned long long)acc - (unsigned long long)memory[operand]); cost += 10; lr++; break;
+            case Opcode::ADDI:   acc = (long long)((unsigned long long)acc + (unsigned long long)memory[memory[operand]]); cost += 20; lr++; break;
+            case Opcode::SUBI:   acc = (long long)((unsigned long long)acc - (unsigned long long)memory[memory[operand]]); cost += 12; lr++; break;
+
+            case Opcode::SET:    acc = operand; cost += 50; lr++; break;
+            case Opcode::HALF:   acc >>= 1; cost += 5; lr++; break;
+
+            case Opcode::JUMP:   lr += operand; cost += 1; break;
+            case Opcode::JPOS:   branch = acc > 0; lr += branch ? operand : 1; cost += 1; break;
+            case Opcode::JZERO:  branch = acc == 0; lr += branch ? operand : 1; cost += 1; break;
+            case Opcode::JNEG:   branch = acc < 0; lr += branch ? operand : 1; cost += 1; break;
+
+            case Opcode::RTRN:   lr = memory[operand]; cost += 10; break;
+            default: break;
+        }
+
+        if (profile) {
+            InstructionProfile& entry = (*profile)[from];
+            entry.count++;
+            entry.cost += cost - before;
+            if (branch == 1) {
+                entry.taken++;
+            } else if (branch == 0) {
+                entry.notTaken++;
+            }
+        }
+
+        if (lr < 0 || lr >= (long long)program.size()) {
+            std::cerr << "Error: Jump to nonexistent instruction " << lr << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+struct Rollup {
+    std::string name;
+    unsigned long long line = 0;
+    unsigned long long count = 0;
+    unsigned long long cost = 0;
+    unsigned long long taken = 0;
+    unsigned long long notTaken = 0;
+};
+
+void print_rollup(std::ostream& out, const std::string& title, std::vector<Rollup> rows,
+                  const std::string& sort, unsigned long long total) {
+    std::sort(rows.begin(), rows.end(), [&sort](const Rollup& a, const Rollup& b) {
+        if (sort == "count") return a.count > b.count;
+        if (sort == "line") return a.line < b.line || (a.line == b.line && a.name < b.name);
+        return a.cost > b.cost;
+    });
+
+    out << title << std::endl;
+    out << std::setw(40) << std::left << "  name" << std::right << std::setw(16) << "cost" << std::setw(8) << "%"
+        << std::setw(14) << "executed" << std::setw(12) << "taken" << std::setw(12) << "not taken" << std::endl;
+    for (const Rollup& row : rows) {
+        if (row.count == 0) {
+            continue;
+        }
+        out << "  " << std::setw(38) << std::left << row.name << std::right << std::setw(16) << row.cost
+            << std::setw(8) << std::fixed << std::setprecision(2) << (total ? 100.0 * row.cost / total : 0.0)
+            << std::setw(14) << row.count << std::setw(12) << row.taken << std::setw(12) << row.notTaken << std::endl;
+    }
+    out << std::endl;
+}
+
+void print_report(std::ostream& out, const std::vector<Instruction>& program, const std::vector<InstructionProfile>& profile,
+                  const std::vector<Origin>& origins, const std::string& sort, unsigned long long total) {
+    std::map<std::string, Rollup> lines, loops, procedures;
+    std::vector<Rollup> instructions;
+
+    for (size_t i = 0; i < program.size(); i++) {
+        const InstructionProfile& entry = profile[i];
+        Origin origin = i < origins.size() ? origins[i] : Origin();
+
+        auto add = [&entry](Rollup& row) {
+            row.count += entry.count;
+            row.cost += entry.cost;
+            row.taken += entry.taken;
+            row.notTaken += entry.notTaken;
+        };
+
+        Rollup instruction;
+        instruction.name = std::to_string(i) + " (line " + std::to_string(origin.line) + ", " + origin.kind + ")";
+        instruction.line = origin.line;
+        add(instruction);
+        instructions.push_back(instruction);
+
+        std::string lineName = origin.procedure + ":" + std::to_string(origin.line);
+        lines[lineName].name = lineName;
+        lines[lineName].line = origin.line;
+        add(lines[lineName]);
+
+        procedures[origin.procedure].name = origin.procedure;
+        add(procedures[origin.procedure]);
+
+        // Loop costs are inclusive, every enclosing loop is charged
+        if (origin.loops != "-") {
+            std::string path;
+            std::istringstream stream(origin.loops);
+            std::string loop;
+            while (std::getline(stream, loop, '/')) {
+                path = path.empty() ? loop : path + "/" + loop;
+                std::string loopName = origin.procedure + ":" + path;
+                loops[loopName].name = loopName;
+                loops[loopName].line = std::stoull(loop.substr(loop.find('@') + 1));
+                add(loops[loopName]);
+            }
+        }
+    }
+
+    auto values = [](const std::map<std::string, Rollup>& rows) {
+        std::vector<Rollup> result;
+        for (const auto& [name, row] : rows) {
+            result.push_back(row);
+        }
+        return result;
+    };
+
+    out << "Profile (total cost: " << total << ")" << std::endl << std::endl;
+    if (!origins.empty()) {
+        print_rollup(out, "Procedures:", values(procedures), sort, total);
+        print_rollup(out, "Loops (inclusive):", values(loops), sort, total);
+        print_rollup(out, "Source lines:", values(lines), sort, total);
+    }
+    print_rollup(out, "Instructions:", instructions, sort, total);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <program.mr> [--profile] [--map <file>] [--sort cost|count|line] [--report <file>] [--profile-out <file>] [--blocks <file>]" << std::endl;
+        return 1;
+    }
+
+    std::string programFile = argv[1];
+    std::string mapFile;
+    std::string reportFile;
+    std::string profileFile;
+    std::string blocksFile;
+    std::string sort = "cost";
+    bool profiling = false;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--profile") == 0) {
+            profiling = true;
+        } else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) {
+            mapFile = argv[++i];
+        } else if (strcmp(argv[i], "--sort") == 0 && i + 1 < argc) {
+            sort = argv[++i];
+        } else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            reportFile = argv[++i];
+        } else if (strcmp(argv[i], "--profile-out") == 0 && i + 1 < argc) {
+            profileFile = argv[++i];
+        } else if (strcmp(argv[i], "--blocks") == 0 && i + 1 < argc) {
+            blocksFile = argv[++i];
+        } else {
+            std::cerr << "Error: Unknown option " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    if (sort != "cost" && sort != "count" && sort != "line") {
+        std::cerr << "Error: Unknown sort key " << sort << std::endl;
+        return 1;
+    }
+
+    std::vector<Instruction> program;
+    std::vector<Origin> origins;
+    if (!load_program(programFile, program, origins)) {
+        return 1;
+    }
+
+    std::vector<Block> blocks;
+    if (!profileFile.empty()) {
+        if (blocksFile.empty()) {
+            blocksFile = programFile + ".blocks";
+        }
+        if (!load_blocks(blocksFile, blocks)) {
+            std::cerr << "Error: No blocks " << blocksFile << ", compile with --profile-generate" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<InstructionProfile> profile(program.size());
+    unsigned long long cost, io;
+    if (!run_machine(program, profiling || !profileFile.empty() ? &profile : nullptr, cost, io)) {
+        return 1;
+    }
+
+    std::cout << "Finished (cost: " << cost << "; i/o: " << io << "; instructions: " << program.size() << ")." << std::endl;
+
+    if (!profileFile.empty() && !save_block_profile(profileFile, blocks, profile)) {
+        std::cerr << "Error: Cannot write " << profileFile << std::endl;
+        return 1;
+    }
+
+    if (profiling) {
+        // A map given on the command line wins over the one inside a binary program
+        if (mapFile.empty() && origins.empty()) {
+            mapFile = programFile + ".map";
+        }
+        if (!mapFile.empty() && !load_map(mapFile, origins)) {
+            std::cerr << "Warning: No source map " << mapFile << ", reporting instructions only" << std::endl;
+        }
+
+        if (reportFile.empty()) {
+            print_report(std::cout, program, profile, origins, sort, cost);
+        } else {
+            std::ofstream report(reportFile);
+            print_report(report, program, profile, origins, sort, cost);
+        }
+    }
+
+    return 0;
+}